@@ -0,0 +1,465 @@
+/***************************************************************************
+* This file is part of last.fm fingerprint app                             *
+*  Last.fm Ltd <mir@last.fm>                                               *
+*                                                                          *
+* This library is free software; you can redistribute it and/or            *
+* modify it under the terms of the GNU Lesser General Public               *
+* License as published by the Free Software Foundation; either             *
+* version 2.1 of the License, or (at your option) any later version.       *
+*                                                                          *
+* This library is distributed in the hope that it will be useful,          *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+* Lesser General Public License for more details.                          *
+*                                                                          *
+* You should have received a copy of the GNU Lesser General Public         *
+* License along with this library; if not, write to the Free Software      *
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 *
+* USA                                                                      *
+***************************************************************************/
+
+// The fplib benchmarks. Not part of the default build: configure with
+// -DFPLIB_BUILD_BENCH=ON, then run fplib_bench [case...].
+// The times are wall clock, best of a few rounds, on one thread.
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include "../tests/TestUtils.h"
+#include "fp_helper_fun.h"
+#include "Filter.h"
+#include "OptFFT.h"
+#include "OptBits.h"
+#include "FloatingAverage.h"
+#include "CircularArray.h"
+#include "FingerprintIndex.h"
+#include "FingerprintIndexFile.h"
+
+// -----------------------------------------------------------------------------
+
+namespace
+{
+
+using namespace std;
+using namespace fingerprint;
+
+const int    BENCH_FREQ = 44100;
+const int    BENCH_NCHANNELS = 2;
+const size_t BENCH_ROUNDS = 3;
+
+// the catalog of the index benchmarks, made up: ~3 min tracks
+const size_t       BENCH_INDEX_TRACKS = 2000;
+const size_t       BENCH_INDEX_GROUPS = 5000;    // per track
+const unsigned int BENCH_INDEX_KEYS = 1000000;
+const size_t       BENCH_QUERIES = 200;
+const size_t       BENCH_QUERY_GROUPS = 300;     // ~10 secs
+
+void report(const char* what, double value, const char* unit)
+{
+   printf("   %-40s %10.3f %s\n", what, value, unit);
+}
+
+// What OptFFT gets for a block: the downsampled mono signal, plus the
+// frames that overlap the next block.
+vector<float> makeDownsampledBlock(unsigned int blockFrames)
+{
+   const size_t size = blockFrames * FRAMESIZE + FRAMESIZE - OVERLAPSAMPLES + Filter::KEYWIDTH * OVERLAPSAMPLES;
+   const vector<short> pcm = makeTestSignal(DFREQ, 1, static_cast<int>(size / DFREQ + 1), 5);
+
+   vector<float> block(size);
+   for ( size_t i = 0; i < size; ++i )
+      block[i] = pcm[i] / 32768.0f;
+   return block;
+}
+
+// pieces of the catalog tracks, at different places
+vector< vector<char> > makeQueries()
+{
+   vector< vector<char> > queries;
+   for ( size_t q = 0; q < BENCH_QUERIES; ++q )
+   {
+      const unsigned int trackId = static_cast<unsigned int>(q * 7919 % BENCH_INDEX_TRACKS);
+      const vector<char> fp = makeTestFingerprint(trackId, BENCH_INDEX_GROUPS, BENCH_INDEX_KEYS);
+      const size_t first = q * 104729 % (BENCH_INDEX_GROUPS - BENCH_QUERY_GROUPS);
+      queries.push_back( vector<char>(fp.begin() + first * 8, fp.begin() + (first + BENCH_QUERY_GROUPS) * 8) );
+   }
+   return queries;
+}
+
+vector<Filter> makeFilters()
+{
+   vector<Filter> filters;
+   for ( size_t i = 0; i < sizeof(rFilters) / sizeof(RawFilter); ++i )
+   {
+      const RawFilter& rf = rFilters[i];
+      filters.push_back( Filter(rf.ftid, rf.wt, rf.first_band, rf.wb, rf.filter_type, rf.thresh, rf.weight) );
+   }
+   return filters;
+}
+
+// -----------------------------------------------------------------------------
+
+// The setup cost of a track: a new extractor every time, or the same one
+// recycled with reset().
+void benchSetup()
+{
+   const size_t numTracks = 200;
+
+   double newTime = 1e30, resetTime = 1e30;
+   for ( size_t round = 0; round < BENCH_ROUNDS; ++round )
+   {
+      double start = wallClock();
+      for ( size_t i = 0; i < numTracks; ++i )
+      {
+         FingerprintExtractor fextr;
+         fextr.initForFullSubmit(BENCH_FREQ, BENCH_NCHANNELS);
+      }
+      newTime = min(newTime, wallClock() - start);
+
+      FingerprintExtractor fextr;
+      fextr.initForFullSubmit(BENCH_FREQ, BENCH_NCHANNELS);
+      start = wallClock();
+      for ( size_t i = 0; i < numTracks; ++i )
+         fextr.reset();
+      resetTime = min(resetTime, wallClock() - start);
+   }
+
+   report("new extractor + initForFullSubmit()", newTime / numTracks * 1e6, "us/track");
+   report("reset()", resetTime / numTracks * 1e6, "us/track");
+}
+
+// -----------------------------------------------------------------------------
+
+// The keys from the band energies of a block (the frame matrix of OptFFT),
+// then the whole extractor on a full submit.
+void benchKeys()
+{
+   const unsigned int blockFrames = FingerprintExtractor::DEFAULT_BLOCK_FRAMES;
+   vector<float> block = makeDownsampledBlock(blockFrames);
+
+   OptFFT fft(block.size());
+   const unsigned int numFrames = fft.process(&block[0], block.size());
+
+   OptBits bits(makeFilters(), fft.getMaxFrames());
+   vector<unsigned int> keys;
+
+   const size_t numBlocks = 20;
+   double bitsTime = 1e30;
+   for ( size_t round = 0; round < BENCH_ROUNDS; ++round )
+   {
+      const double start = wallClock();
+      for ( size_t i = 0; i < numBlocks; ++i )
+         bits.process(keys, fft.getFrames(), numFrames);
+      bitsTime = min(bitsTime, wallClock() - start);
+   }
+
+   report("OptBits::process", bitsTime / (numBlocks * numFrames) * 1e9, "ns/frame");
+
+   const int secs = 60;
+   const vector<short> pcm = makeTestSignal(BENCH_FREQ, BENCH_NCHANNELS, secs, 6);
+
+   double fullTime = 1e30;
+   for ( size_t round = 0; round < BENCH_ROUNDS; ++round )
+   {
+      FingerprintExtractor fextr;
+      fextr.initForFullSubmit(BENCH_FREQ, BENCH_NCHANNELS);
+
+      const double start = wallClock();
+      fingerprintOf(fextr, &pcm[0], pcm.size());
+      fullTime = min(fullTime, wallClock() - start);
+   }
+
+   report("full submit, 44100 Hz stereo", secs / fullTime, "x realtime");
+}
+
+// -----------------------------------------------------------------------------
+
+// The spectrum of a block: windowing, FFT and band energies.
+void benchFFT()
+{
+   const unsigned int blockFrames = FingerprintExtractor::DEFAULT_BLOCK_FRAMES;
+   vector<float> block = makeDownsampledBlock(blockFrames);
+
+   OptFFT fft(block.size());
+   unsigned int numFrames = 0;
+
+   const size_t numBlocks = 20;
+   double fftTime = 1e30;
+   for ( size_t round = 0; round < BENCH_ROUNDS; ++round )
+   {
+      const double start = wallClock();
+      for ( size_t i = 0; i < numBlocks; ++i )
+         numFrames = fft.process(&block[0], block.size());
+      fftTime = min(fftTime, wallClock() - start);
+   }
+
+   report("OptFFT::process", fftTime / (numBlocks * numFrames) * 1e6, "us/frame");
+}
+
+// -----------------------------------------------------------------------------
+
+// FloatingAverage as it was on CircularArray, before the ring buffer: the
+// baseline of benchRing().
+class CircularAverage
+{
+public:
+   CircularAverage(size_t size)
+   : m_bufferFilled(false), m_sum(0)
+   {
+      m_values.resize(size);
+      m_valIt = m_values.head();
+   }
+
+   void add(double value)
+   {
+      m_sum += value;
+
+      if ( m_bufferFilled )
+         m_sum -= *m_valIt;
+
+      *m_valIt = value;
+      ++m_valIt;
+      if ( m_valIt == m_values.head() )
+         m_bufferFilled = true;
+   }
+
+   double getAverage() const
+   {
+      if ( !m_bufferFilled )
+         return m_sum / (m_valIt - m_values.head());
+      else
+         return m_sum / m_values.size();
+   }
+
+private:
+   CircularArray<double>           m_values;
+   CircularArray<double>::iterator m_valIt;
+
+   bool   m_bufferFilled;
+   double m_sum;
+};
+
+// The moving average of normalize(), over its 5 secs window: the old
+// CircularArray one, FloatingAverage a sample at a time, and addBlock().
+void benchRing()
+{
+   const size_t windowSize = static_cast<size_t>(NORMALIZATION_SKIP_SECS * 2 * DFREQ);
+   const size_t numSamples = 20 * windowSize;
+   const size_t blockSize = 1024;
+
+   const vector<float> block = makeDownsampledBlock(numSamples / FRAMESIZE);
+   vector<double> squares(numSamples);
+   for ( size_t i = 0; i < numSamples; ++i )
+      squares[i] = block[i] * block[i];
+   vector<double> averages(numSamples);
+
+   double circularTime = 1e30, ringTime = 1e30, blockTime = 1e30;
+   for ( size_t round = 0; round < BENCH_ROUNDS; ++round )
+   {
+      CircularAverage circular(windowSize);
+      double start = wallClock();
+      for ( size_t i = 0; i < numSamples; ++i )
+      {
+         averages[i] = circular.getAverage();
+         circular.add(squares[i]);
+      }
+      circularTime = min(circularTime, wallClock() - start);
+
+      FloatingAverage<double> ring(windowSize);
+      start = wallClock();
+      for ( size_t i = 0; i < numSamples; ++i )
+      {
+         averages[i] = ring.getAverage();
+         ring.add(squares[i]);
+      }
+      ringTime = min(ringTime, wallClock() - start);
+
+      FloatingAverage<double> ringBlocks(windowSize);
+      start = wallClock();
+      for ( size_t i = 0; i < numSamples; i += blockSize )
+         ringBlocks.addBlock(&squares[i], min(blockSize, numSamples - i), &averages[i]);
+      blockTime = min(blockTime, wallClock() - start);
+   }
+
+   report("CircularArray add + getAverage", circularTime / numSamples * 1e9, "ns/sample");
+   report("FloatingAverage add + getAverage", ringTime / numSamples * 1e9, "ns/sample");
+   report("FloatingAverage::addBlock", blockTime / numSamples * 1e9, "ns/sample");
+}
+
+// -----------------------------------------------------------------------------
+
+// A full submit with blocks of a few sizes: the throughput, and what each
+// block costs, that is how late its keys come on a live stream.
+void benchBlockSize()
+{
+   const unsigned int blockSizes[] = { 7, 16, 32, 64, 128 };
+
+   const int secs = 60;
+   const vector<short> pcm = makeTestSignal(BENCH_FREQ, BENCH_NCHANNELS, secs, 7);
+
+   for ( size_t b = 0; b < sizeof(blockSizes) / sizeof(unsigned int); ++b )
+   {
+      const unsigned int blockFrames = blockSizes[b];
+
+      double fullTime = 1e30;
+      for ( size_t round = 0; round < BENCH_ROUNDS; ++round )
+      {
+         FingerprintExtractor fextr(blockFrames);
+         fextr.initForFullSubmit(BENCH_FREQ, BENCH_NCHANNELS);
+
+         const double start = wallClock();
+         fingerprintOf(fextr, &pcm[0], pcm.size());
+         fullTime = min(fullTime, wallClock() - start);
+      }
+
+      const double numBlocks = static_cast<double>(secs) * DFREQ / (blockFrames * FRAMESIZE);
+
+      char what[64];
+      sprintf(what, "%u frames, full submit", blockFrames);
+      report(what, secs / fullTime, "x realtime");
+      sprintf(what, "%u frames, per block", blockFrames);
+      report(what, fullTime / numBlocks * 1e3, "ms/block");
+   }
+}
+
+// -----------------------------------------------------------------------------
+
+// The in-memory index: adding the catalog, then the queries.
+void benchIndex()
+{
+   FingerprintIndex index;
+
+   const double buildStart = wallClock();
+   for ( size_t t = 0; t < BENCH_INDEX_TRACKS; ++t )
+   {
+      const vector<char> fp = makeTestFingerprint(static_cast<unsigned int>(t), BENCH_INDEX_GROUPS, BENCH_INDEX_KEYS);
+      index.addTrack( static_cast<unsigned int>(t), &fp[0], fp.size() );
+   }
+   report("FingerprintIndex::addTrack", (wallClock() - buildStart) / BENCH_INDEX_TRACKS * 1e6, "us/track");
+
+   const vector< vector<char> > queries = makeQueries();
+   vector<IndexMatch> matches;
+
+   double queryTime = 1e30;
+   for ( size_t round = 0; round < BENCH_ROUNDS; ++round )
+   {
+      const double start = wallClock();
+      for ( size_t q = 0; q < queries.size(); ++q )
+         index.query( &queries[q][0], queries[q].size(), matches );
+      queryTime = min(queryTime, wallClock() - start);
+   }
+
+   report("FingerprintIndex::query", queryTime / queries.size() * 1e3, "ms/query");
+}
+
+// -----------------------------------------------------------------------------
+
+// The same catalog in an index file: writing it (in memory, then spilling
+// a run every ~100 tracks), opening it, and the queries on the mapped pages.
+void benchMapped()
+{
+   const char* fileName = "fplib_bench_index.tmp";
+   const size_t memoryLimits[] = { FingerprintIndexBuilder::DEFAULT_MAX_MEMORY, 100 * BENCH_INDEX_GROUPS * 12 };
+
+   for ( size_t m = 0; m < sizeof(memoryLimits) / sizeof(size_t); ++m )
+   {
+      FingerprintIndexBuilder builder(memoryLimits[m]);
+
+      const double start = wallClock();
+      for ( size_t t = 0; t < BENCH_INDEX_TRACKS; ++t )
+      {
+         const vector<char> fp = makeTestFingerprint(static_cast<unsigned int>(t), BENCH_INDEX_GROUPS, BENCH_INDEX_KEYS);
+         builder.addTrack( static_cast<unsigned int>(t), &fp[0], fp.size() );
+      }
+      builder.write(fileName);
+
+      report( m == 0 ? "FingerprintIndexBuilder, in memory" : "FingerprintIndexBuilder, spilled",
+              (wallClock() - start) / BENCH_INDEX_TRACKS * 1e6, "us/track" );
+   }
+
+   double openTime = 1e30;
+   for ( size_t round = 0; round < BENCH_ROUNDS; ++round )
+   {
+      const double start = wallClock();
+      MappedFingerprintIndex index(fileName);
+      openTime = min(openTime, wallClock() - start);
+   }
+   report("MappedFingerprintIndex ctor", openTime * 1e3, "ms");
+
+   const vector< vector<char> > queries = makeQueries();
+   vector<IndexMatch> matches;
+
+   double queryTime = 1e30;
+   {
+      MappedFingerprintIndex index(fileName);
+      for ( size_t round = 0; round < BENCH_ROUNDS; ++round )
+      {
+         const double start = wallClock();
+         for ( size_t q = 0; q < queries.size(); ++q )
+            index.query( &queries[q][0], queries[q].size(), matches );
+         queryTime = min(queryTime, wallClock() - start);
+      }
+   }
+   report("MappedFingerprintIndex::query", queryTime / queries.size() * 1e3, "ms/query");
+
+   remove(fileName);
+}
+
+// -----------------------------------------------------------------------------
+
+struct BenchCase
+{
+   const char* name;
+   void (*run)();
+};
+
+const BenchCase cases[] = {
+   { "setup",     benchSetup },
+   { "keys",      benchKeys },
+   { "fft",       benchFFT },
+   { "ring",      benchRing },
+   { "blocksize", benchBlockSize },
+   { "index",     benchIndex },
+   { "mapped",    benchMapped },
+};
+
+bool isSelected(const char* name, int argc, char* argv[])
+{
+   if ( argc < 2 )
+      return true;
+
+   for ( int i = 1; i < argc; ++i )
+   {
+      if ( strcmp(argv[i], name) == 0 )
+         return true;
+   }
+   return false;
+}
+
+} // end of anonymous namespace
+
+// -----------------------------------------------------------------------------
+
+// with arguments, only the cases named
+int main(int argc, char* argv[])
+{
+   try
+   {
+      for ( size_t i = 0; i < sizeof(cases) / sizeof(BenchCase); ++i )
+      {
+         if ( !isSelected(cases[i].name, argc, argv) )
+            continue;
+
+         printf("%s\n", cases[i].name);
+         cases[i].run();
+      }
+   }
+   catch ( const std::exception& e )
+   {
+      fprintf(stderr, "%s\n", e.what());
+      return 1;
+   }
+
+   return 0;
+}
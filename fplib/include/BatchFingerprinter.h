@@ -0,0 +1,105 @@
+/***************************************************************************
+* This file is part of last.fm fingerprint app                             *
+*  Last.fm Ltd <mir@last.fm>                                               *
+*                                                                          *
+* This library is free software; you can redistribute it and/or            *
+* modify it under the terms of the GNU Lesser General Public               *
+* License as published by the Free Software Foundation; either             *
+* version 2.1 of the License, or (at your option) any later version.       *
+*                                                                          *
+* This library is distributed in the hope that it will be useful,          *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+* Lesser General Public License for more details.                          *
+*                                                                          *
+* You should have received a copy of the GNU Lesser General Public         *
+* License along with this library; if not, write to the Free Software      *
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 *
+* USA                                                                      *
+***************************************************************************/
+
+#ifndef __BATCH_FINGERPRINTER_H
+#define __BATCH_FINGERPRINTER_H
+
+#include <vector>
+#include <string>
+#include <cstddef> // for size_t
+
+namespace fingerprint {
+
+// -----------------------------------------------------------------------------
+
+// Anything that can deliver PCM data to the BatchFingerprinter.
+// Each source is read by exactly one worker thread at a time, so
+// implementations don't need to be thread safe.
+class PCMSource
+{
+public:
+
+   virtual ~PCMSource() {}
+
+   virtual int getFreq() const = 0;
+   virtual int getNumChannels() const = 0;
+
+   // duration in seconds, or -1 if unknown (see FingerprintExtractor::initForQuery)
+   virtual int getDuration() const { return -1; }
+
+   // fill pPCM with up to num_samples interleaved samples (i.e. [L][R][L][R]..)
+   // and return how many have been written. 0 means end of stream.
+   virtual size_t read(short* pPCM, size_t num_samples) = 0;
+};
+
+// -----------------------------------------------------------------------------
+
+struct BatchResult
+{
+   size_t             index;        // position of the source in the list given to start()
+   bool               success;
+   std::string        error;        // the reason of the failure if !success
+   std::vector<char>  fingerprint;  // what FingerprintExtractor::getFingerprint() returned
+};
+
+// -----------------------------------------------------------------------------
+
+class BatchPimplData;
+
+class BatchFingerprinter
+{
+public:
+
+   enum eMode
+   {
+      FOR_QUERY,
+      FOR_FULLSUBMIT
+   };
+
+   // numThreads == 0 means one worker per core
+   BatchFingerprinter(size_t numThreads = 0, eMode mode = FOR_QUERY); // ctor
+   ~BatchFingerprinter(); // dtor, waits for the running jobs to finish
+
+   // Queue the sources on the workers. The sources must stay alive until
+   // their result has been returned by getNextResult().
+   // IMPORTANT: call it again only when all the results of the previous
+   //            batch have been collected!
+   void start(const std::vector<PCMSource*>& sources);
+
+   // Blocks until one of the sources is done (in completion order, not in the
+   // order they were given!). Returns false when all the results of the
+   // current batch have been returned.
+   bool getNextResult(BatchResult& result);
+
+   size_t getNumThreads() const;
+
+private:
+
+   BatchFingerprinter(const BatchFingerprinter&);
+   BatchFingerprinter& operator=(const BatchFingerprinter&);
+
+   BatchPimplData* m_pPimplData;
+};
+
+// -----------------------------------------------------------------------------
+
+} // end of namespace fingerprint
+
+#endif // __BATCH_FINGERPRINTER_H
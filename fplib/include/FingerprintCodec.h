@@ -0,0 +1,64 @@
+/***************************************************************************
+* This file is part of last.fm fingerprint app                             *
+*  Last.fm Ltd <mir@last.fm>                                               *
+*                                                                          *
+* This library is free software; you can redistribute it and/or            *
+* modify it under the terms of the GNU Lesser General Public               *
+* License as published by the Free Software Foundation; either             *
+* version 2.1 of the License, or (at your option) any later version.       *
+*                                                                          *
+* This library is distributed in the hope that it will be useful,          *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+* Lesser General Public License for more details.                          *
+*                                                                          *
+* You should have received a copy of the GNU Lesser General Public         *
+* License along with this library; if not, write to the Free Software      *
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 *
+* USA                                                                      *
+***************************************************************************/
+
+#ifndef __FINGERPRINT_CODEC_H
+#define __FINGERPRINT_CODEC_H
+
+#include <vector>
+#include <cstddef> // for size_t
+
+namespace fingerprint {
+
+// -----------------------------------------------------------------------------
+
+// A compact format for the fingerprints, to store or send them. The legacy
+// one of FingerprintExtractor::getFingerprint() (8 bytes per group) is still
+// what the last.fm fingerprint service wants: this is on top of it.
+//
+//   byte 0    format version (FINGERPRINT_CODEC_VERSION)
+//   byte 1    flags (FINGERPRINT_CODEC_LZ)
+//   varint    number of groups
+//   [varint   size of the Stream VByte payload, only with FINGERPRINT_CODEC_LZ]
+//   payload   Stream VByte of key XOR previous key, count, for every group
+//             (padded with zeros to a multiple of four values), or its LZ
+//             compressed version
+//
+// Consecutive keys only differ by a few bits and the counts are small, so
+// most groups take 3 to 5 bytes instead of 8. The LZ stage also squeezes the
+// repeated sections of a track (a chorus, a loop): it is worth it for the
+// full submits, less for the queries.
+
+static const unsigned char FINGERPRINT_CODEC_VERSION = 1;
+static const unsigned char FINGERPRINT_CODEC_LZ = 0x01;
+
+// Puts in out (cleared first) the compact form of a fingerprint as returned
+// by getFingerprint(). Throws if size is not a multiple of 8.
+void encodeFingerprint(const char* pData, size_t size, std::vector<char>& out, bool useLZ = false);
+
+// Puts in out (cleared first) the legacy form of a compact fingerprint, ready
+// for the fingerprint service. Throws if the data is corrupted or of an
+// unknown version.
+void decodeFingerprint(const char* pData, size_t size, std::vector<char>& out);
+
+// -----------------------------------------------------------------------------
+
+} // end of namespace fingerprint
+
+#endif // __FINGERPRINT_CODEC_H
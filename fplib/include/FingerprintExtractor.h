@@ -28,6 +28,9 @@
 
 #include <utility> // for pair
 #include <cstddef> // for size_t
+#include <cstdio>  // for FILE
+#include <vector>
+#include <string>
 
 namespace fingerprint {
 
@@ -35,18 +38,124 @@ namespace fingerprint {
 
 class PimplData;
 
+// A run of identical keys, as handed out by the streaming mode
+struct StreamGroup
+{
+   unsigned int key;
+   unsigned int count;   // how many consecutive frames (~11.6 ms apart) share the key
+   double       startMs; // time of the first of them, since the start of the stream
+};
+
+// -----------------------------------------------------------------------------
+
+// Where a full submit puts its keys as the blocks complete, instead of
+// keeping the whole track in memory. Derive from it to get them in a
+// callback, or use the FileGroupSink below.
+class GroupSink
+{
+public:
+
+   virtual ~GroupSink() {}
+
+   // size bytes of fingerprint, in the same format of getFingerprint().
+   // The groups come in order, and one is never split across two calls.
+   virtual void write(const char* data, size_t size) = 0;
+
+   // the stream is over: nothing else will be written
+   virtual void finish() {}
+
+   // What FingerprintExtractor::getFingerprint() returns once the stream is
+   // over. A sink that hands the data over without keeping it returns pair<NULL, 0>.
+   virtual std::pair<const char*, size_t> getFingerprint()
+   { return std::make_pair(static_cast<const char*>(0), static_cast<size_t>(0)); }
+};
+
+// Writes the fingerprint to a file. getFingerprint() reads it back in
+// memory, so skip it and use the file if the track is very long.
+class FileGroupSink : public GroupSink
+{
+public:
+
+   // throws if the file can't be created
+   explicit FileGroupSink(const std::string& fileName);
+   ~FileGroupSink();
+
+   void write(const char* data, size_t size);
+   void finish();
+   std::pair<const char*, size_t> getFingerprint();
+
+private:
+
+   FileGroupSink(const FileGroupSink&);
+   FileGroupSink& operator=(const FileGroupSink&);
+
+   std::string       m_fileName;
+   FILE*             m_pFile;
+   std::vector<char> m_data;
+};
+
+// -----------------------------------------------------------------------------
+
 class FingerprintExtractor
 {
 public:
 
-   FingerprintExtractor(); // ctor
+   // The audio is processed in blocks of blockFrames * 2048 downsampled
+   // samples at 5512 Hz (~0.37 secs per frame). Small blocks
+   // deliver the keys sooner, which suits live streams; large blocks make
+   // fewer and bigger FFT batches. The minimum is 7 (~2.6 secs).
+   // The integral image of the bands restarts with every block, so other
+   // block sizes give slightly different keys (~3% of them on a full track):
+   // keep the default for the fingerprints matched against the last.fm ones.
+   static const unsigned int DEFAULT_BLOCK_FRAMES = 32; // ~= 12 secs.
+
+   explicit FingerprintExtractor(unsigned int blockFrames = DEFAULT_BLOCK_FRAMES); // ctor
    ~FingerprintExtractor(); // dtor
 
    // duration (in seconds!) is optional, but if you want to submit tracks <34 secs
    // it must be provided. 
    void initForQuery(int freq, int nchannels, int duration = -1);
+
+   // For seekable sources: the data given to process() starts at startFrame
+   // of the track instead of its beginning, so there is no need to decode
+   // what the query skips anyway. startFrame can't be past the first frame
+   // of getQueryRange().
+   void initForQuery(int freq, int nchannels, int duration, size_t startFrame);
+
+   // The frames [first, second) of the track that a query actually reads:
+   // seek to first, then initForQuery(freq, nchannels, duration, first) and
+   // decode up to second. In the unlucky case process() still wants more,
+   // just keep decoding after second.
+   std::pair<size_t, size_t> getQueryRange(int freq, int nchannels, int duration = -1) const;
    void initForFullSubmit(int freq, int nchannels);
 
+   // The same, but the keys go to pSink as the blocks complete and the
+   // memory doesn't grow with the length of the track. getFingerprint()
+   // returns what pSink->getFingerprint() does. The sink is not owned, and
+   // must stay alive until the extractor is initialized again. A sink is
+   // good for one track: for the next one, pass a new sink here again.
+   void initForFullSubmit(int freq, int nchannels, GroupSink* pSink);
+
+   // For endless streams (e.g. live radio): nothing is skipped, there's no
+   // final fingerprint and getFingerprint() stays empty. The keys are handed
+   // out by pollKeys() after every processed block instead (see the block
+   // size in the ctor), and process() only returns true once the
+   // end_of_stream has been given and the last keys flushed (it can come
+   // with no samples). A stream shorter than the first block has no keys.
+   void initForStream(int freq, int nchannels);
+
+   // Streaming mode only: moves the groups of keys produced since the last
+   // call into groups (which is cleared first) and returns how many they are.
+   // Memory stays bounded as long as this is called regularly.
+   size_t pollKeys(std::vector<StreamGroup>& groups);
+
+   // Get ready for a new stream with the same parameters (freq, channels,
+   // duration and type) of the last initForQuery()/initForFullSubmit().
+   // The sink is not kept: the keys go to memory, as without one.
+   // The FFT plan, the buffers and the resampler are all kept, so this is
+   // the cheap way to recycle the same extractor for many tracks.
+   void reset();
+
    // return false if it needs more data, otherwise true
    // IMPORTANT: num_samples specify the size of the *short* array pPCM, that is
    //            the number of samples that are in the buffer. This includes
@@ -54,6 +163,17 @@ public:
    //            [L][R][L][R][L][R][L][R] would be num_samples=8
    bool process(const short* pPCM, size_t num_samples, bool end_of_stream = false);
 
+   // The same for the other sample formats, so that the output of any decoder
+   // is converted only once. Any number of channels is mixed down to mono.
+   // Interleaved float in [-1, 1], 32 bits, and 24 bits packed little endian
+   // (3 bytes per sample). num_samples as above.
+   bool processFloat(const float* pPCM, size_t num_samples, bool end_of_stream = false);
+   bool processInt32(const int* pPCM, size_t num_samples, bool end_of_stream = false);
+   bool processInt24(const unsigned char* pPCM, size_t num_samples, bool end_of_stream = false);
+   // Planar float: ppChannels[c] holds num_frames samples of the channel c.
+   // Notice that this is num_frames, not num_samples!
+   bool processPlanarFloat(const float* const* ppChannels, size_t num_frames, bool end_of_stream = false);
+
    // returns pair<NULL, 0> if the data is not ready
    std::pair<const char*, size_t> getFingerprint();
 
@@ -72,6 +192,42 @@ public:
    // return the version of the fingerprint
    static size_t getVersion();
 
+   // Downsample the usual frequencies (44100, 48000, 22050, 32000, 96000...)
+   // with a built-in fixed ratio filter instead of libsamplerate. It is a lot
+   // faster, but the keys are not bit exact with the ones of libsamplerate:
+   // leave it off if the fingerprints are matched against the last.fm ones.
+   // Default is off; takes effect from the next init.
+   void setFastResampling(bool enable);
+
+   //////////////////////////////////////////////////////////////////////////
+
+   // The FFT plans are made once per process and shared by all the
+   // extractors. These settings only affect the plans made after the call,
+   // so set them up before creating the first extractor.
+   // FFT_MEASURE and FFT_PATIENT time several FFT algorithms and keep the
+   // fastest, and those round differently: the keys can change a little
+   // between runs, machines and wisdom files. Only FFT_ESTIMATE is
+   // guaranteed to give the keys of the fingerprints of the last.fm server.
+
+   enum eFFTPlanner
+   {
+      FFT_ESTIMATE, // default: instant planning, decent transform
+      FFT_MEASURE,  // a few seconds of planning, faster transform
+      FFT_PATIENT   // much slower planning, sometimes a bit faster again
+   };
+
+   static void setFFTPlanner(eFFTPlanner planner);
+
+   // Save/restore what FFTW learnt while planning, so that FFT_MEASURE and
+   // FFT_PATIENT only pay the planning time once per machine.
+   // Return false if the file can't be read/written.
+   static bool importFFTWisdom(const char* filename);
+   static bool exportFFTWisdom(const char* filename);
+
+   // The same, done for you: loads the wisdom of filename now (returns false
+   // if there is none yet) and saves it back there whenever a new plan is made.
+   static bool setFFTWisdomFile(const char* filename);
+
 private:
 
    PimplData* m_pPimplData;
@@ -0,0 +1,83 @@
+/***************************************************************************
+* This file is part of last.fm fingerprint app                             *
+*  Last.fm Ltd <mir@last.fm>                                               *
+*                                                                          *
+* This library is free software; you can redistribute it and/or            *
+* modify it under the terms of the GNU Lesser General Public               *
+* License as published by the Free Software Foundation; either             *
+* version 2.1 of the License, or (at your option) any later version.       *
+*                                                                          *
+* This library is distributed in the hope that it will be useful,          *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+* Lesser General Public License for more details.                          *
+*                                                                          *
+* You should have received a copy of the GNU Lesser General Public         *
+* License along with this library; if not, write to the Free Software      *
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 *
+* USA                                                                      *
+***************************************************************************/
+
+#ifndef __FINGERPRINT_INDEX_H
+#define __FINGERPRINT_INDEX_H
+
+#include <vector>
+#include <cstddef> // for size_t
+
+namespace fingerprint {
+
+// -----------------------------------------------------------------------------
+
+// A track found by a query
+struct IndexMatch
+{
+   unsigned int trackId;
+   int          offset; // where the query starts in the track, in keys (~11.6 ms each)
+   unsigned int votes;  // how many keys of the query agree on that offset
+};
+
+// -----------------------------------------------------------------------------
+
+class IndexPimplData;
+
+// An in-process stand-in for the fingerprint service: the full submits of
+// the catalog go in, the queries get back the tracks they come from.
+// Every group of keys is listed under its key with its track and position
+// (an inverted index). A query looks up its keys, and every track position
+// found votes for an offset between the query and that track: the real
+// match is where many keys agree on the same offset, while the keys that
+// just happen to be shared scatter their votes.
+// The queries don't change the index, so they can run concurrently, but
+// not while tracks are being added.
+class FingerprintIndex
+{
+public:
+
+   FingerprintIndex(); // ctor
+   ~FingerprintIndex(); // dtor
+
+   // Adds a fingerprint as returned by getFingerprint(), usually a full
+   // submit, under trackId. Throws if it is not a fingerprint.
+   void addTrack(unsigned int trackId, const char* pData, size_t size);
+
+   size_t getNumTracks() const;
+
+   // Puts in matches (cleared first) the tracks that share the most keys
+   // with the query fingerprint at a consistent offset, the best first.
+   // Tracks with less than minVotes votes are left out.
+   void query( const char* pData, size_t size, std::vector<IndexMatch>& matches,
+               size_t maxResults = 5, unsigned int minVotes = 10 ) const;
+
+private:
+
+   FingerprintIndex(const FingerprintIndex&);
+   FingerprintIndex& operator=(const FingerprintIndex&);
+
+   IndexPimplData* m_pPimplData;
+};
+
+// -----------------------------------------------------------------------------
+
+} // end of namespace fingerprint
+
+#endif // __FINGERPRINT_INDEX_H
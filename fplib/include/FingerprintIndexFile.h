@@ -0,0 +1,129 @@
+/***************************************************************************
+* This file is part of last.fm fingerprint app                             *
+*  Last.fm Ltd <mir@last.fm>                                               *
+*                                                                          *
+* This library is free software; you can redistribute it and/or            *
+* modify it under the terms of the GNU Lesser General Public               *
+* License as published by the Free Software Foundation; either             *
+* version 2.1 of the License, or (at your option) any later version.       *
+*                                                                          *
+* This library is distributed in the hope that it will be useful,          *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+* Lesser General Public License for more details.                          *
+*                                                                          *
+* You should have received a copy of the GNU Lesser General Public         *
+* License along with this library; if not, write to the Free Software      *
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 *
+* USA                                                                      *
+***************************************************************************/
+
+#ifndef __FINGERPRINT_INDEX_FILE_H
+#define __FINGERPRINT_INDEX_FILE_H
+
+#include <string>
+#include <vector>
+#include <cstddef> // for size_t
+
+#include "FingerprintIndex.h" // for IndexMatch
+
+namespace fingerprint {
+
+// -----------------------------------------------------------------------------
+
+// The on-disk form of FingerprintIndex, for catalogs that don't fit (or
+// take too long to build) on the heap. The file is written once by
+// FingerprintIndexBuilder and never changed: MappedFingerprintIndex maps it
+// and answers the queries straight from the mapped pages, so opening it
+// costs nothing whatever its size, and all the processes that map the same
+// file share one copy in the page cache.
+//
+// All the numbers are little endian, every section starts on a page
+// (INDEX_FILE_PAGE_SIZE bytes). The header comes first, the other sections
+// can be in any order (the builder writes the postings first):
+//
+//   header    magic "LFPI", version, counts, where the sections are
+//   buckets   65537 x 32 bits: the first key of the directory for each
+//             value of the top 16 bits of the key
+//   keys      numKeys x 32 bits: every key, sorted
+//   postings  for every key: varint count, then for every (track, position)
+//             sorted by track and position, varint track - previous track,
+//             varint position (- previous position within the same track)
+//   offsets   (numKeys + 1) x 64 bits: where the postings of each key start
+
+static const unsigned int INDEX_FILE_VERSION = 1;
+static const size_t INDEX_FILE_PAGE_SIZE = 4096;
+
+// -----------------------------------------------------------------------------
+
+class IndexBuilderPimplData;
+
+// Collects the full submits of a catalog and writes the index file.
+// The postings take 12 bytes per group. Up to maxMemory bytes of them stay
+// in memory, then they are sorted and spilled to a temporary file, and
+// write() merges all these runs back. So the catalog is limited by the disk
+// (about twice the postings, while writing) and by the open files, one per
+// run: with the default maxMemory a run holds ~22 million groups, and 1000
+// runs ~22 billion. write() also keeps 12 bytes per distinct key in memory.
+class FingerprintIndexBuilder
+{
+public:
+
+   static const size_t DEFAULT_MAX_MEMORY = 256 * 1024 * 1024;
+
+   explicit FingerprintIndexBuilder(size_t maxMemory = DEFAULT_MAX_MEMORY); // ctor
+   ~FingerprintIndexBuilder(); // dtor
+
+   // Adds a fingerprint as returned by getFingerprint() under trackId.
+   // Throws if it is not a fingerprint or if the track is already there.
+   void addTrack(unsigned int trackId, const char* pData, size_t size);
+
+   size_t getNumTracks() const;
+
+   // Writes the index file, throws if it can't. More tracks can still be
+   // added after, and written again.
+   void write(const std::string& fileName);
+
+private:
+
+   FingerprintIndexBuilder(const FingerprintIndexBuilder&);
+   FingerprintIndexBuilder& operator=(const FingerprintIndexBuilder&);
+
+   IndexBuilderPimplData* m_pPimplData;
+};
+
+// -----------------------------------------------------------------------------
+
+class MappedIndexPimplData;
+
+// A read only index file, mapped in memory. The queries can run concurrently.
+class MappedFingerprintIndex
+{
+public:
+
+   // Maps fileName. Throws if it can't, or if it is not an index file of
+   // this version.
+   explicit MappedFingerprintIndex(const std::string& fileName); // ctor
+   ~MappedFingerprintIndex(); // dtor
+
+   size_t getNumTracks() const;
+   size_t getNumKeys() const;
+
+   // Same as FingerprintIndex::query(). Throws if the postings it reads
+   // turn out to be corrupted.
+   void query( const char* pData, size_t size, std::vector<IndexMatch>& matches,
+               size_t maxResults = 5, unsigned int minVotes = 10 ) const;
+
+private:
+
+   MappedFingerprintIndex(const MappedFingerprintIndex&);
+   MappedFingerprintIndex& operator=(const MappedFingerprintIndex&);
+
+   MappedIndexPimplData* m_pPimplData;
+};
+
+// -----------------------------------------------------------------------------
+
+} // end of namespace fingerprint
+
+#endif // __FINGERPRINT_INDEX_FILE_H
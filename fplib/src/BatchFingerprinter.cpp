@@ -0,0 +1,371 @@
+/***************************************************************************
+* This file is part of last.fm fingerprint app                             *
+*  Last.fm Ltd <mir@last.fm>                                               *
+*                                                                          *
+* This library is free software; you can redistribute it and/or            *
+* modify it under the terms of the GNU Lesser General Public               *
+* License as published by the Free Software Foundation; either             *
+* version 2.1 of the License, or (at your option) any later version.       *
+*                                                                          *
+* This library is distributed in the hope that it will be useful,          *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+* Lesser General Public License for more details.                          *
+*                                                                          *
+* You should have received a copy of the GNU Lesser General Public         *
+* License along with this library; if not, write to the Free Software      *
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 *
+* USA                                                                      *
+***************************************************************************/
+
+#include <deque>
+#include <vector>
+#include <stdexcept>
+#include <algorithm>
+
+#include "../include/BatchFingerprinter.h"
+#include "../include/FingerprintExtractor.h"
+#include "Threading.h"
+
+//////////////////////////////////////////////////////////////////////////
+
+namespace fingerprint
+{
+
+using namespace std;
+
+// same as the client: any size is fine, but the extractor is happier with 2^x
+static const size_t BATCH_PCM_BUFFER_SIZE = 131072;
+
+//////////////////////////////////////////////////////////////////////////
+
+struct BatchWorker
+{
+   BatchWorker() : pExtractor(NULL), pPimplData(NULL), id(0)
+   {
+      pPCMBuffers[0] = pPCMBuffers[1] = NULL;
+   }
+
+   ~BatchWorker()
+   {
+      delete pExtractor;
+      delete [] pPCMBuffers[0];
+      delete [] pPCMBuffers[1];
+   }
+
+   // every worker keeps its own extractor (and its FFT plan and buffers) alive
+   // for the whole life of the pool
+   FingerprintExtractor* pExtractor;
+   short*                pPCMBuffers[2];
+
+   // the jobs of this worker. The owner pops from the front,
+   // the others steal from the back.
+   Mutex                 queueMutex;
+   deque<size_t>         queue;
+
+   Thread                thread;
+   BatchPimplData*       pPimplData;
+   size_t                id;
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+class BatchPimplData
+{
+public:
+
+   BatchPimplData(size_t numThreads, BatchFingerprinter::eMode mode)
+   : m_mode(mode), m_batchId(0), m_outstanding(0), m_shutdown(false)
+   {
+      if ( numThreads == 0 )
+         numThreads = Thread::getNumCores();
+
+      // every worker creates its own extractor with its first job
+      m_workers.resize(numThreads, NULL);
+      try
+      {
+         for ( size_t i = 0; i < numThreads; ++i )
+         {
+            BatchWorker* pWorker = new BatchWorker();
+            m_workers[i] = pWorker;
+
+            pWorker->pPCMBuffers[0] = new short[BATCH_PCM_BUFFER_SIZE];
+            pWorker->pPCMBuffers[1] = new short[BATCH_PCM_BUFFER_SIZE];
+            pWorker->pPimplData = this;
+            pWorker->id = i;
+         }
+
+         for ( size_t i = 0; i < numThreads; ++i )
+            m_workers[i]->thread.start(&BatchPimplData::workerMain, m_workers[i]);
+      }
+      catch (...)
+      {
+         // no dtor after a throwing ctor: the threads already started
+         // would run on with a dangling pointer
+         stopWorkers();
+         throw;
+      }
+   }
+
+   ~BatchPimplData()
+   {
+      // drop what's still queued, the workers will just finish their current job
+      for ( size_t i = 0; i < m_workers.size(); ++i )
+      {
+         ScopedLock lock(m_workers[i]->queueMutex);
+         m_workers[i]->queue.clear();
+      }
+
+      stopWorkers();
+   }
+
+   // Ends the threads (the ones started) and deletes the workers.
+   void stopWorkers()
+   {
+      {
+         ScopedLock lock(m_mutex);
+         m_shutdown = true;
+         m_workCond.broadcast();
+      }
+
+      // all of them, before deleting any: a worker still running might be
+      // looking into the queue of another one
+      for ( size_t i = 0; i < m_workers.size(); ++i )
+      {
+         if ( m_workers[i] )
+            m_workers[i]->thread.join();
+      }
+
+      for ( size_t i = 0; i < m_workers.size(); ++i )
+         delete m_workers[i];
+   }
+
+   static void workerMain(void* pArg);
+
+   bool popJob( size_t workerId, size_t& job );
+   void runJob( BatchWorker& worker, size_t job );
+
+   //////////////////////////////////////////////////////////////////////////
+
+   BatchFingerprinter::eMode  m_mode;
+   vector<BatchWorker*>       m_workers;
+   vector<PCMSource*>         m_sources;
+
+   // everything below is protected by m_mutex
+   Mutex                      m_mutex;
+   Condition                  m_workCond;    // a new batch or shutdown
+   Condition                  m_resultCond;  // a new result is ready
+
+   size_t                     m_batchId;
+   size_t                     m_outstanding; // results not yet returned to the user
+   deque<BatchResult>         m_results;
+   bool                       m_shutdown;
+};
+
+// -----------------------------------------------------------------------------
+
+void BatchPimplData::workerMain( void* pArg )
+{
+   BatchWorker& worker = *static_cast<BatchWorker*>(pArg);
+   BatchPimplData& pd = *worker.pPimplData;
+
+   size_t seenBatchId = 0;
+   size_t job;
+
+   for (;;)
+   {
+      if ( pd.popJob(worker.id, job) )
+      {
+         pd.runJob(worker, job);
+         continue;
+      }
+
+      // nothing left anywhere: wait for the next batch
+      ScopedLock lock(pd.m_mutex);
+      while ( !pd.m_shutdown && seenBatchId == pd.m_batchId )
+         pd.m_workCond.wait(pd.m_mutex);
+
+      if ( pd.m_shutdown )
+         return;
+
+      seenBatchId = pd.m_batchId;
+   }
+}
+
+// -----------------------------------------------------------------------------
+
+bool BatchPimplData::popJob( size_t workerId, size_t& job )
+{
+   // own queue first..
+   {
+      BatchWorker& w = *m_workers[workerId];
+      ScopedLock lock(w.queueMutex);
+      if ( !w.queue.empty() )
+      {
+         job = w.queue.front();
+         w.queue.pop_front();
+         return true;
+      }
+   }
+
+   // ..then steal from the others, starting from the next one
+   const size_t numWorkers = m_workers.size();
+   for ( size_t i = 1; i < numWorkers; ++i )
+   {
+      BatchWorker& w = *m_workers[(workerId + i) % numWorkers];
+      ScopedLock lock(w.queueMutex);
+      if ( !w.queue.empty() )
+      {
+         job = w.queue.back();
+         w.queue.pop_back();
+         return true;
+      }
+   }
+
+   return false;
+}
+
+// -----------------------------------------------------------------------------
+
+void BatchPimplData::runJob( BatchWorker& worker, size_t job )
+{
+   BatchResult res;
+   res.index = job;
+   res.success = false;
+
+   try
+   {
+      PCMSource& source = *m_sources[job];
+
+      if ( !worker.pExtractor )
+         worker.pExtractor = new FingerprintExtractor();
+      FingerprintExtractor& fextr = *worker.pExtractor;
+
+      if ( m_mode == BatchFingerprinter::FOR_QUERY )
+         fextr.initForQuery(source.getFreq(), source.getNumChannels(), source.getDuration());
+      else
+         fextr.initForFullSubmit(source.getFreq(), source.getNumChannels());
+
+      // always read one buffer ahead so that the last one can be flagged as end_of_stream
+      short* pCurr = worker.pPCMBuffers[0];
+      short* pNext = worker.pPCMBuffers[1];
+
+      size_t currSize = source.read(pCurr, BATCH_PCM_BUFFER_SIZE);
+      bool done = false;
+
+      while ( currSize > 0 && !done )
+      {
+         size_t nextSize = source.read(pNext, BATCH_PCM_BUFFER_SIZE);
+         done = fextr.process(pCurr, currSize, nextSize == 0);
+
+         swap(pCurr, pNext);
+         currSize = nextSize;
+      }
+
+      if ( !done )
+         throw std::runtime_error("Insufficient input data!");
+
+      pair<const char*, size_t> fpData = fextr.getFingerprint();
+      res.fingerprint.assign(fpData.first, fpData.first + fpData.second);
+      res.success = true;
+   }
+   catch (const std::exception& e)
+   {
+      res.error = e.what();
+   }
+
+   ScopedLock lock(m_mutex);
+   m_results.push_back(BatchResult());
+   m_results.back().index = res.index;
+   m_results.back().success = res.success;
+   m_results.back().error.swap(res.error);
+   m_results.back().fingerprint.swap(res.fingerprint);
+   m_resultCond.signal();
+}
+
+// -----------------------------------------------------------------------------
+// -----------------------------------------------------------------------------
+
+BatchFingerprinter::BatchFingerprinter( size_t numThreads, eMode mode )
+: m_pPimplData(NULL)
+{
+   m_pPimplData = new BatchPimplData(numThreads, mode);
+}
+
+// -----------------------------------------------------------------------------
+
+BatchFingerprinter::~BatchFingerprinter()
+{
+   if ( m_pPimplData )
+      delete m_pPimplData;
+}
+
+// -----------------------------------------------------------------------------
+
+size_t BatchFingerprinter::getNumThreads() const
+{ return m_pPimplData->m_workers.size(); }
+
+// -----------------------------------------------------------------------------
+
+void BatchFingerprinter::start( const std::vector<PCMSource*>& sources )
+{
+   // easier read
+   BatchPimplData& pd = *m_pPimplData;
+
+   {
+      ScopedLock lock(pd.m_mutex);
+      if ( pd.m_outstanding != 0 )
+         throw std::runtime_error("Please collect all the results before starting a new batch!");
+      pd.m_outstanding = sources.size();
+   }
+
+   // the workers are idle at this point, so it's safe to swap the sources
+   pd.m_sources = sources;
+
+   // round robin; stealing takes care of the balance if the tracks
+   // have very different lengths
+   const size_t numWorkers = pd.m_workers.size();
+   for ( size_t i = 0; i < sources.size(); ++i )
+   {
+      BatchWorker& w = *pd.m_workers[i % numWorkers];
+      ScopedLock lock(w.queueMutex);
+      w.queue.push_back(i);
+   }
+
+   ScopedLock lock(pd.m_mutex);
+   ++pd.m_batchId;
+   pd.m_workCond.broadcast();
+}
+
+// -----------------------------------------------------------------------------
+
+bool BatchFingerprinter::getNextResult( BatchResult& result )
+{
+   // easier read
+   BatchPimplData& pd = *m_pPimplData;
+
+   ScopedLock lock(pd.m_mutex);
+
+   if ( pd.m_outstanding == 0 )
+      return false;
+
+   while ( pd.m_results.empty() )
+      pd.m_resultCond.wait(pd.m_mutex);
+
+   BatchResult& front = pd.m_results.front();
+   result.index = front.index;
+   result.success = front.success;
+   result.error.swap(front.error);
+   result.fingerprint.swap(front.fingerprint);
+
+   pd.m_results.pop_front();
+   --pd.m_outstanding;
+
+   return true;
+}
+
+// -----------------------------------------------------------------------------
+
+} // end of namespace
+
+// -----------------------------------------------------------------------------
@@ -166,17 +166,17 @@ public:
 
 
    CircularArray()
-      : _headIdx(0), _pData(NULL)
+      : _headIdx(0), _pData(NULL), _size(0)
    { }
 
    CircularArray( size_type size )
-      : _headIdx(0), _pData(NULL)
+      : _headIdx(0), _pData(NULL), _size(0)
    {
       this->resize(size);
    }
 
    CircularArray( size_type size, const T& init )
-      : _headIdx(0), _pData(NULL)
+      : _headIdx(0), _pData(NULL), _size(0)
    {
       this->resize(size, init);
    }
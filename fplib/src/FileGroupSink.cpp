@@ -0,0 +1,102 @@
+/***************************************************************************
+* This file is part of last.fm fingerprint app                             *
+*  Last.fm Ltd <mir@last.fm>                                               *
+*                                                                          *
+* This library is free software; you can redistribute it and/or            *
+* modify it under the terms of the GNU Lesser General Public               *
+* License as published by the Free Software Foundation; either             *
+* version 2.1 of the License, or (at your option) any later version.       *
+*                                                                          *
+* This library is distributed in the hope that it will be useful,          *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+* Lesser General Public License for more details.                          *
+*                                                                          *
+* You should have received a copy of the GNU Lesser General Public         *
+* License along with this library; if not, write to the Free Software      *
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 *
+* USA                                                                      *
+***************************************************************************/
+
+#include <stdexcept>
+
+#include "../include/FingerprintExtractor.h"
+
+namespace fingerprint
+{
+
+using namespace std;
+
+// -----------------------------------------------------------------------------
+
+FileGroupSink::FileGroupSink(const string& fileName)
+: m_fileName(fileName), m_pFile(NULL)
+{
+   m_pFile = fopen(fileName.c_str(), "wb");
+   if ( !m_pFile )
+      throw std::runtime_error("Cannot create the fingerprint file " + fileName + "!");
+}
+
+// -----------------------------------------------------------------------------
+
+FileGroupSink::~FileGroupSink()
+{
+   if ( m_pFile )
+      fclose(m_pFile);
+}
+
+// -----------------------------------------------------------------------------
+
+void FileGroupSink::write(const char* data, size_t size)
+{
+   if ( !m_pFile )
+      throw std::runtime_error("The fingerprint file " + m_fileName + " is already closed!");
+
+   if ( fwrite(data, 1, size, m_pFile) != size )
+      throw std::runtime_error("Cannot write the fingerprint file " + m_fileName + "!");
+}
+
+// -----------------------------------------------------------------------------
+
+void FileGroupSink::finish()
+{
+   if ( !m_pFile )
+      return;
+
+   const bool failed = fclose(m_pFile) != 0;
+   m_pFile = NULL;
+
+   if ( failed )
+      throw std::runtime_error("Cannot write the fingerprint file " + m_fileName + "!");
+}
+
+// -----------------------------------------------------------------------------
+
+pair<const char*, size_t> FileGroupSink::getFingerprint()
+{
+   if ( m_pFile )
+      return make_pair(static_cast<const char*>(0), static_cast<size_t>(0)); // not finished yet
+
+   if ( m_data.empty() )
+   {
+      FILE* pFile = fopen(m_fileName.c_str(), "rb");
+      if ( !pFile )
+         throw std::runtime_error("Cannot read the fingerprint file " + m_fileName + "!");
+
+      char buffer[4096];
+      size_t read;
+      while ( (read = fread(buffer, 1, sizeof(buffer), pFile)) > 0 )
+         m_data.insert(m_data.end(), buffer, buffer + read);
+
+      fclose(pFile);
+   }
+
+   if ( m_data.empty() )
+      return make_pair(static_cast<const char*>(0), static_cast<size_t>(0));
+
+   return make_pair(static_cast<const char*>(&m_data[0]), m_data.size());
+}
+
+// -----------------------------------------------------------------------------
+
+} // end of namespace fingerprint
@@ -130,6 +130,14 @@ Filter::Filter(unsigned int id, float threshold, float weight)
 	} // for wt
 }
 
+// -----------------------------------------------------------------------------
+
+Filter::Filter(unsigned int id, unsigned int wt, unsigned int first_band, unsigned int wb,
+               unsigned int filter_type, float threshold, float weight)
+: id(id), wt(wt), first_band(first_band), wb(wb), filter_type(filter_type),
+  threshold(threshold), weight(weight)
+{}
+
 } // end of namespace fingerprint
 
 // -----------------------------------------------------------------------------
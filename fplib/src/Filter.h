@@ -33,6 +33,9 @@ struct Filter
 {
 	/// Constructs a new filter with id.
 	Filter(unsigned int id, float threshold, float weight);
+	/// Constructs a filter already decoded (see rFilters), skipping the id lookup.
+	Filter(unsigned int id, unsigned int wt, unsigned int first_band, unsigned int wb,
+	       unsigned int filter_type, float threshold, float weight);
    
    unsigned int id; //< filter id
 	unsigned int wt; //< time width
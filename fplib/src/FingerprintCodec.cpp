@@ -0,0 +1,447 @@
+/***************************************************************************
+* This file is part of last.fm fingerprint app                             *
+*  Last.fm Ltd <mir@last.fm>                                               *
+*                                                                          *
+* This library is free software; you can redistribute it and/or            *
+* modify it under the terms of the GNU Lesser General Public               *
+* License as published by the Free Software Foundation; either             *
+* version 2.1 of the License, or (at your option) any later version.       *
+*                                                                          *
+* This library is distributed in the hope that it will be useful,          *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+* Lesser General Public License for more details.                          *
+*                                                                          *
+* You should have received a copy of the GNU Lesser General Public         *
+* License along with this library; if not, write to the Free Software      *
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 *
+* USA                                                                      *
+***************************************************************************/
+
+#include <stdexcept>
+#include <algorithm>
+
+#include "../include/FingerprintCodec.h"
+#include "FingerprintCodecKernel.h"
+#include "LittleEndian.h"
+
+#if defined(FP_X86_CODEC) && defined(_MSC_VER)
+#include <intrin.h> // __cpuid
+#endif
+
+// -----------------------------------------------------------------------------
+
+namespace
+{
+
+using namespace fingerprint;
+
+struct Tables : public StreamVByteTables
+{
+   Tables()
+   {
+      for ( unsigned int c = 0; c < 256; ++c )
+      {
+         unsigned int len = 0;
+         for ( unsigned int j = 0; j < 4; ++j )
+         {
+            const unsigned int numBytes = ((c >> (2 * j)) & 3) + 1;
+            for ( unsigned int b = 0; b < 4; ++b )
+            {
+               if ( b < numBytes )
+               {
+                  decodeShuffle[c][4 * j + b] = static_cast<unsigned char>(len + b);
+                  encodeShuffle[c][len + b] = static_cast<unsigned char>(4 * j + b);
+               }
+               else
+                  decodeShuffle[c][4 * j + b] = 0x80;
+            }
+            len += numBytes;
+         }
+
+         for ( unsigned int k = len; k < 16; ++k )
+            encodeShuffle[c][k] = 0x80;
+
+         length[c] = static_cast<unsigned char>(len);
+      }
+   }
+};
+
+const Tables g_tables;
+
+#ifdef FP_X86_CODEC
+bool cpuHasSSSE3()
+{
+#if defined(_MSC_VER)
+   int info[4];
+   __cpuid(info, 1);
+   return (info[2] & (1 << 9)) != 0;
+#elif defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 8)))
+   __builtin_cpu_init();
+   return __builtin_cpu_supports("ssse3") != 0;
+#else
+   return false;
+#endif
+}
+
+const bool g_useSSSE3 = cpuHasSSSE3();
+#endif
+
+// -----------------------------------------------------------------------------
+
+void writeVarint(size_t value, std::vector<char>& out)
+{
+   while ( value >= 0x80 )
+   {
+      out.push_back( static_cast<char>((value & 0x7F) | 0x80) );
+      value >>= 7;
+   }
+   out.push_back( static_cast<char>(value) );
+}
+
+size_t readVarint(const unsigned char*& p, const unsigned char* pEnd)
+{
+   size_t value = 0;
+   for ( unsigned int shift = 0; p != pEnd && shift < 8 * sizeof(size_t); shift += 7 )
+   {
+      const unsigned char byte = *p++;
+      value |= static_cast<size_t>(byte & 0x7F) << shift;
+      if ( (byte & 0x80) == 0 )
+         return value;
+   }
+
+   throw std::runtime_error("Corrupted compact fingerprint!");
+}
+
+// -----------------------------------------------------------------------------
+
+// LZ77 in the spirit of LZ4, a list of sequences:
+//
+//   token     literals (high 4 bits) and match length - LZ_MIN_MATCH (low 4
+//             bits); 15 means that more bytes follow, each adding up to 255
+//   literals
+//   offset    2 bytes, little endian, how far back the match starts
+//   match length bytes, if any
+//
+// The last sequence stops after its literals.
+
+const size_t       LZ_MIN_MATCH = 4;
+const size_t       LZ_MAX_OFFSET = 0xFFFF;
+const unsigned int LZ_HASH_BITS = 12;
+
+inline unsigned int lzHash(const unsigned char* p)
+{
+   return (readLE32(p) * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+void lzWriteLength(size_t length, std::vector<char>& out)
+{
+   for ( ; length >= 255; length -= 255 )
+      out.push_back( static_cast<char>(255) );
+   out.push_back( static_cast<char>(length) );
+}
+
+void lzWriteLiterals(const unsigned char* pLiterals, size_t numLiterals, size_t matchCode, std::vector<char>& out)
+{
+   out.push_back( static_cast<char>( (std::min<size_t>(numLiterals, 15) << 4) | std::min<size_t>(matchCode, 15) ) );
+   if ( numLiterals >= 15 )
+      lzWriteLength(numLiterals - 15, out);
+   out.insert(out.end(), pLiterals, pLiterals + numLiterals);
+}
+
+void lzCompress(const unsigned char* pIn, size_t size, std::vector<char>& out)
+{
+   // last position + 1 of every hash, 0 is none
+   std::vector<size_t> table(1u << LZ_HASH_BITS, 0);
+
+   size_t anchor = 0; // first literal not written yet
+   size_t pos = 0;
+   while ( pos + LZ_MIN_MATCH <= size )
+   {
+      const unsigned int h = lzHash(pIn + pos);
+      const size_t candidate = table[h];
+      table[h] = pos + 1;
+
+      if ( candidate == 0 || pos - (candidate - 1) > LZ_MAX_OFFSET ||
+           readLE32(pIn + candidate - 1) != readLE32(pIn + pos) )
+      {
+         ++pos;
+         continue;
+      }
+
+      const size_t ref = candidate - 1;
+      size_t length = LZ_MIN_MATCH;
+      while ( pos + length < size && pIn[ref + length] == pIn[pos + length] )
+         ++length;
+
+      const size_t offset = pos - ref;
+      lzWriteLiterals(pIn + anchor, pos - anchor, length - LZ_MIN_MATCH, out);
+      out.push_back( static_cast<char>(offset & 0xFF) );
+      out.push_back( static_cast<char>(offset >> 8) );
+      if ( length - LZ_MIN_MATCH >= 15 )
+         lzWriteLength(length - LZ_MIN_MATCH - 15, out);
+
+      pos += length;
+      anchor = pos;
+   }
+
+   lzWriteLiterals(pIn + anchor, size - anchor, 0, out);
+}
+
+size_t lzReadLength(size_t length, const unsigned char*& p, const unsigned char* pEnd)
+{
+   if ( length < 15 )
+      return length;
+
+   for (;;)
+   {
+      if ( p == pEnd )
+         throw std::runtime_error("Corrupted compact fingerprint!");
+      const unsigned char byte = *p++;
+      length += byte;
+      if ( byte != 255 )
+         return length;
+   }
+}
+
+void lzDecompress(const unsigned char* p, const unsigned char* pEnd, size_t size, std::vector<unsigned char>& out)
+{
+   out.clear();
+   out.reserve(size);
+
+   // the last sequence, literals only, is always there (even when empty):
+   // without it the data was cut off
+   bool lastSequence = false;
+   while ( p != pEnd )
+   {
+      const unsigned char token = *p++;
+
+      const size_t numLiterals = lzReadLength(token >> 4, p, pEnd);
+      if ( numLiterals > static_cast<size_t>(pEnd - p) || numLiterals > size - out.size() )
+         throw std::runtime_error("Corrupted compact fingerprint!");
+      out.insert(out.end(), p, p + numLiterals);
+      p += numLiterals;
+
+      if ( p == pEnd )
+      {
+         lastSequence = true;
+         break;
+      }
+
+      if ( pEnd - p < 2 )
+         throw std::runtime_error("Corrupted compact fingerprint!");
+      const size_t offset = p[0] | (static_cast<size_t>(p[1]) << 8);
+      p += 2;
+
+      const size_t length = lzReadLength(token & 0x0F, p, pEnd) + LZ_MIN_MATCH;
+      if ( offset == 0 || offset > out.size() || length > size - out.size() )
+         throw std::runtime_error("Corrupted compact fingerprint!");
+
+      // byte by byte: the match can overlap what it writes
+      const size_t ref = out.size() - offset;
+      for ( size_t i = 0; i < length; ++i )
+         out.push_back( out[ref + i] );
+   }
+
+   if ( !lastSequence || out.size() != size )
+      throw std::runtime_error("Corrupted compact fingerprint!");
+}
+
+} // end of anonymous namespace
+
+// -----------------------------------------------------------------------------
+
+namespace fingerprint
+{
+
+using namespace std;
+
+// -----------------------------------------------------------------------------
+
+unsigned char* encodeQuadsScalar( const unsigned int* pValues, size_t numQuads,
+                                  unsigned char* pControl, unsigned char* pData,
+                                  const StreamVByteTables& /*tables*/ )
+{
+   for ( size_t q = 0; q < numQuads; ++q )
+   {
+      unsigned int control = 0;
+      for ( unsigned int j = 0; j < 4; ++j )
+      {
+         unsigned int value = pValues[4 * q + j];
+         const unsigned int code = streamVByteCode(value);
+         control |= code << (2 * j);
+
+         for ( unsigned int b = 0; b <= code; ++b, value >>= 8 )
+            *pData++ = static_cast<unsigned char>(value);
+      }
+      pControl[q] = static_cast<unsigned char>(control);
+   }
+
+   return pData;
+}
+
+// -----------------------------------------------------------------------------
+
+size_t decodeQuadsScalar( const unsigned char* pControl, size_t numQuads,
+                          const unsigned char*& pData, const unsigned char* /*pDataEnd*/,
+                          unsigned int* pValues, const StreamVByteTables& /*tables*/ )
+{
+   for ( size_t q = 0; q < numQuads; ++q )
+   {
+      const unsigned int control = pControl[q];
+      for ( unsigned int j = 0; j < 4; ++j )
+      {
+         const unsigned int numBytes = ((control >> (2 * j)) & 3) + 1;
+         unsigned int value = 0;
+         for ( unsigned int b = 0; b < numBytes; ++b )
+            value |= static_cast<unsigned int>(pData[b]) << (8 * b);
+         pData += numBytes;
+         pValues[4 * q + j] = value;
+      }
+   }
+
+   return numQuads;
+}
+
+// -----------------------------------------------------------------------------
+
+const StreamVByteTables& getStreamVByteTables()
+{
+   return g_tables;
+}
+
+#ifdef FP_X86_CODEC
+bool codecUsesSSSE3()
+{
+   return g_useSSSE3;
+}
+#endif
+
+// -----------------------------------------------------------------------------
+
+void encodeFingerprint(const char* pData, size_t size, vector<char>& out, bool useLZ)
+{
+   if ( size % 8 != 0 )
+      throw std::runtime_error("The size of a fingerprint must be a multiple of 8!");
+
+   const size_t numGroups = size / 8;
+   const unsigned char* pIn = reinterpret_cast<const unsigned char*>(pData);
+
+   // key XOR previous key, count (plus the padding)
+   vector<unsigned int> values( (2 * numGroups + 3) & ~static_cast<size_t>(3), 0 );
+   unsigned int prevKey = 0;
+   for ( size_t i = 0; i < numGroups; ++i )
+   {
+      const unsigned int key = readLE32(pIn + 8 * i);
+      values[2 * i] = key ^ prevKey;
+      values[2 * i + 1] = readLE32(pIn + 8 * i + 4);
+      prevKey = key;
+   }
+
+   // the control bytes, then the data (with room for the last 16 bytes store)
+   const size_t numQuads = values.size() / 4;
+   vector<unsigned char> payload(numQuads + 16 * numQuads + 16);
+   unsigned char* pPayloadEnd = &payload[numQuads];
+   if ( numQuads > 0 )
+   {
+#ifdef FP_X86_CODEC
+      if ( g_useSSSE3 )
+         pPayloadEnd = encodeQuadsSSSE3(&values[0], numQuads, &payload[0], pPayloadEnd, g_tables);
+      else
+#endif
+         pPayloadEnd = encodeQuadsScalar(&values[0], numQuads, &payload[0], pPayloadEnd, g_tables);
+   }
+   payload.resize(pPayloadEnd - &payload[0]);
+
+   out.clear();
+   out.push_back( static_cast<char>(FINGERPRINT_CODEC_VERSION) );
+   out.push_back( static_cast<char>(useLZ ? FINGERPRINT_CODEC_LZ : 0) );
+   writeVarint(numGroups, out);
+
+   if ( useLZ )
+   {
+      writeVarint(payload.size(), out);
+      lzCompress(payload.empty() ? NULL : &payload[0], payload.size(), out);
+   }
+   else
+      out.insert(out.end(), payload.begin(), payload.end());
+}
+
+// -----------------------------------------------------------------------------
+
+void decodeFingerprint(const char* pData, size_t size, vector<char>& out)
+{
+   const unsigned char* p = reinterpret_cast<const unsigned char*>(pData);
+   const unsigned char* pEnd = p + size;
+
+   if ( size < 2 )
+      throw std::runtime_error("Corrupted compact fingerprint!");
+   if ( p[0] != FINGERPRINT_CODEC_VERSION )
+      throw std::runtime_error("Unknown version of the compact fingerprint!");
+
+   const unsigned char flags = p[1];
+   if ( (flags & ~FINGERPRINT_CODEC_LZ) != 0 )
+      throw std::runtime_error("Unknown version of the compact fingerprint!");
+   p += 2;
+
+   const size_t numGroups = readVarint(p, pEnd);
+
+   vector<unsigned char> unpacked;
+   if ( flags & FINGERPRINT_CODEC_LZ )
+   {
+      const size_t payloadSize = readVarint(p, pEnd);
+      // a byte of LZ can't give more than a few hundred (and the check
+      // avoids allocating whatever a corrupted size says)
+      if ( payloadSize / 256 > static_cast<size_t>(pEnd - p) )
+         throw std::runtime_error("Corrupted compact fingerprint!");
+
+      lzDecompress(p, pEnd, payloadSize, unpacked);
+      p = unpacked.empty() ? NULL : &unpacked[0];
+      pEnd = p + unpacked.size();
+   }
+
+   // every four values (two groups) take at least 5 bytes
+   const size_t payloadSize = pEnd - p;
+   if ( numGroups > payloadSize )
+      throw std::runtime_error("Corrupted compact fingerprint!");
+
+   const size_t numQuads = (2 * numGroups + 3) / 4;
+   if ( 5 * numQuads > payloadSize )
+      throw std::runtime_error("Corrupted compact fingerprint!");
+
+   const unsigned char* pControl = p;
+   const unsigned char* pValueData = p + numQuads;
+
+   size_t dataSize = 0;
+   for ( size_t q = 0; q < numQuads; ++q )
+      dataSize += g_tables.length[pControl[q]];
+   if ( dataSize != static_cast<size_t>(pEnd - pValueData) )
+      throw std::runtime_error("Corrupted compact fingerprint!");
+
+   vector<unsigned int> values(4 * numQuads);
+   if ( numQuads > 0 )
+   {
+      size_t q = 0;
+#ifdef FP_X86_CODEC
+      if ( g_useSSSE3 )
+         q = decodeQuadsSSSE3(pControl, numQuads, pValueData, pEnd, &values[0], g_tables);
+#endif
+      decodeQuadsScalar(pControl + q, numQuads - q, pValueData, pEnd, &values[0] + 4 * q, g_tables);
+   }
+
+   out.clear();
+   out.resize(8 * numGroups);
+
+   unsigned char* pOut = reinterpret_cast<unsigned char*>( out.empty() ? NULL : &out[0] );
+   unsigned int key = 0;
+   for ( size_t i = 0; i < numGroups; ++i )
+   {
+      key ^= values[2 * i];
+      writeLE32(pOut + 8 * i, key);
+      writeLE32(pOut + 8 * i + 4, values[2 * i + 1]);
+   }
+}
+
+// -----------------------------------------------------------------------------
+
+} // end of namespace fingerprint
@@ -0,0 +1,95 @@
+/***************************************************************************
+* This file is part of last.fm fingerprint app                             *
+*  Last.fm Ltd <mir@last.fm>                                               *
+*                                                                          *
+* This library is free software; you can redistribute it and/or            *
+* modify it under the terms of the GNU Lesser General Public               *
+* License as published by the Free Software Foundation; either             *
+* version 2.1 of the License, or (at your option) any later version.       *
+*                                                                          *
+* This library is distributed in the hope that it will be useful,          *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+* Lesser General Public License for more details.                          *
+*                                                                          *
+* You should have received a copy of the GNU Lesser General Public         *
+* License along with this library; if not, write to the Free Software      *
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 *
+* USA                                                                      *
+***************************************************************************/
+
+#ifndef __FINGERPRINT_CODEC_KERNEL_H
+#define __FINGERPRINT_CODEC_KERNEL_H
+
+// The Stream VByte loops of the compact fingerprint format (see
+// FingerprintCodec.h), shared by FingerprintCodec.cpp and
+// FingerprintCodecSSSE3.cpp. The latter is the only file compiled with
+// -mssse3 and is only called after checking the cpu at runtime, so don't
+// include any other header from here.
+//
+// Stream VByte stores the 32 bits values in 1 to 4 bytes each, with the
+// lengths apart: one control byte for every four values (2 bits each, the
+// length minus one of the first value in the lowest bits), then all the
+// data bytes, little endian. The shuffles turn a control byte into the
+// moves of the bytes of four values at once.
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define FP_X86_CODEC
+#endif
+
+#include <cstddef> // for size_t
+
+namespace fingerprint
+{
+
+// -----------------------------------------------------------------------------
+
+struct StreamVByteTables
+{
+   unsigned char length[256];        // data bytes of the four values of a control byte
+   unsigned char decodeShuffle[256][16]; // data bytes -> four values (0x80 = zero)
+   unsigned char encodeShuffle[256][16]; // four values -> data bytes
+};
+
+// Every four values of pValues (numQuads * 4 of them) are encoded with their
+// control byte in pControl and their bytes from pData on, whose end is
+// returned. Up to 12 bytes after the end may be overwritten.
+unsigned char* encodeQuadsScalar( const unsigned int* pValues, size_t numQuads,
+                                  unsigned char* pControl, unsigned char* pData,
+                                  const StreamVByteTables& tables );
+
+// The other way round. The SIMD flavour needs 16 readable bytes for every
+// load, so it stops before pDataEnd gets too close and returns how many quads
+// it decoded (pData is moved past them): the scalar one does the rest.
+size_t decodeQuadsScalar( const unsigned char* pControl, size_t numQuads,
+                          const unsigned char*& pData, const unsigned char* pDataEnd,
+                          unsigned int* pValues, const StreamVByteTables& tables );
+
+#ifdef FP_X86_CODEC
+unsigned char* encodeQuadsSSSE3( const unsigned int* pValues, size_t numQuads,
+                                 unsigned char* pControl, unsigned char* pData,
+                                 const StreamVByteTables& tables );
+
+size_t decodeQuadsSSSE3( const unsigned char* pControl, size_t numQuads,
+                         const unsigned char*& pData, const unsigned char* pDataEnd,
+                         unsigned int* pValues, const StreamVByteTables& tables );
+#endif
+
+// The tables FingerprintCodec.cpp works with, and whether it picked the SSSE3
+// loops (for the tests, that hold them against the scalar ones).
+const StreamVByteTables& getStreamVByteTables();
+#ifdef FP_X86_CODEC
+bool codecUsesSSSE3();
+#endif
+
+// the code (length - 1) of a value
+inline unsigned int streamVByteCode(unsigned int value)
+{
+   return (value > 0xFF) + (value > 0xFFFF) + (value > 0xFFFFFF);
+}
+
+// -----------------------------------------------------------------------------
+
+} // end of namespace fingerprint
+
+#endif // __FINGERPRINT_CODEC_KERNEL_H
@@ -0,0 +1,120 @@
+/***************************************************************************
+* This file is part of last.fm fingerprint app                             *
+*  Last.fm Ltd <mir@last.fm>                                               *
+*                                                                          *
+* This library is free software; you can redistribute it and/or            *
+* modify it under the terms of the GNU Lesser General Public               *
+* License as published by the Free Software Foundation; either             *
+* version 2.1 of the License, or (at your option) any later version.       *
+*                                                                          *
+* This library is distributed in the hope that it will be useful,          *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+* Lesser General Public License for more details.                          *
+*                                                                          *
+* You should have received a copy of the GNU Lesser General Public         *
+* License along with this library; if not, write to the Free Software      *
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 *
+* USA                                                                      *
+***************************************************************************/
+
+// The SSSE3 flavour of the Stream VByte loops. This is the only file
+// compiled with -mssse3 (see CMakeLists.txt), and its code is only called
+// after checking the cpu at runtime: keep everything else out of it!
+
+#include "FingerprintCodecKernel.h"
+
+#if defined(FP_X86_CODEC) && ( defined(__SSSE3__) || defined(_MSC_VER) )
+
+#include <tmmintrin.h>
+
+namespace fingerprint
+{
+
+// -----------------------------------------------------------------------------
+
+unsigned char* encodeQuadsSSSE3( const unsigned int* pValues, size_t numQuads,
+                                 unsigned char* pControl, unsigned char* pData,
+                                 const StreamVByteTables& tables )
+{
+   // no unsigned compare: flip the sign bits
+   const __m128i bias = _mm_set1_epi32(static_cast<int>(0x80000000u));
+   const __m128i limit1 = _mm_set1_epi32(static_cast<int>(0x000000FFu ^ 0x80000000u));
+   const __m128i limit2 = _mm_set1_epi32(static_cast<int>(0x0000FFFFu ^ 0x80000000u));
+   const __m128i limit3 = _mm_set1_epi32(static_cast<int>(0x00FFFFFFu ^ 0x80000000u));
+   // the low byte of every lane in the low 32 bits
+   const __m128i gatherCodes = _mm_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+
+   for ( size_t q = 0; q < numQuads; ++q )
+   {
+      const __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pValues + 4 * q));
+      const __m128i biased = _mm_xor_si128(values, bias);
+
+      // the masks are -1 where true: the code is minus their sum
+      __m128i codes = _mm_cmpgt_epi32(biased, limit1);
+      codes = _mm_add_epi32(codes, _mm_cmpgt_epi32(biased, limit2));
+      codes = _mm_add_epi32(codes, _mm_cmpgt_epi32(biased, limit3));
+      codes = _mm_sub_epi32(_mm_setzero_si128(), codes);
+
+      // the four codes, one per byte, to 2 bits each
+      const unsigned int bytes = static_cast<unsigned int>( _mm_cvtsi128_si32(_mm_shuffle_epi8(codes, gatherCodes)) );
+      const unsigned int spread = bytes | (bytes >> 6);
+      const unsigned int control = (spread | (spread >> 12)) & 0xFF;
+
+      pControl[q] = static_cast<unsigned char>(control);
+
+      const __m128i shuffle = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tables.encodeShuffle[control]));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(pData), _mm_shuffle_epi8(values, shuffle));
+      pData += tables.length[control];
+   }
+
+   return pData;
+}
+
+// -----------------------------------------------------------------------------
+
+size_t decodeQuadsSSSE3( const unsigned char* pControl, size_t numQuads,
+                         const unsigned char*& pData, const unsigned char* pDataEnd,
+                         unsigned int* pValues, const StreamVByteTables& tables )
+{
+   size_t q = 0;
+   for ( ; q < numQuads && pDataEnd - pData >= 16; ++q )
+   {
+      const unsigned int control = pControl[q];
+
+      const __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pData));
+      const __m128i shuffle = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tables.decodeShuffle[control]));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(pValues + 4 * q), _mm_shuffle_epi8(data, shuffle));
+      pData += tables.length[control];
+   }
+
+   return q;
+}
+
+// -----------------------------------------------------------------------------
+
+} // end of namespace fingerprint
+
+#elif defined(FP_X86_CODEC)
+
+namespace fingerprint
+{
+
+// built without SSSE3 support: same bytes, one value at a time
+unsigned char* encodeQuadsSSSE3( const unsigned int* pValues, size_t numQuads,
+                                 unsigned char* pControl, unsigned char* pData,
+                                 const StreamVByteTables& tables )
+{
+   return encodeQuadsScalar(pValues, numQuads, pControl, pData, tables);
+}
+
+size_t decodeQuadsSSSE3( const unsigned char* pControl, size_t numQuads,
+                         const unsigned char*& pData, const unsigned char* pDataEnd,
+                         unsigned int* pValues, const StreamVByteTables& tables )
+{
+   return decodeQuadsScalar(pControl, numQuads, pData, pDataEnd, pValues, tables);
+}
+
+} // end of namespace fingerprint
+
+#endif
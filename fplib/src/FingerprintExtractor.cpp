@@ -25,9 +25,8 @@
 
 #include <iostream>
 #include <limits>
-#include <bitset>
-#include <deque>
 #include <vector>
+#include <set>
 #include <stdexcept>
 #include <cmath>
 #include <cstring>
@@ -39,6 +38,14 @@
 #include "Filter.h"
 #include "FloatingAverage.h"
 #include "OptFFT.h"
+#include "OptBits.h"
+#include "OptResampler.h"
+#include "PCMReader.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FP_SSE2_NORMALIZE
+#endif
 
 //////////////////////////////////////////////////////////////////////////
 
@@ -46,13 +53,17 @@ namespace fingerprint
 {
 
 using namespace std;
-static const int NUM_FRAMES_CLIENT = 32; // ~= 10 secs.
+static const int FLOAT_BLOCK_SIZE = 1024; // mono samples converted at once (stays in L1)
+static const int NORM_BLOCK_SIZE = 1024;  // samples normalized at once
+static const int NUM_STORED_BLOCKS = 4;   // the downsampled buffer slides over at least this many blocks
+static const double RESAMPLER_GUARD_SECS = 0.1; // the input the resampler holds back (getQueryRange)
 
 enum eProcessType
 {
    PT_UNKNOWN,
    PT_FOR_QUERY,
-   PT_FOR_FULLSUBMIT
+   PT_FOR_FULLSUBMIT,
+   PT_FOR_STREAM
 };
 
 //////////////////////////////////////////////////////////////////////////
@@ -62,30 +73,54 @@ class PimplData
 
 public:
 
-   PimplData()
-   : m_pDownsampledPCM(NULL), m_pDownsampledCurrIt(NULL),
+   PimplData(unsigned int blockFrames)
+   : m_pDownsampledPCM(NULL), m_pDownsampledCurrIt(NULL), m_pDownsampledStorage(NULL),
      m_normalizedWindowMs(static_cast<unsigned int>(NORMALIZATION_SKIP_SECS * 1000 * 2)),
      m_compensateBufferSize(FRAMESIZE-OVERLAPSAMPLES + Filter::KEYWIDTH * OVERLAPSAMPLES),
-     m_downsampledProcessSize(NUM_FRAMES_CLIENT*FRAMESIZE),
+     m_downsampledProcessSize(blockFrames*FRAMESIZE),
      // notice that the buffer has extra space on either side for the normalization window  
      m_fullDownsampledBufferSize( m_downsampledProcessSize + // the actual processed part
                                   m_compensateBufferSize +  // a compensation buffer for the fft
                                 ((m_normalizedWindowMs * DFREQ / 1000) / 2) ), // a compensation buffer for the normalization
      m_normWindow(m_normalizedWindowMs * DFREQ / 1000),
-     m_pFFT(NULL), m_pDownsampleState(NULL), m_processType(PT_UNKNOWN)
+     m_pFFT(NULL), m_pBits(NULL), m_pDownsampleState(NULL), m_processType(PT_UNKNOWN),
+     m_initType(PT_UNKNOWN), m_queryStartFrame(0), m_duration(-1), m_fastResampling(false), m_useOptResampler(false),
+     m_streamKeyPos(0), m_pSink(NULL), m_sinkBadGroup(false)
    {
+      // the pre-buffering starts half a normalization window before the first block
+      if ( m_downsampledProcessSize < m_normWindow.size() / 2 )
+         throw std::runtime_error("The block size is too small!");
+
       m_pFFT            = new OptFFT(m_downsampledProcessSize + m_compensateBufferSize);
-      m_pDownsampledPCM = new float[m_fullDownsampledBufferSize];
+
+      // The buffer moves forward by m_bufferSize at every block, over a storage
+      // of a few blocks: only when it gets to the end is the tail copied back
+      // to the beginning (see PROCESS in processPCM).
+      // The copy must not overlap the last buffer, so with small blocks the
+      // storage holds more of them.
+      const size_t tailSize = m_fullDownsampledBufferSize - m_downsampledProcessSize;
+      const size_t numStoredBlocks = max( static_cast<size_t>(NUM_STORED_BLOCKS),
+                                          2 + (tailSize + m_downsampledProcessSize - 1) / m_downsampledProcessSize );
+      const size_t storageSize = m_fullDownsampledBufferSize + (numStoredBlocks - 1) * m_downsampledProcessSize;
+
+      m_pDownsampledStorage = new float[storageSize];
+      m_pEndDownsampledStorage = m_pDownsampledStorage + storageSize;
+      m_pDownsampledPCM = m_pPrevDownsampledPCM = m_pDownsampledStorage;
 
       // the end of ||-------m_bufferSize-------|-cb-|---norm/2---|| 
       //                                                           ^-- pEndDownsampledBuf
       m_pEndDownsampledBuf = m_pDownsampledPCM + m_fullDownsampledBufferSize;
 
-      // loading filters
+      // loading filters (already decoded, no need to look up the ids)
       size_t numFilters = sizeof(rFilters) / sizeof(RawFilter) ;
       for (size_t i = 0; i < numFilters; ++i)
-         m_filters.push_back( Filter( rFilters[i].ftid, rFilters[i].thresh, rFilters[i].weight ) );
+      {
+         const RawFilter& rf = rFilters[i];
+         m_filters.push_back( Filter( rf.ftid, rf.wt, rf.first_band, rf.wb, rf.filter_type,
+                                      rf.thresh, rf.weight ) );
+      }
 
+      m_pBits = new OptBits(m_filters, m_pFFT->getMaxFrames());
    }
 
    ~PimplData()
@@ -93,8 +128,12 @@ public:
       if ( m_pFFT )
          delete m_pFFT;
       m_pFFT = NULL;
-      if ( m_pDownsampledPCM )
-         delete [] m_pDownsampledPCM;
+      if ( m_pBits )
+         delete m_pBits;
+      m_pBits = NULL;
+      if ( m_pDownsampledStorage )
+         delete [] m_pDownsampledStorage;
+      m_pDownsampledStorage = NULL;
       m_pDownsampledPCM = NULL;
 
       if ( m_pDownsampleState )
@@ -102,9 +141,13 @@ public:
 
    }
 
-   float*                 m_pDownsampledPCM;
+   float*                 m_pDownsampledPCM; // the current buffer, inside the storage
    float*                 m_pDownsampledCurrIt;
 
+   float*                 m_pDownsampledStorage;
+   float*                 m_pEndDownsampledStorage;
+   float*                 m_pPrevDownsampledPCM; // where the buffer was for the previous block
+
    const unsigned int     m_normalizedWindowMs;
    const size_t           m_compensateBufferSize;
    const size_t           m_downsampledProcessSize;
@@ -112,6 +155,7 @@ public:
 
    FloatingAverage<double> m_normWindow;
    OptFFT*                 m_pFFT;
+   OptBits*                m_pBits;
 
    //////////////////////////////////////////////////////////////////////////
    
@@ -119,7 +163,14 @@ public:
    SRC_STATE*              m_pDownsampleState;
    SRC_DATA                m_downsampleData;
 
-   vector<float>           m_floatInData;
+   // the fixed ratio resampler, if enabled and the frequency allows it
+   OptResampler            m_optResampler;
+
+   float                   m_floatInBlock[FLOAT_BLOCK_SIZE];
+
+   // scratch space of normalize()
+   double                  m_normSquares[NORM_BLOCK_SIZE];
+   double                  m_normAverages[NORM_BLOCK_SIZE];
 
    //////////////////////////////////////////////////////////////////////////
 
@@ -128,17 +179,23 @@ public:
    bool                   m_preBufferPassed;
 
    eProcessType           m_processType;
+   eProcessType           m_initType; // what the last init was for (used by reset)
 
    size_t                 m_toSkipSize;
    size_t                 m_toSkipMs;
 
    size_t                 m_skippedSoFar;
    bool                   m_skipPassed;
+   size_t                 m_queryStartFrame; // where the data given to a query starts in the track
 
    float*                 m_pEndDownsampledBuf;
 
    int m_freq;
    int m_nchannels;
+   int m_duration;
+
+   bool m_fastResampling;  // what the user asked for
+   bool m_useOptResampler; // what the current stream uses
 
    unsigned int m_lengthMs;
    int          m_minUniqueKeys;
@@ -149,10 +206,19 @@ public:
    
    vector<Filter>     m_filters;
 
-   deque<GroupData>   m_groupWindow;
-   vector<GroupData>  m_groups;
+   GroupBuffer<GroupData> m_groupWindow; // also what getFingerprint() returns
    unsigned int       m_processedKeys;
 
+   // streaming mode: what pollKeys() hands out
+   vector<StreamGroup> m_streamGroups;
+   size_t              m_streamKeyPos; // index of the first key not in m_streamGroups yet
+
+   // full submit to a sink: only the groups not written yet stay in the window
+   GroupSink*          m_pSink;
+   vector<GroupData>   m_sinkBuffer;     // one write(), already in the output byte order
+   set<unsigned int>   m_sinkUniqueKeys; // the check of enoughUniqueGoodGroups(), as the groups go
+   bool                m_sinkBadGroup;
+
    vector<unsigned int>   m_partialBits; // here just to avoid reallocation
 
 #if __BIG_ENDIAN__
@@ -173,24 +239,25 @@ void initCustom( PimplData& pd,
                  unsigned int lengthMs, unsigned int skipMs,
                  int minUniqueKeys, unsigned int uniqueKeyWindowMs, int duration );
 
-inline float getRMS( const FloatingAverage<double>& signal );
-unsigned int processKeys( deque<GroupData>& groups, size_t size, PimplData& pd );
-void         integralImage( float** ppFrames, unsigned int nFrames );
-void         computeBits( vector<unsigned int>& bits,
-                          const vector<Filter>& f, 
-                          float ** frames, unsigned int nframes );
-
-
-void src_short_to_float_and_mono_array(const short *in, float *out, int srclen, int nchannels);
+inline float getRMS( double average );
+void         normalize( PimplData& pd, size_t pos, size_t window_pos, size_t numSamples );
+unsigned int processKeys( GroupBuffer<GroupData>& groups, size_t size, PimplData& pd );
+void         integralImage( const FrameView& frames, unsigned int nFrames );
+bool         processPCM( PimplData& pd, const PCMReader& pcm, size_t num_samples, bool end_of_stream );
+size_t       downsample( PimplData& pd, const PCMReader& pcm, size_t pos, size_t numFrames, bool end_of_input );
+void         moveStreamGroups( PimplData& pd, bool all );
+void         writeToSink( PimplData& pd, bool all );
+void         computeSkip( unsigned int skipMs, int duration, unsigned int normalizedWindowMs,
+                          int freq, int nchannels, size_t& toSkipMs, size_t& toSkipSize );
 
 //////////////////////////////////////////////////////////////////////////
 
 // -----------------------------------------------------------------------------
 
-FingerprintExtractor::FingerprintExtractor()
+FingerprintExtractor::FingerprintExtractor(unsigned int blockFrames)
 : m_pPimplData(NULL)
 {
-   m_pPimplData = new PimplData();
+   m_pPimplData = new PimplData(blockFrames);
 }
 
 // -----------------------------------------------------------------------------
@@ -220,10 +287,59 @@ size_t FingerprintExtractor::getVersion()
 
 // -----------------------------------------------------------------------------
 
+void FingerprintExtractor::setFastResampling(bool enable)
+{ m_pPimplData->m_fastResampling = enable; }
+
+// -----------------------------------------------------------------------------
+
+void FingerprintExtractor::setFFTPlanner(eFFTPlanner planner)
+{
+   switch ( planner )
+   {
+   case FFT_ESTIMATE:
+      OptFFT::setPlannerFlags(FFTW_ESTIMATE);
+      break;
+   case FFT_MEASURE:
+      OptFFT::setPlannerFlags(FFTW_MEASURE);
+      break;
+   case FFT_PATIENT:
+      OptFFT::setPlannerFlags(FFTW_PATIENT);
+      break;
+   default:
+      throw std::runtime_error("Unknown FFT planner!");
+   }
+}
+
+// -----------------------------------------------------------------------------
+
+bool FingerprintExtractor::importFFTWisdom(const char* filename)
+{ return OptFFT::importWisdom(filename); }
+
+// -----------------------------------------------------------------------------
+
+bool FingerprintExtractor::exportFFTWisdom(const char* filename)
+{ return OptFFT::exportWisdom(filename); }
+
+// -----------------------------------------------------------------------------
+
+bool FingerprintExtractor::setFFTWisdomFile(const char* filename)
+{ return OptFFT::setWisdomFile(filename); }
+
+// -----------------------------------------------------------------------------
+
 void FingerprintExtractor::initForQuery(int freq, int nchannels, int duration )
+{
+   initForQuery(freq, nchannels, duration, 0);
+}
+
+// -----------------------------------------------------------------------------
+
+void FingerprintExtractor::initForQuery(int freq, int nchannels, int duration, size_t startFrame )
 {
    m_pPimplData->m_skipPassed = false;
    m_pPimplData->m_processType = PT_FOR_QUERY;
+   m_pPimplData->m_initType = PT_FOR_QUERY;
+   m_pPimplData->m_duration = duration;
 
    if ( !m_pPimplData )
       throw std::runtime_error("Not enough RAM to allocate the fingerprinter!");
@@ -234,14 +350,57 @@ void FingerprintExtractor::initForQuery(int freq, int nchannels, int duration )
                static_cast<unsigned int>(QUERY_START_SECS * 1000), 
                MIN_UNIQUE_KEYS, 
                static_cast<unsigned int>(UPDATE_SIZE_SECS * 1000), duration );
+
+   // the data before startFrame counts as already skipped
+   PimplData& pd = *m_pPimplData;
+   pd.m_queryStartFrame = startFrame;
+   pd.m_skippedSoFar = startFrame * nchannels;
+   if ( pd.m_skippedSoFar > pd.m_toSkipSize )
+      throw std::runtime_error("The query starts before the given data (see getQueryRange())!");
+}
+
+// -----------------------------------------------------------------------------
+
+pair<size_t, size_t> FingerprintExtractor::getQueryRange(int freq, int nchannels, int duration) const
+{
+   const PimplData& pd = *m_pPimplData;
+
+   size_t toSkipMs, toSkipSize;
+   computeSkip( static_cast<unsigned int>(QUERY_START_SECS * 1000), duration, pd.m_normalizedWindowMs,
+                freq, nchannels, toSkipMs, toSkipSize );
+   const size_t firstFrame = toSkipSize / nchannels;
+
+   // At 5512 Hz: the prebuffering (normalization window and FFT
+   // compensation), then whole blocks until there are more keys than the
+   // query needs.
+   const size_t queryKeys = getTotalKeys( static_cast<int>(QUERY_SIZE_SECS * 1000) );
+   const size_t keysPerBlock = pd.m_downsampledProcessSize / OVERLAPSAMPLES;
+   const size_t numBlocks = queryKeys / keysPerBlock + 1;
+   const size_t downsampledSize = pd.m_normWindow.size() + pd.m_compensateBufferSize +
+                                  numBlocks * pd.m_downsampledProcessSize;
+
+   // back to the input rate, plus the delay of the resampler
+   const size_t numFrames = static_cast<size_t>( ceil(downsampledSize * (freq / FDFREQ)) ) +
+                            static_cast<size_t>( freq * RESAMPLER_GUARD_SECS );
+
+   return make_pair(firstFrame, firstFrame + numFrames);
 }
 
 // -----------------------------------------------------------------------------
 
 void FingerprintExtractor::initForFullSubmit(int freq, int nchannels )
+{
+   initForFullSubmit(freq, nchannels, NULL);
+}
+
+// -----------------------------------------------------------------------------
+
+void FingerprintExtractor::initForFullSubmit(int freq, int nchannels, GroupSink* pSink )
 {
    m_pPimplData->m_skipPassed = true;
    m_pPimplData->m_processType = PT_FOR_FULLSUBMIT;
+   m_pPimplData->m_initType = PT_FOR_FULLSUBMIT;
+   m_pPimplData->m_duration = -1;
 
    if ( !m_pPimplData )
       throw std::runtime_error("Not enough RAM to allocate the fingerprinter!");
@@ -250,6 +409,62 @@ void FingerprintExtractor::initForFullSubmit(int freq, int nchannels )
                freq, nchannels, 
                numeric_limits<unsigned int>::max(), 
                0, MIN_UNIQUE_KEYS, 0, -1 );
+
+   m_pPimplData->m_pSink = pSink;
+}
+
+// -----------------------------------------------------------------------------
+
+void FingerprintExtractor::initForStream(int freq, int nchannels )
+{
+   m_pPimplData->m_skipPassed = true;
+   m_pPimplData->m_processType = PT_FOR_STREAM;
+   m_pPimplData->m_initType = PT_FOR_STREAM;
+   m_pPimplData->m_duration = -1;
+
+   if ( !m_pPimplData )
+      throw std::runtime_error("Not enough RAM to allocate the fingerprinter!");
+
+   // no length: the keys are never chopped, they just go to pollKeys()
+   initCustom( *m_pPimplData, 
+               freq, nchannels, 
+               0, 0, MIN_UNIQUE_KEYS, 0, -1 );
+
+   m_pPimplData->m_streamGroups.clear();
+   m_pPimplData->m_streamKeyPos = 0;
+}
+
+// -----------------------------------------------------------------------------
+
+size_t FingerprintExtractor::pollKeys(vector<StreamGroup>& groups)
+{
+   groups.clear();
+   groups.swap(m_pPimplData->m_streamGroups);
+   return groups.size();
+}
+
+// -----------------------------------------------------------------------------
+
+void FingerprintExtractor::reset()
+{
+   // easier read
+   PimplData& pd = *m_pPimplData;
+
+   switch ( pd.m_initType )
+   {
+   case PT_FOR_QUERY:
+      initForQuery(pd.m_freq, pd.m_nchannels, pd.m_duration, pd.m_queryStartFrame);
+      break;
+   case PT_FOR_FULLSUBMIT:
+      // not to the sink, that has been finished: back to memory
+      initForFullSubmit(pd.m_freq, pd.m_nchannels);
+      break;
+   case PT_FOR_STREAM:
+      initForStream(pd.m_freq, pd.m_nchannels);
+      break;
+   default:
+      throw std::runtime_error("Please call initForQuery(), initForFullSubmit() or initForStream() before reset()!");
+   }
 }
 
 // -----------------------------------------------------------------------------
@@ -261,6 +476,9 @@ void initCustom( PimplData& pd,
                  int minUniqueKeys, 
                  unsigned int uniqueKeyWindowMs, int duration )
 {
+   if ( nchannels < 1 )
+      throw std::runtime_error("Unsupported number of channels!");
+
    //////////////////////////////////////////////////////////////////////////
    pd.m_freq = freq;
    pd.m_nchannels = nchannels;
@@ -270,29 +488,37 @@ void initCustom( PimplData& pd,
    //////////////////////////////////////////////////////////////////////////
 
    // ***********************************************************************
-   if ( pd.m_pDownsampleState )
-      pd.m_pDownsampleState = src_delete(pd.m_pDownsampleState) ;
-   pd.m_pDownsampleState = src_new (SRC_SINC_FASTEST, 1, NULL) ;
+   pd.m_useOptResampler = pd.m_fastResampling && OptResampler::isSupported(freq);
+   if ( pd.m_useOptResampler )
+   {
+      // (init only redesigns the filter if the frequency changed)
+      pd.m_optResampler.init(freq);
+   }
+   // The converter is always mono and the ratio is passed with every
+   // src_process call, so the state doesn't depend on freq: just reset it
+   // if we already have one.
+   else if ( pd.m_pDownsampleState )
+   {
+      int err = src_reset(pd.m_pDownsampleState);
+      if ( err )
+         throw std::runtime_error( src_strerror(err) );
+   }
+   else
+   {
+      int err = 0;
+      pd.m_pDownsampleState = src_new (SRC_SINC_FASTEST, 1, &err) ;
+      if ( !pd.m_pDownsampleState )
+         throw std::runtime_error( src_strerror(err) );
+   }
    pd.m_downsampleData.src_ratio = FDFREQ / freq;
    // ***********************************************************************
 
    //////////////////////////////////////////////////////////////////////////
    if ( pd.m_processType == PT_FOR_FULLSUBMIT ) 
       skipMs = 0; // make sure
-   else if ( duration > 0 )
-   {
-      // skip + size + right normalization window + FFT guard
-      // 
-      int stdDurationMs = static_cast<int>((QUERY_START_SECS + QUERY_SIZE_SECS + NORMALIZATION_SKIP_SECS + GUARD_SIZE_SECS) * 1000);
-      int actualDurationMs = duration * 1000;
-      // compute the actual skipMs depending on the duration
-      if ( actualDurationMs < stdDurationMs )
-         skipMs -= max( stdDurationMs - actualDurationMs, 0 );
-   }
 
-   pd.m_toSkipMs = max( static_cast<int>(skipMs) - static_cast<int>((pd.m_normalizedWindowMs/2)), 0 );
-   pd.m_toSkipSize = static_cast<size_t>( freq * nchannels * 
-                                          (pd.m_toSkipMs / 1000.0) ); // half the norm window in secs;
+   computeSkip( skipMs, duration, pd.m_normalizedWindowMs, freq, nchannels, 
+                pd.m_toSkipMs, pd.m_toSkipSize );
 
    //if ( pd.m_processType == PT_FOR_QUERY && skipMs > pd.m_normalizedWindowMs/2 )
    //{
@@ -310,7 +536,12 @@ void initCustom( PimplData& pd,
    pd.m_groupsReady = false;
    pd.m_preBufferPassed = false;
 
+   // the extractor might be recycled: forget the energy of the previous stream
+   pd.m_normWindow.clear();
+
    // prepare the position for pre-buffering
+   pd.m_pDownsampledPCM = pd.m_pPrevDownsampledPCM = pd.m_pDownsampledStorage;
+   pd.m_pEndDownsampledBuf = pd.m_pDownsampledPCM + pd.m_fullDownsampledBufferSize;
    pd.m_pDownsampledCurrIt = pd.m_pDownsampledPCM + (pd.m_downsampledProcessSize - (pd.m_normWindow.size() / 2) ); 
 
    pd.m_toProcessKeys = fingerprint::getTotalKeys(pd.m_lengthMs);//  (m_lengthMs * DFREQ) / (1000 * OVERLAPSAMPLES) + 1;
@@ -325,6 +556,70 @@ void initCustom( PimplData& pd,
 
    pd.m_groupWindow.clear();
    pd.m_processedKeys = 0;
+
+   pd.m_pSink = NULL;
+   pd.m_sinkUniqueKeys.clear();
+   pd.m_sinkBadGroup = false;
+}
+
+// -----------------------------------------------------------------------------
+
+// How much of the beginning of the stream is skipped: skipMs minus half the
+// normalization window (which is read before the first block), and less
+// than that if the track is too short.
+void computeSkip( unsigned int skipMs, int duration, unsigned int normalizedWindowMs,
+                  int freq, int nchannels, size_t& toSkipMs, size_t& toSkipSize )
+{
+   if ( duration > 0 )
+   {
+      // skip + size + right normalization window + FFT guard
+      // 
+      int stdDurationMs = static_cast<int>((QUERY_START_SECS + QUERY_SIZE_SECS + NORMALIZATION_SKIP_SECS + GUARD_SIZE_SECS) * 1000);
+      int actualDurationMs = duration * 1000;
+      // compute the actual skipMs depending on the duration
+      if ( actualDurationMs < stdDurationMs )
+         skipMs -= max( stdDurationMs - actualDurationMs, 0 );
+   }
+
+   toSkipMs = max( static_cast<int>(skipMs) - static_cast<int>((normalizedWindowMs/2)), 0 );
+   toSkipSize = static_cast<size_t>( freq * nchannels * 
+                                     (toSkipMs / 1000.0) ); // half the norm window in secs;
+}
+
+// -----------------------------------------------------------------------------
+
+bool FingerprintExtractor::process( const short* pPCM, size_t num_samples, bool end_of_stream )
+{
+   return processPCM( *m_pPimplData, ShortPCMReader(pPCM, m_pPimplData->m_nchannels), num_samples, end_of_stream );
+}
+
+// -----------------------------------------------------------------------------
+
+bool FingerprintExtractor::processFloat( const float* pPCM, size_t num_samples, bool end_of_stream )
+{
+   return processPCM( *m_pPimplData, FloatPCMReader(pPCM, m_pPimplData->m_nchannels), num_samples, end_of_stream );
+}
+
+// -----------------------------------------------------------------------------
+
+bool FingerprintExtractor::processInt32( const int* pPCM, size_t num_samples, bool end_of_stream )
+{
+   return processPCM( *m_pPimplData, Int32PCMReader(pPCM, m_pPimplData->m_nchannels), num_samples, end_of_stream );
+}
+
+// -----------------------------------------------------------------------------
+
+bool FingerprintExtractor::processInt24( const unsigned char* pPCM, size_t num_samples, bool end_of_stream )
+{
+   return processPCM( *m_pPimplData, Int24PCMReader(pPCM, m_pPimplData->m_nchannels), num_samples, end_of_stream );
+}
+
+// -----------------------------------------------------------------------------
+
+bool FingerprintExtractor::processPlanarFloat( const float* const* ppChannels, size_t num_frames, bool end_of_stream )
+{
+   return processPCM( *m_pPimplData, PlanarFloatPCMReader(ppChannels, m_pPimplData->m_nchannels),
+                      num_frames * m_pPimplData->m_nchannels, end_of_stream );
 }
 
 // -----------------------------------------------------------------------------
@@ -359,26 +654,27 @@ void initCustom( PimplData& pd,
 //
 // repeat until enough blocks processed and enough groups!
 //
-bool FingerprintExtractor::process( const short* pPCM, size_t num_samples, bool end_of_stream )
+bool processPCM( PimplData& pd, const PCMReader& pcm, size_t num_samples, bool end_of_stream )
 {
-   if ( num_samples == 0 )
-      return false;
+   // (a stream can be ended with no more samples)
+   const bool stream_ends = end_of_stream && pd.m_processType == PT_FOR_STREAM;
 
-   // easier read
-   PimplData& pd = *m_pPimplData;
+   if ( num_samples == 0 && !stream_ends )
+      return false;
 
    if ( pd.m_processType == PT_UNKNOWN )
-      throw std::runtime_error("Please call initForQuery() or initForFullSubmit() before process()!");
+      throw std::runtime_error("Please call initForQuery(), initForFullSubmit() or initForStream() before process()!");
 
-   const short* pSourcePCMIt = pPCM;
-   const short* pSourcePCMIt_end = pPCM + num_samples;
+   // positions in samples in the caller's buffer
+   size_t sourcePos = 0;
+   const size_t sourceEnd = num_samples;
 
    if ( !pd.m_skipPassed )
    {
       // needs to skip data? (reminder: the query needs to skip QUERY_START_SECS (- half of the normalization window)
       if ( pd.m_skippedSoFar + num_samples > pd.m_toSkipSize )
       {
-         pSourcePCMIt = pPCM + (pd.m_toSkipSize - pd.m_skippedSoFar);
+         sourcePos = pd.m_toSkipSize - pd.m_skippedSoFar;
          pd.m_skipPassed = true;
       }
       else
@@ -390,34 +686,28 @@ bool FingerprintExtractor::process( const short* pPCM, size_t num_samples, bool
    }
 
    pair<size_t, size_t> readData(0,0);
-   pd.m_downsampleData.end_of_input = end_of_stream ? 1 : 0;
 
    //////////////////////////////////////////////////////////////////////////
    // PREBUFFER:
    if ( !pd.m_preBufferPassed )
    {
       // 1. downsample [norm + cb] frames to m_bufferSize - norm/2
-      pd.m_floatInData.resize( (pSourcePCMIt_end - pSourcePCMIt) / pd.m_nchannels);
-      src_short_to_float_and_mono_array( pSourcePCMIt, 
-                                         &(pd.m_floatInData[0]), static_cast<int>(pSourcePCMIt_end - pSourcePCMIt), 
-                                         pd.m_nchannels);
-
-      pd.m_downsampleData.data_in = &(pd.m_floatInData[0]);
-      pd.m_downsampleData.input_frames = static_cast<long>(pd.m_floatInData.size());
-
-      pd.m_downsampleData.data_out = pd.m_pDownsampledCurrIt;
-      pd.m_downsampleData.output_frames = static_cast<long>(pd.m_pEndDownsampledBuf - pd.m_pDownsampledCurrIt);
-
-      int err = src_process(pd.m_pDownsampleState, &(pd.m_downsampleData));
-      if ( err )
-         throw std::runtime_error( src_strerror(err) );
-
-      pd.m_pDownsampledCurrIt += pd.m_downsampleData.output_frames_gen;
+      const size_t usedFrames = downsample( pd, pcm, sourcePos,
+                                            (sourceEnd - sourcePos) / pd.m_nchannels,
+                                            end_of_stream );
 
       if ( pd.m_pDownsampledCurrIt != pd.m_pEndDownsampledBuf )
+      {
+         if ( stream_ends )
+         {
+            // the stream ended before the first block: there are no keys
+            pd.m_processType = PT_UNKNOWN;
+            return true;
+         }
          return false; // NEED MORE DATA
+      }
 
-      pSourcePCMIt += pd.m_downsampleData.input_frames_used * pd.m_nchannels;
+      sourcePos += usedFrames * pd.m_nchannels;
 
       size_t pos = pd.m_downsampledProcessSize;
       size_t window_pos = pd.m_downsampledProcessSize - pd.m_normWindow.size() / 2;
@@ -428,11 +718,7 @@ bool FingerprintExtractor::process( const short* pPCM, size_t num_samples, bool
          pd.m_normWindow.add(pd.m_pDownsampledPCM[window_pos] * pd.m_pDownsampledPCM[window_pos]);
 
       // 3. normalize [m_bufferSize..m_bufferSize+cb]
-      for (; pos < pd.m_downsampledProcessSize + pd.m_compensateBufferSize; ++pos, ++window_pos)
-      {
-         pd.m_pDownsampledPCM[pos] /= getRMS(pd.m_normWindow);
-         pd.m_normWindow.add(pd.m_pDownsampledPCM[window_pos] * pd.m_pDownsampledPCM[window_pos]);
-      }
+      normalize(pd, pos, window_pos, pd.m_compensateBufferSize);
 
       pd.m_preBufferPassed = true;
    }
@@ -445,40 +731,57 @@ bool FingerprintExtractor::process( const short* pPCM, size_t num_samples, bool
    {
 
       // 1. copy [m_bufferSize..m_bufferSize + cb + norm/2] to beginning
+      //    (which is just moving the buffer forward, unless we are at the
+      //    end of the storage)
       if ( pd.m_pDownsampledCurrIt == pd.m_pEndDownsampledBuf )
       {
-         memcpy( pd.m_pDownsampledPCM, pd.m_pDownsampledPCM + pd.m_downsampledProcessSize,
-                (pd.m_compensateBufferSize + (pd.m_normWindow.size() / 2)) * sizeof(float));
+         pd.m_pPrevDownsampledPCM = pd.m_pDownsampledPCM;
+
+         if ( pd.m_pEndDownsampledBuf + pd.m_downsampledProcessSize <= pd.m_pEndDownsampledStorage )
+            pd.m_pDownsampledPCM += pd.m_downsampledProcessSize;
+         else
+         {
+            memcpy( pd.m_pDownsampledStorage, pd.m_pDownsampledPCM + pd.m_downsampledProcessSize,
+                   (pd.m_compensateBufferSize + (pd.m_normWindow.size() / 2)) * sizeof(float));
+            pd.m_pDownsampledPCM = pd.m_pDownsampledStorage;
+         }
+
+         pd.m_pEndDownsampledBuf = pd.m_pDownsampledPCM + pd.m_fullDownsampledBufferSize;
          pd.m_pDownsampledCurrIt = pd.m_pDownsampledPCM + (pd.m_compensateBufferSize + (pd.m_normWindow.size() / 2));
       }
 
       // 2. read m_bufferSize frames to cb + norm/2
-      pd.m_floatInData.resize( (pSourcePCMIt_end - pSourcePCMIt) / pd.m_nchannels);
+      const size_t numFrames = (sourceEnd - sourcePos) / pd.m_nchannels;
 
-      if ( pd.m_floatInData.empty() )
+      if ( numFrames == 0 && !stream_ends )
          return false;
 
-      src_short_to_float_and_mono_array( pSourcePCMIt, 
-                                         &(pd.m_floatInData[0]), static_cast<int>(pSourcePCMIt_end - pSourcePCMIt), 
-                                         pd.m_nchannels);
-
-      pd.m_downsampleData.data_in = &(pd.m_floatInData[0]);
-      pd.m_downsampleData.input_frames = static_cast<long>(pd.m_floatInData.size());
+      // (a stream ended with no samples only flushes the resampler, and the
+      // block read so far goes on as the short last one)
+      const size_t usedFrames = downsample( pd, pcm, sourcePos, numFrames, end_of_stream );
 
-      pd.m_downsampleData.data_out = pd.m_pDownsampledCurrIt;
-      pd.m_downsampleData.output_frames = static_cast<long>(pd.m_pEndDownsampledBuf - pd.m_pDownsampledCurrIt);
-
-      int err = src_process(pd.m_pDownsampleState, &(pd.m_downsampleData));
-      if ( err )
-         throw std::runtime_error( src_strerror(err) );
+      if ( numFrames == 0 &&
+           pd.m_pDownsampledCurrIt == pd.m_pDownsampledPCM + (pd.m_compensateBufferSize + (pd.m_normWindow.size() / 2)) )
+         break; // nothing new, but still have to flush the last group
 
-      pd.m_pDownsampledCurrIt += pd.m_downsampleData.output_frames_gen;
+      // how much of the buffer is real audio
+      size_t filled = pd.m_fullDownsampledBufferSize;
 
-      if ( pd.m_pDownsampledCurrIt != pd.m_pEndDownsampledBuf && !end_of_stream )
-         return false; // NEED MORE DATA
+      if ( pd.m_pDownsampledCurrIt != pd.m_pEndDownsampledBuf )
+      {
+         if ( !end_of_stream )
+            return false; // NEED MORE DATA
+
+         // The last block is short: the rest of the buffer is processed anyway,
+         // with what the previous block left there, as when the buffer was
+         // always copied back in place.
+         filled = pd.m_pDownsampledCurrIt - pd.m_pDownsampledPCM;
+         memmove( pd.m_pDownsampledCurrIt, pd.m_pPrevDownsampledPCM + filled,
+                  (pd.m_pEndDownsampledBuf - pd.m_pDownsampledCurrIt) * sizeof(float) );
+      }
 
       //pSourcePCMIt += readData.second;
-      pSourcePCMIt += pd.m_downsampleData.input_frames_used * pd.m_nchannels;
+      sourcePos += usedFrames * pd.m_nchannels;
 
       // ********************************************************************
 
@@ -486,52 +789,78 @@ bool FingerprintExtractor::process( const short* pPCM, size_t num_samples, bool
       size_t pos = static_cast<unsigned int>(pd.m_compensateBufferSize);
       size_t window_pos = static_cast<unsigned int>(pd.m_compensateBufferSize + (pd.m_normWindow.size() / 2));
 
-      for(; pos < pd.m_downsampledProcessSize + pd.m_compensateBufferSize /* m_fullDownsampledBufferSize*/; ++pos, ++window_pos)
-      {
-         pd.m_pDownsampledPCM[pos] /= getRMS(pd.m_normWindow);
-         pd.m_normWindow.add(pd.m_pDownsampledPCM[window_pos] * pd.m_pDownsampledPCM[window_pos]);
-      }
+      normalize(pd, pos, window_pos, pd.m_downsampledProcessSize);
+      pos += pd.m_downsampledProcessSize;
 
       // 4. fft/process/whatevs [0...m_bufferSize+cb]
-      pd.m_processedKeys += processKeys(pd.m_groupWindow, pos, pd);
+      //    (the streaming mode stops at the real audio: the keys of the rest
+      //    would be for audio that never existed)
+      const size_t keysSize = pd.m_processType == PT_FOR_STREAM ? min(pos, filled) : pos;
+      pd.m_processedKeys += processKeys(pd.m_groupWindow, keysSize, pd);
+
+      if ( pd.m_processType == PT_FOR_STREAM )
+         moveStreamGroups(pd, false);
+      else if ( pd.m_pSink )
+         writeToSink(pd, false);
 
       // we have too many keys, now we have to chop either one end or the other
       if (pd.m_toProcessKeys != 0 && pd.m_processedKeys > pd.m_toProcessKeys)
       {
          // set up window begin and end
-         deque<GroupData>::iterator itBeg = pd.m_groupWindow.begin(), itEnd = pd.m_groupWindow.end();
+         GroupData* itBeg = pd.m_groupWindow.begin();
+         GroupData* itEnd = pd.m_groupWindow.end();
          unsigned int offset_left, offset_right;
 
          found_enough_unique_keys = 
             fingerprint::findSignificantGroups( itBeg, itEnd, offset_left, offset_right, pd.m_toProcessKeys,
                                                 pd.m_totalWindowKeys, pd.m_minUniqueKeys);
 
+         size_t first = itBeg - pd.m_groupWindow.begin();
+         size_t last = itEnd - pd.m_groupWindow.begin();
+
          // if we're happy with this set, snip the beginning and end of the grouped keys
          if (found_enough_unique_keys)
          {
-            itBeg->count -= offset_left;
-            if (offset_right > 0 && itEnd != pd.m_groupWindow.end())
+            pd.m_groupWindow.setCount(first, pd.m_groupWindow[first].count - offset_left);
+            if (offset_right > 0 && last != pd.m_groupWindow.size())
             {
-               itEnd->count = offset_right;
-               ++itEnd;
+               pd.m_groupWindow.setCount(last, offset_right);
+               ++last;
             }
          }
 
-         // chop the deque
-         copy(itBeg, itEnd, pd.m_groupWindow.begin());
-         pd.m_groupWindow.resize(itEnd - itBeg);            
-
-         // recalc keys
-         pd.m_processedKeys = 0;
-         for (deque<GroupData>::const_iterator it = pd.m_groupWindow.begin(); it != pd.m_groupWindow.end(); ++it)
-            pd.m_processedKeys += it->count;
+         // chop the window (the front just moves forward)
+         pd.m_groupWindow.trim(first, last);
+         pd.m_processedKeys = static_cast<unsigned int>(pd.m_groupWindow.numKeys());
       }
 
-      if ( end_of_stream )
+      // the last call goes through all the data it's given, not only its
+      // first block
+      if ( end_of_stream && sourcePos == sourceEnd )
          break;
 
    } // while (totalKeys == 0 || keys < totalKeys || !found_enough_unique_keys)
 
+   if ( pd.m_processType == PT_FOR_STREAM )
+   {
+      // the stream is over: the last group can't grow anymore
+      moveStreamGroups(pd, true);
+      pd.m_processType = PT_UNKNOWN;
+      return true;
+   }
+
+   if ( pd.m_pSink )
+   {
+      writeToSink(pd, true);
+      pd.m_pSink->finish();
+
+      if ( pd.m_sinkBadGroup || pd.m_sinkUniqueKeys.size() < static_cast<size_t>(pd.m_minUniqueKeys) )
+         throw std::runtime_error("Not enough unique keys (it's the file too short?)");
+
+      pd.m_groupsReady = true;
+      pd.m_processType = PT_UNKNOWN;
+      return true;
+   }
 
    if (pd.m_toProcessKeys != 0 && pd.m_processedKeys < pd.m_toProcessKeys)
       throw std::runtime_error("Couldn't deliver the requested number of keys (it's the file too short?)");
@@ -542,10 +871,7 @@ bool FingerprintExtractor::process( const short* pPCM, size_t num_samples, bool
       throw std::runtime_error("Not enough unique keys (it's the file too short?)");
    }
 
-   // copy to a vector so that they can be returned as contiguous data
-   pd.m_groups.resize(pd.m_groupWindow.size());
-   copy(pd.m_groupWindow.begin(), pd.m_groupWindow.end(), pd.m_groups.begin());
-
+   // the window is contiguous: getFingerprint() returns it as it is
    pd.m_groupsReady = true;
    pd.m_processType = PT_UNKNOWN;
    return true;
@@ -553,25 +879,148 @@ bool FingerprintExtractor::process( const short* pPCM, size_t num_samples, bool
 
 // -----------------------------------------------------------------------------
 
+// Streaming mode: moves the groups of the window to the ones for pollKeys(),
+// with their time. Unless all is set, the last group is kept back, as the
+// next block might continue it.
+void moveStreamGroups( PimplData& pd, bool all )
+{
+   size_t numGroups = pd.m_groupWindow.size();
+   if ( !all && numGroups > 0 )
+      --numGroups;
+
+   // the first block starts half a normalization window into the stream, and
+   // the key is centered KEYWIDTH/2 frames into its filters
+   const double firstKeyPos = static_cast<double>(pd.m_normWindow.size() / 2 + (Filter::KEYWIDTH / 2) * OVERLAPSAMPLES);
+
+   for ( size_t i = 0; i < numGroups; ++i )
+   {
+      const GroupData& gd = pd.m_groupWindow[i];
+
+      StreamGroup sg;
+      sg.key = gd.key;
+      sg.count = gd.count;
+      sg.startMs = (firstKeyPos + static_cast<double>(pd.m_streamKeyPos) * OVERLAPSAMPLES) * 1000.0 / FDFREQ;
+      pd.m_streamGroups.push_back(sg);
+
+      pd.m_streamKeyPos += gd.count;
+   }
+
+   pd.m_groupWindow.erase_front(numGroups);
+}
+
+// -----------------------------------------------------------------------------
+
+// Full submit to a sink: writes the groups of the window and drops them.
+// Unless all is set, the last group is kept back, as the next block might
+// continue it.
+void writeToSink( PimplData& pd, bool all )
+{
+   size_t numGroups = pd.m_groupWindow.size();
+   if ( !all && numGroups > 0 )
+      --numGroups;
+
+   if ( numGroups == 0 )
+      return;
+
+   pd.m_sinkBuffer.resize(numGroups);
+   for ( size_t i = 0; i < numGroups; ++i )
+   {
+      const GroupData& gd = pd.m_groupWindow[i];
+
+      // as enoughUniqueGoodGroups() on the whole track: only the groups
+      // until the first minUniqueKeys different keys count
+      if ( !pd.m_sinkBadGroup && pd.m_sinkUniqueKeys.size() < static_cast<size_t>(pd.m_minUniqueKeys) )
+      {
+         if ( gd.count > MAX_GOOD_GROUP_SIZE )
+            pd.m_sinkBadGroup = true;
+         else
+            pd.m_sinkUniqueKeys.insert(gd.key);
+      }
+
+#if __BIG_ENDIAN__
+      pd.m_sinkBuffer[i].key = reorderbits(gd.key);
+      pd.m_sinkBuffer[i].count = reorderbits(gd.count);
+#else
+      pd.m_sinkBuffer[i] = gd;
+#endif
+   }
+
+   pd.m_pSink->write( reinterpret_cast<const char*>(&pd.m_sinkBuffer[0]), numGroups * sizeof(GroupData) );
+   pd.m_groupWindow.erase_front(numGroups);
+}
+
+// -----------------------------------------------------------------------------
+
+// Converts to mono float and downsamples as much of the pcm (from the sample
+// pos) as fits between m_pDownsampledCurrIt and the end of the buffer, moving
+// m_pDownsampledCurrIt.
+// The conversion goes through a small block instead of a copy of the whole
+// input, so the floats are still in cache when the resampler reads them.
+// Returns the number of frames of pcm that were used.
+// With end_of_input and no frames, it just flushes what the resampler holds.
+size_t downsample( PimplData& pd, const PCMReader& pcm, size_t pos, size_t numFrames, bool end_of_input )
+{
+   SRC_DATA& data = pd.m_downsampleData;
+   size_t usedFrames = 0;
+   bool flush = end_of_input && numFrames == 0;
+
+   while ( (usedFrames < numFrames || flush) && pd.m_pDownsampledCurrIt != pd.m_pEndDownsampledBuf )
+   {
+      flush = false;
+
+      const size_t blockFrames = min( numFrames - usedFrames, static_cast<size_t>(FLOAT_BLOCK_SIZE) );
+      if ( blockFrames > 0 )
+         pcm.toMono( pos + usedFrames * pd.m_nchannels, blockFrames, pd.m_floatInBlock );
+
+      data.data_in = pd.m_floatInBlock;
+      data.input_frames = static_cast<long>(blockFrames);
+      data.data_out = pd.m_pDownsampledCurrIt;
+      data.output_frames = static_cast<long>(pd.m_pEndDownsampledBuf - pd.m_pDownsampledCurrIt);
+      data.end_of_input = ( end_of_input && usedFrames + blockFrames == numFrames ) ? 1 : 0;
+
+      if ( pd.m_useOptResampler )
+         pd.m_optResampler.process(data);
+      else
+      {
+         int err = src_process(pd.m_pDownsampleState, &data);
+         if ( err )
+            throw std::runtime_error( src_strerror(err) );
+      }
+
+      pd.m_pDownsampledCurrIt += data.output_frames_gen;
+      usedFrames += data.input_frames_used;
+
+      if ( data.input_frames_used < data.input_frames )
+         break; // the output is full
+   }
+
+   return usedFrames;
+}
+
+// -----------------------------------------------------------------------------
+
 pair<const char*, size_t> FingerprintExtractor::getFingerprint()
 {
    // easier read
    PimplData& pd = *m_pPimplData;
 
+   if ( pd.m_groupsReady && pd.m_pSink )
+      return pd.m_pSink->getFingerprint();
+
    if ( pd.m_groupsReady )
    {
 #if __BIG_ENDIAN__
-      pd.m_bigEndianGroups.resize(pd.m_groups.size());
-      for ( size_t i = 0; i < pd.m_groups.size(); ++i )
+      pd.m_bigEndianGroups.resize(pd.m_groupWindow.size());
+      for ( size_t i = 0; i < pd.m_groupWindow.size(); ++i )
       {
-         pd.m_bigEndianGroups[i].key = reorderbits(pd.m_groups[i].key);
-         pd.m_bigEndianGroups[i].count = reorderbits(pd.m_groups[i].count);
+         pd.m_bigEndianGroups[i].key = reorderbits(pd.m_groupWindow[i].key);
+         pd.m_bigEndianGroups[i].count = reorderbits(pd.m_groupWindow[i].count);
       }
 
       return make_pair(reinterpret_cast<const char*>(&pd.m_bigEndianGroups[0]), pd.m_bigEndianGroups.size() * sizeof(GroupData) );
 
 #else
-      return make_pair(reinterpret_cast<const char*>(&pd.m_groups[0]), pd.m_groups.size() * sizeof(GroupData) );
+      return make_pair(reinterpret_cast<const char*>(pd.m_groupWindow.data()), pd.m_groupWindow.size() * sizeof(GroupData) );
 #endif
    }
    else
@@ -582,10 +1031,10 @@ pair<const char*, size_t> FingerprintExtractor::getFingerprint()
 // -----------------------------------------------------------------------------
 // -----------------------------------------------------------------------------
 
-float getRMS(const FloatingAverage<double>& signal)
+float getRMS(double average)
 {
    // we don't want to normalize by the real rms, because excessive clipping will occur
-   float rms = sqrtf(static_cast<float>(signal.getAverage())) * 10.0F;
+   float rms = sqrtf(static_cast<float>(average)) * 10.0F;
 
    if (rms < 0.1F)
       rms = 0.1F;
@@ -597,7 +1046,58 @@ float getRMS(const FloatingAverage<double>& signal)
 
 // -----------------------------------------------------------------------------
 
-unsigned int processKeys( deque<GroupData>& groups, size_t size, PimplData& pd )
+// Normalizes the samples from pos while the window slides over the ones from
+// window_pos. It is the same as numSamples times
+//
+//    pcm[pos++] /= getRMS(window average);
+//    window.add(pcm[window_pos] * pcm[window_pos]); ++window_pos;
+//
+// but a block at a time: only the running sum of the window is serial, the
+// sqrt, the clamp and the divisions are done four at a time.
+void normalize( PimplData& pd, size_t pos, size_t window_pos, size_t numSamples )
+{
+   float* pPCM = pd.m_pDownsampledPCM;
+   double* pSquares = pd.m_normSquares;
+   double* pAverages = pd.m_normAverages;
+
+   while ( numSamples > 0 )
+   {
+      // the samples entering the window must still be the original ones
+      const size_t blockSize = min( min(numSamples, static_cast<size_t>(NORM_BLOCK_SIZE)), window_pos - pos );
+
+      for ( size_t i = 0; i < blockSize; ++i )
+         pSquares[i] = pPCM[window_pos + i] * pPCM[window_pos + i]; // (float product, as before)
+
+      pd.m_normWindow.addBlock(pSquares, blockSize, pAverages);
+
+      float* pOut = pPCM + pos;
+      size_t i = 0;
+#ifdef FP_SSE2_NORMALIZE
+      const __m128 ten = _mm_set1_ps(10.0F);
+      const __m128 minRMS = _mm_set1_ps(0.1F);
+      const __m128 maxRMS = _mm_set1_ps(3.0F);
+      for ( ; i + 4 <= blockSize; i += 4 )
+      {
+         const __m128 avg = _mm_movelh_ps( _mm_cvtpd_ps(_mm_loadu_pd(pAverages + i)),
+                                           _mm_cvtpd_ps(_mm_loadu_pd(pAverages + i + 2)) );
+         __m128 rms = _mm_mul_ps( _mm_sqrt_ps(avg), ten );
+         // min/max return the second operand on NaN: a NaN goes through as in getRMS
+         rms = _mm_min_ps( maxRMS, _mm_max_ps(minRMS, rms) );
+         _mm_storeu_ps( pOut + i, _mm_div_ps(_mm_loadu_ps(pOut + i), rms) );
+      }
+#endif
+      for ( ; i < blockSize; ++i )
+         pOut[i] /= getRMS(pAverages[i]);
+
+      pos += blockSize;
+      window_pos += blockSize;
+      numSamples -= blockSize;
+   }
+}
+
+// -----------------------------------------------------------------------------
+
+unsigned int processKeys( GroupBuffer<GroupData>& groups, size_t size, PimplData& pd )
 {
    size_t read_size = min(size, pd.m_downsampledProcessSize + pd.m_compensateBufferSize);
 
@@ -606,10 +1106,10 @@ unsigned int processKeys( deque<GroupData>& groups, size_t size, PimplData& pd )
    if ( numFrames <= Filter::KEYWIDTH )
       return 0; // skip it when the number of frames is too small
 
-   float** ppFrames = pd.m_pFFT->getFrames();
+   FrameView frames = pd.m_pFFT->getFrames();
 
-   integralImage(ppFrames, numFrames);
-   computeBits(pd.m_partialBits, pd.m_filters, ppFrames, numFrames);
+   integralImage(frames, numFrames);
+   pd.m_pBits->process(pd.m_partialBits, frames, numFrames);
    fingerprint::keys2GroupData(pd.m_partialBits, groups, false);
 
    return static_cast<unsigned int>(pd.m_partialBits.size());
@@ -618,174 +1118,29 @@ unsigned int processKeys( deque<GroupData>& groups, size_t size, PimplData& pd )
 
 // -----------------------------------------------------------------------------
 
-void integralImage(float** ppFrames, unsigned int nFrames)
+void integralImage(const FrameView& frames, unsigned int nFrames)
 {
    for (unsigned int y = 1; y < nFrames; y++) 
    {
-      ppFrames[y][0] += ppFrames[y-1][0];
+      frames[y][0] += frames[y-1][0];
    }
 
    for (unsigned int x = 1; x < Filter::NBANDS; x++) 
    {
-      ppFrames[0][x] += ppFrames[0][x-1];
+      frames[0][x] += frames[0][x-1];
    }
 
    for (unsigned int y = 1; y < nFrames; y++) 
    {
       for (unsigned int x = 1; x < Filter::NBANDS; x++) 
       {
-         ppFrames[y][x] += static_cast<float>( static_cast<double>(ppFrames[y-1][x]) + 
-                                               static_cast<double>(ppFrames[y][x-1]) - 
-                                               static_cast<double>(ppFrames[y-1][x-1]) );
+         frames[y][x] += static_cast<float>( static_cast<double>(frames[y-1][x]) + 
+                                             static_cast<double>(frames[y][x-1]) - 
+                                             static_cast<double>(frames[y-1][x-1]) );
       }
    }
 }
 
-// ---------------------------------------------------------------------
-//
-/// Convert bands to bits, using the supplied filters
-void computeBits( vector<unsigned int>& bits,
-                  const vector<Filter>& f, 
-                  float ** frames, unsigned int nframes ) 
-{
-   unsigned int first_time = Filter::KEYWIDTH / 2 + 1;
-   unsigned int last_time = nframes - Filter::KEYWIDTH / 2;
-
-   unsigned int numBits = last_time - first_time + 1;
-   bits.resize(numBits);
-
-   const unsigned int fSize = static_cast<unsigned int>(f.size());
-   std::bitset<32> bt;
-   double X = 0;
-
-   for (unsigned int t2 = first_time; t2 <= last_time; ++t2) 
-   {
-
-      for (unsigned int i = 0; i < fSize; ++i) 
-      {
-         // we subtract 1 from t1 and b1 because we use integral images
-      
-         unsigned int t1 = (unsigned int) ((float) t2 - f[i].wt / 2.0 - 1);
-         unsigned int t3 = (unsigned int) ((float) t2 + f[i].wt / 2.0 - 1);
-         unsigned int b1 = f[i].first_band;
-         unsigned int b2 = (unsigned int) round__((float) b1 + f[i].wb / 2.0) - 1;
-         unsigned int b3 = b1 + f[i].wb - 1;
-         --b1;
-
-         unsigned int t_1q = (t1 + t2) / 2; // one quarter time 
-         unsigned int t_3q = t_1q + (t3 - t1 + 1) / 2; // three quarter time
-         unsigned int b_1q = (b1 + b2) / 2; // one quarter band
-         unsigned int b_3q = b_1q + (b3 - b1) / 2; // three quarter band
-         
-         X = 0;
-         
-         // we should check from t1 > 0, but in practice, this doesn't happen
-         // we subtract 1 from everything because this came from matlab where indices start from 1
-         switch (f[i].filter_type) {
-         case 1: { // total energy
-            if (b1 > 0)
-               X = static_cast<double>(frames[t3-1][b3-1]) - static_cast<double>(frames[t3-1][b1-1])
-                 - static_cast<double>(frames[t1-1][b3-1]) + static_cast<double>(frames[t1-1][b1-1]);
-            else
-               X = static_cast<double>(frames[t3-1][b3-1]) - static_cast<double>(frames[t1-1][b3-1]);
-            break;
-         }
-         case 2: { // energy difference over time
-            if (b1 > 0)
-               X = static_cast<double>(frames[t1-1][b1-1]) - 2*static_cast<double>(frames[t2-2][b1-1])
-                 + static_cast<double>(frames[t3-1][b1-1]) - static_cast<double>(frames[t1-1][b3-1])
-                 + 2*static_cast<double>(frames[t2-2][b3-1]) - static_cast<double>(frames[t3-1][b3-1]);
-            else
-               X = - static_cast<double>(frames[t1-1][b3-1]) + 2*static_cast<double>(frames[t2-2][b3-1])
-                   - static_cast<double>(frames[t3-1][b3-1]);
-            break;
-         
-         }
-         case 3: { // energy difference over bands
-            if (b1 > 0)
-               X = static_cast<double>(frames[t1-1][b1-1]) - static_cast<double>(frames[t3-1][b1-1])
-                 - 2*static_cast<double>(frames[t1-1][b2-1]) + 2*static_cast<double>(frames[t3-1][b2-1])
-                 + static_cast<double>(frames[t1-1][b3-1]) - static_cast<double>(frames[t3-1][b3-1]);
-            else
-               X = - 2*static_cast<double>(frames[t1-1][b2-1]) + 2*static_cast<double>(frames[t3-1][b2-1])
-                   + static_cast<double>(frames[t1-1][b3-1]) - static_cast<double>(frames[t3-1][b3-1]);
-            break;   
-         }
-         case 4: {
-            // energy difference over time and bands
-            if (b1 > 0)
-               X = static_cast<double>(frames[t1-1][b1-1]) - 2*static_cast<double>(frames[t2-2][b1-1])
-                 + static_cast<double>(frames[t3-1][b1-1]) - 2*static_cast<double>(frames[t1-1][b2-1])
-                 + 4*static_cast<double>(frames[t2-2][b2-1]) - 2*static_cast<double>(frames[t3-1][b2-1])
-                 + static_cast<double>(frames[t1-1][b3-1]) - 2*static_cast<double>(frames[t2-2][b3-1])
-                 + static_cast<double>(frames[t3-1][b3-1]);
-            else
-               X = - 2*static_cast<double>(frames[t1-1][b2-1]) + 4*static_cast<double>(frames[t2-2][b2-1])
-                   - 2*static_cast<double>(frames[t3-1][b2-1]) + static_cast<double>(frames[t1-1][b3-1])
-                   - 2*static_cast<double>(frames[t2-2][b3-1]) + static_cast<double>(frames[t3-1][b3-1]);
-            break;   
-         }
-         case 5: { // time peak
-            if (b1 > 0)
-               X = - static_cast<double>(frames[t1-1][b1-1]) + 2*static_cast<double>(frames[t_1q-1][b1-1])
-                   - 2*static_cast<double>(frames[t_3q-1][b1-1]) + static_cast<double>(frames[t3-1][b1-1])
-                   + static_cast<double>(frames[t1-1][b3-1]) - 2*static_cast<double>(frames[t_1q-1][b3-1])
-                   + 2*static_cast<double>(frames[t_3q-1][b3-1]) - static_cast<double>(frames[t3-1][b3-1]);
-            else
-               X = static_cast<double>(frames[t1-1][b3-1]) - 2*static_cast<double>(frames[t_1q-1][b3-1])
-                 + 2*static_cast<double>(frames[t_3q-1][b3-1]) - static_cast<double>(frames[t3-1][b3-1]);
-                  
-            break;
-         }
-         case 6: { // band beak
-            if (b1 > 0)
-               X = - static_cast<double>(frames[t1-1][b1-1]) + static_cast<double>(frames[t3-1][b1-1])
-                   + 2*static_cast<double>(frames[t1-1][b_1q-1]) - 2*static_cast<double>(frames[t3-1][b_1q-1])
-                   - 2*static_cast<double>(frames[t1-1][b_3q-1]) + 2*static_cast<double>(frames[t3-1][b_3q-1])
-                   + static_cast<double>(frames[t1-1][b3-1]) - static_cast<double>(frames[t3-1][b3-1]);
-            else
-               X = + 2*static_cast<double>(frames[t1-1][b_1q-1]) - 2*static_cast<double>(frames[t3-1][b_1q-1])
-                   - 2*static_cast<double>(frames[t1-1][b_3q-1]) + 2*static_cast<double>(frames[t3-1][b_3q-1])
-                   + static_cast<double>(frames[t1-1][b3-1]) - static_cast<double>(frames[t3-1][b3-1]);
-
-            break;
-         }
-         }
-
-         bt[i] = X > f[i].threshold;
-      }
-
-      bits[t2 - first_time] = bt.to_ulong();
-   }
-}
-
-// -----------------------------------------------------------------------------
-
-void src_short_to_float_and_mono_array( const short *in, float *out, int srclen, int nchannels )
-{
-   switch ( nchannels )
-   {
-   case 1:
-      src_short_to_float_array(in, out, srclen);
-      break;
-   case 2:
-      {
-         // this can be optimized
-         int j = 0;
-         const double div = numeric_limits<short>::max() * nchannels;
-         for ( int i = 0; i < srclen; i += 2, ++j )
-         {
-            out[j] = static_cast<float>( static_cast<double>(static_cast<int>(in[i]) + static_cast<int>(in[i+1])) / div );
-         }
-      }
-      break;
-
-   default:
-      throw( std::runtime_error("Unsupported number of channels!") );
-   }
-
-}
-
 // -----------------------------------------------------------------------------
 
 } // end of namespace
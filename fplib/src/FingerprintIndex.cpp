@@ -0,0 +1,134 @@
+/***************************************************************************
+* This file is part of last.fm fingerprint app                             *
+*  Last.fm Ltd <mir@last.fm>                                               *
+*                                                                          *
+* This library is free software; you can redistribute it and/or            *
+* modify it under the terms of the GNU Lesser General Public               *
+* License as published by the Free Software Foundation; either             *
+* version 2.1 of the License, or (at your option) any later version.       *
+*                                                                          *
+* This library is distributed in the hope that it will be useful,          *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+* Lesser General Public License for more details.                          *
+*                                                                          *
+* You should have received a copy of the GNU Lesser General Public         *
+* License along with this library; if not, write to the Free Software      *
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 *
+* USA                                                                      *
+***************************************************************************/
+
+#include <set>
+#include <stdexcept>
+
+#include "../include/FingerprintIndex.h"
+#include "OffsetVoter.h"
+#include "OpenHashTable.h"
+
+namespace fingerprint
+{
+
+using namespace std;
+
+// -----------------------------------------------------------------------------
+
+// a key without postings list yet (OpenHashTable takes it by reference, hence
+// not a static member)
+const unsigned int NO_LIST = 0xFFFFFFFF;
+
+class IndexPimplData
+{
+public:
+
+   IndexPimplData() : m_lists(NO_LIST, 1024) {}
+
+   // the postings of key, or NULL
+   const vector<Posting>* find(unsigned int key) const
+   {
+      const unsigned int* pList = m_lists.find(key);
+      return pList ? &m_postings[*pList] : NULL;
+   }
+
+   vector<Posting>& findOrAdd(unsigned int key)
+   {
+      unsigned int& list = m_lists.insert(key);
+      if ( list == NO_LIST )
+      {
+         list = static_cast<unsigned int>(m_postings.size());
+         m_postings.push_back( vector<Posting>() );
+      }
+
+      return m_postings[list];
+   }
+
+   // for queryIndex
+   const Posting* getPostings(unsigned int key, vector<Posting>& /*scratch*/, size_t& numPostings) const
+   {
+      const vector<Posting>* pPostings = find(key);
+      numPostings = pPostings ? pPostings->size() : 0;
+      return numPostings > 0 ? &(*pPostings)[0] : NULL;
+   }
+
+   set<unsigned int> m_trackIds;
+
+private:
+
+   OpenHashTable<unsigned int, unsigned int> m_lists; // where in m_postings
+   vector< vector<Posting> >                 m_postings; // one list per key
+};
+
+// -----------------------------------------------------------------------------
+
+FingerprintIndex::FingerprintIndex()
+: m_pPimplData(NULL)
+{
+   m_pPimplData = new IndexPimplData();
+}
+
+// -----------------------------------------------------------------------------
+
+FingerprintIndex::~FingerprintIndex()
+{
+   if ( m_pPimplData )
+      delete m_pPimplData;
+}
+
+// -----------------------------------------------------------------------------
+
+void FingerprintIndex::addTrack(unsigned int trackId, const char* pData, size_t size)
+{
+   IndexPimplData& pd = *m_pPimplData;
+
+   if ( pd.m_trackIds.count(trackId) )
+      throw std::runtime_error("The track is already in the index!");
+
+   vector<GroupData> groups;
+   parseFingerprint(pData, size, groups);
+
+   pd.m_trackIds.insert(trackId);
+
+   Posting posting;
+   posting.trackId = trackId;
+   posting.pos = 0;
+   for ( size_t i = 0; i < groups.size(); posting.pos += groups[i].count, ++i )
+      pd.findOrAdd(groups[i].key).push_back(posting);
+}
+
+// -----------------------------------------------------------------------------
+
+size_t FingerprintIndex::getNumTracks() const
+{
+   return m_pPimplData->m_trackIds.size();
+}
+
+// -----------------------------------------------------------------------------
+
+void FingerprintIndex::query( const char* pData, size_t size, vector<IndexMatch>& matches,
+                              size_t maxResults, unsigned int minVotes ) const
+{
+   queryIndex(*m_pPimplData, pData, size, matches, maxResults, minVotes);
+}
+
+// -----------------------------------------------------------------------------
+
+} // end of namespace fingerprint
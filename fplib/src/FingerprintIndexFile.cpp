@@ -0,0 +1,686 @@
+/***************************************************************************
+* This file is part of last.fm fingerprint app                             *
+*  Last.fm Ltd <mir@last.fm>                                               *
+*                                                                          *
+* This library is free software; you can redistribute it and/or            *
+* modify it under the terms of the GNU Lesser General Public               *
+* License as published by the Free Software Foundation; either             *
+* version 2.1 of the License, or (at your option) any later version.       *
+*                                                                          *
+* This library is distributed in the hope that it will be useful,          *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+* Lesser General Public License for more details.                          *
+*                                                                          *
+* You should have received a copy of the GNU Lesser General Public         *
+* License along with this library; if not, write to the Free Software      *
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 *
+* USA                                                                      *
+***************************************************************************/
+
+#include <set>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdio>
+#include <cstring> // for memcmp
+
+#include "../include/FingerprintIndexFile.h"
+#include "OffsetVoter.h"
+#include "LittleEndian.h"
+#include "MappedFile.h"
+
+// -----------------------------------------------------------------------------
+
+namespace
+{
+
+using namespace std;
+using namespace fingerprint;
+
+const char         INDEX_FILE_MAGIC[4] = { 'L', 'F', 'P', 'I' };
+const unsigned int BUCKET_SHIFT = 16; // the top 16 bits of the key
+const size_t       NUM_BUCKETS = (1 << 16);
+
+// where the fields of the header are, in bytes
+// (the 64 bits ones are two 32 bits words, the low one first)
+enum HeaderField
+{
+   HDR_MAGIC        = 0,
+   HDR_VERSION      = 4,
+   HDR_PAGE_SIZE    = 8,
+   HDR_NUM_TRACKS   = 12,
+   HDR_NUM_KEYS     = 16,
+   HDR_NUM_POSTINGS = 20, // 64 bits
+   HDR_BUCKETS_POS  = 28, // 64 bits
+   HDR_KEYS_POS     = 36, // 64 bits
+   HDR_POSTINGS_POS = 44, // 64 bits
+   HDR_POSTINGS_SIZE= 52, // 64 bits
+   HDR_OFFSETS_POS  = 60, // 64 bits
+   HDR_SIZE         = 68
+};
+
+// (the two shifts keep the compilers quiet where size_t is 32 bits)
+inline size_t readLE64(const unsigned char* p)
+{
+   const unsigned int hi = readLE32(p + 4);
+   if ( sizeof(size_t) < 8 && hi != 0 )
+      throw std::runtime_error("The index file is too large for this platform!");
+   return static_cast<size_t>(readLE32(p)) | ((static_cast<size_t>(hi) << 16) << 16);
+}
+
+inline void writeLE64(unsigned char* p, size_t v)
+{
+   writeLE32( p, static_cast<unsigned int>(v) );
+   writeLE32( p + 4, static_cast<unsigned int>((v >> 16) >> 16) );
+}
+
+inline void writeVarint(vector<unsigned char>& out, unsigned int v)
+{
+   while ( v >= 0x80 )
+   {
+      out.push_back( static_cast<unsigned char>(v | 0x80) );
+      v >>= 7;
+   }
+   out.push_back( static_cast<unsigned char>(v) );
+}
+
+inline unsigned int readVarint(const unsigned char*& p, const unsigned char* pEnd)
+{
+   unsigned int v = 0;
+   for ( int shift = 0; shift < 35; shift += 7 )
+   {
+      if ( p == pEnd )
+         break;
+      const unsigned int b = *p++;
+      v |= (b & 0x7F) << shift;
+      if ( b < 0x80 )
+         return v;
+   }
+   throw std::runtime_error("The postings of the index file are corrupted!");
+}
+
+// -----------------------------------------------------------------------------
+
+struct IndexEntry
+{
+   unsigned int key;
+   unsigned int trackId;
+   unsigned int pos;
+};
+
+bool operator<(const IndexEntry& a, const IndexEntry& b)
+{
+   if ( a.key != b.key )
+      return a.key < b.key;
+   if ( a.trackId != b.trackId )
+      return a.trackId < b.trackId;
+   return a.pos < b.pos;
+}
+
+// -----------------------------------------------------------------------------
+
+// A sorted run of postings spilled by the builder to a temporary file, read
+// back a buffer at a time.
+class RunReader
+{
+public:
+
+   RunReader(FILE* pFile, size_t bufferEntries)
+   : m_pFile(pFile), m_bufferEntries(bufferEntries), m_pos(0)
+   {
+      if ( fseek(m_pFile, 0, SEEK_SET) != 0 )
+         throw std::runtime_error("Cannot read back the postings of the index!");
+      fill();
+   }
+
+   bool empty() const { return m_buffer.empty(); }
+
+   const IndexEntry& front() const { return m_buffer[m_pos]; }
+
+   void pop()
+   {
+      if ( ++m_pos == m_buffer.size() )
+         fill();
+   }
+
+private:
+
+   void fill()
+   {
+      m_buffer.resize(m_bufferEntries);
+      const size_t n = fread( &m_buffer[0], sizeof(IndexEntry), m_buffer.size(), m_pFile );
+      if ( n < m_buffer.size() && ferror(m_pFile) )
+         throw std::runtime_error("Cannot read back the postings of the index!");
+      m_buffer.resize(n);
+      m_pos = 0;
+   }
+
+   FILE*              m_pFile;
+   size_t             m_bufferEntries;
+   vector<IndexEntry> m_buffer;
+   size_t             m_pos;
+};
+
+// for the heap of the runs: the one with the smallest first entry on top
+struct RunGreater
+{
+   explicit RunGreater(const vector<RunReader>& runs) : pRuns(&runs) {}
+
+   bool operator()(size_t a, size_t b) const
+   { return (*pRuns)[b].front() < (*pRuns)[a].front(); }
+
+   const vector<RunReader>* pRuns;
+};
+
+// All the postings in order: the ones in memory, already sorted, or else
+// the runs on disk merged.
+class SortedPostings
+{
+public:
+
+   SortedPostings(const vector<IndexEntry>& entries, const vector<FILE*>& runs, size_t mergeEntries)
+   : m_entries(entries), m_pos(0)
+   {
+      if ( runs.empty() )
+         return;
+
+      // the read buffers share the memory of the builder
+      const size_t bufferEntries = max( mergeEntries / runs.size(), static_cast<size_t>(1024) );
+
+      m_runs.reserve(runs.size());
+      for ( size_t r = 0; r < runs.size(); ++r )
+      {
+         m_runs.push_back( RunReader(runs[r], bufferEntries) );
+         if ( !m_runs.back().empty() )
+            m_heap.push_back(r);
+      }
+      make_heap( m_heap.begin(), m_heap.end(), RunGreater(m_runs) );
+   }
+
+   bool next(IndexEntry& entry)
+   {
+      if ( m_runs.empty() )
+      {
+         if ( m_pos == m_entries.size() )
+            return false;
+         entry = m_entries[m_pos++];
+         return true;
+      }
+
+      if ( m_heap.empty() )
+         return false;
+
+      pop_heap( m_heap.begin(), m_heap.end(), RunGreater(m_runs) );
+      RunReader& run = m_runs[m_heap.back()];
+
+      entry = run.front();
+      run.pop();
+
+      if ( run.empty() )
+         m_heap.pop_back();
+      else
+         push_heap( m_heap.begin(), m_heap.end(), RunGreater(m_runs) );
+      return true;
+   }
+
+private:
+
+   const vector<IndexEntry>& m_entries;
+   size_t                    m_pos;
+
+   vector<RunReader>         m_runs;
+   vector<size_t>            m_heap;
+};
+
+// -----------------------------------------------------------------------------
+
+// Sequential writes that throw on failure, and keep track of the position
+// for the page alignment.
+class IndexFileWriter
+{
+public:
+
+   explicit IndexFileWriter(const string& fileName)
+   : m_fileName(fileName), m_pFile(NULL), m_pos(0)
+   {
+      m_pFile = fopen(fileName.c_str(), "wb");
+      if ( !m_pFile )
+         throw std::runtime_error("Cannot create the index file " + fileName + "!");
+   }
+
+   ~IndexFileWriter()
+   {
+      if ( m_pFile )
+         fclose(m_pFile);
+   }
+
+   size_t pos() const { return m_pos; }
+
+   void write(const void* data, size_t size)
+   {
+      if ( size > 0 && fwrite(data, 1, size, m_pFile) != size )
+         throw std::runtime_error("Cannot write the index file " + m_fileName + "!");
+      m_pos += size;
+   }
+
+   void write(const vector<unsigned char>& data)
+   {
+      if ( !data.empty() )
+         write(&data[0], data.size());
+   }
+
+   // zeros up to the next page
+   void padToPage()
+   {
+      static const unsigned char zeros[INDEX_FILE_PAGE_SIZE] = { 0 };
+      write( zeros, (INDEX_FILE_PAGE_SIZE - m_pos % INDEX_FILE_PAGE_SIZE) % INDEX_FILE_PAGE_SIZE );
+   }
+
+   // goes back to the start to write the header, then closes the file
+   void finish(const vector<unsigned char>& header)
+   {
+      if ( fseek(m_pFile, 0, SEEK_SET) != 0 )
+         throw std::runtime_error("Cannot write the index file " + m_fileName + "!");
+      write(header);
+
+      FILE* pFile = m_pFile;
+      m_pFile = NULL;
+      if ( fclose(pFile) != 0 )
+         throw std::runtime_error("Cannot write the index file " + m_fileName + "!");
+   }
+
+private:
+
+   IndexFileWriter(const IndexFileWriter&);
+   IndexFileWriter& operator=(const IndexFileWriter&);
+
+   string m_fileName;
+   FILE*  m_pFile;
+   size_t m_pos;
+};
+
+} // end of anonymous namespace
+
+// -----------------------------------------------------------------------------
+
+namespace fingerprint
+{
+
+using namespace std;
+
+// -----------------------------------------------------------------------------
+
+class IndexBuilderPimplData
+{
+public:
+
+   explicit IndexBuilderPimplData(size_t maxMemory)
+   : m_maxEntries( max(maxMemory / sizeof(IndexEntry), static_cast<size_t>(1)) )
+   {}
+
+   ~IndexBuilderPimplData()
+   {
+      for ( size_t r = 0; r < m_runs.size(); ++r )
+         fclose(m_runs[r]);
+   }
+
+   // sorts the entries in memory and moves them to a new run on disk
+   void spill();
+
+   vector<IndexEntry> m_entries;
+   const size_t       m_maxEntries; // in memory
+   vector<FILE*>      m_runs;       // sorted, on disk (deleted when closed)
+   set<unsigned int>  m_trackIds;
+};
+
+// -----------------------------------------------------------------------------
+
+void IndexBuilderPimplData::spill()
+{
+   sort(m_entries.begin(), m_entries.end());
+
+   FILE* pFile = tmpfile();
+   if ( !pFile )
+      throw std::runtime_error("Cannot create a temporary file for the postings of the index!");
+   m_runs.push_back(pFile);
+
+   if ( !m_entries.empty() &&
+        fwrite(&m_entries[0], sizeof(IndexEntry), m_entries.size(), pFile) != m_entries.size() )
+      throw std::runtime_error("Cannot write the postings of the index to a temporary file!");
+
+   // (the memory is kept for the next run)
+   m_entries.clear();
+}
+
+// -----------------------------------------------------------------------------
+
+FingerprintIndexBuilder::FingerprintIndexBuilder(size_t maxMemory)
+: m_pPimplData(NULL)
+{
+   m_pPimplData = new IndexBuilderPimplData(maxMemory);
+}
+
+// -----------------------------------------------------------------------------
+
+FingerprintIndexBuilder::~FingerprintIndexBuilder()
+{
+   if ( m_pPimplData )
+      delete m_pPimplData;
+}
+
+// -----------------------------------------------------------------------------
+
+void FingerprintIndexBuilder::addTrack(unsigned int trackId, const char* pData, size_t size)
+{
+   IndexBuilderPimplData& pd = *m_pPimplData;
+
+   if ( pd.m_trackIds.count(trackId) )
+      throw std::runtime_error("The track is already in the index!");
+
+   vector<GroupData> groups;
+   parseFingerprint(pData, size, groups);
+
+   pd.m_trackIds.insert(trackId);
+
+   if ( !pd.m_entries.empty() && pd.m_entries.size() + groups.size() > pd.m_maxEntries )
+      pd.spill();
+
+   // grow as push_back would, but not past the limit (unless the track alone is larger)
+   const size_t needed = pd.m_entries.size() + groups.size();
+   if ( needed > pd.m_entries.capacity() )
+      pd.m_entries.reserve( max(min(pd.m_entries.capacity() * 2, pd.m_maxEntries), needed) );
+
+   IndexEntry entry;
+   entry.trackId = trackId;
+   entry.pos = 0;
+   for ( size_t i = 0; i < groups.size(); entry.pos += groups[i].count, ++i )
+   {
+      entry.key = groups[i].key;
+      pd.m_entries.push_back(entry);
+   }
+}
+
+// -----------------------------------------------------------------------------
+
+size_t FingerprintIndexBuilder::getNumTracks() const
+{
+   return m_pPimplData->m_trackIds.size();
+}
+
+// -----------------------------------------------------------------------------
+
+void FingerprintIndexBuilder::write(const string& fileName)
+{
+   IndexBuilderPimplData& pd = *m_pPimplData;
+
+   // all the postings in memory, or all on disk
+   if ( pd.m_runs.empty() )
+      sort(pd.m_entries.begin(), pd.m_entries.end());
+   else if ( !pd.m_entries.empty() )
+      pd.spill();
+
+   IndexFileWriter out(fileName);
+
+   // the header goes in the first page, at the end
+   out.write( vector<unsigned char>(HDR_SIZE) );
+   out.padToPage();
+
+   // postings, one key at a time as they come sorted (this way the keys are
+   // only known at the end, so their sections come after)
+   const size_t postingsPos = out.pos();
+
+   vector<unsigned int> keys;
+   vector<size_t> offsets;
+   size_t numPostings = 0;
+   {
+      SortedPostings postings(pd.m_entries, pd.m_runs, pd.m_maxEntries);
+      vector<IndexEntry> keyEntries;
+      vector<unsigned char> buf;
+
+      IndexEntry e;
+      bool more = postings.next(e);
+      while ( more )
+      {
+         keyEntries.clear();
+         const unsigned int key = e.key;
+         do
+         {
+            keyEntries.push_back(e);
+            more = postings.next(e);
+         }
+         while ( more && e.key == key );
+
+         keys.push_back(key);
+         offsets.push_back(out.pos() - postingsPos);
+
+         buf.clear();
+         writeVarint( buf, static_cast<unsigned int>(keyEntries.size()) );
+
+         unsigned int prevTrack = 0, prevPos = 0;
+         for ( size_t i = 0; i < keyEntries.size(); ++i )
+         {
+            const IndexEntry& ke = keyEntries[i];
+            writeVarint( buf, ke.trackId - prevTrack );
+            writeVarint( buf, ke.trackId == prevTrack ? ke.pos - prevPos : ke.pos );
+            prevTrack = ke.trackId;
+            prevPos = ke.pos;
+         }
+
+         out.write(buf);
+         numPostings += keyEntries.size();
+      }
+   }
+   offsets.push_back(out.pos() - postingsPos);
+
+   vector<unsigned char> header(HDR_SIZE);
+   memcpy( &header[HDR_MAGIC], INDEX_FILE_MAGIC, sizeof(INDEX_FILE_MAGIC) );
+   writeLE32( &header[HDR_VERSION], INDEX_FILE_VERSION );
+   writeLE32( &header[HDR_PAGE_SIZE], static_cast<unsigned int>(INDEX_FILE_PAGE_SIZE) );
+   writeLE32( &header[HDR_NUM_TRACKS], static_cast<unsigned int>(pd.m_trackIds.size()) );
+   writeLE32( &header[HDR_NUM_KEYS], static_cast<unsigned int>(keys.size()) );
+   writeLE64( &header[HDR_NUM_POSTINGS], numPostings );
+   writeLE64( &header[HDR_POSTINGS_POS], postingsPos );
+   writeLE64( &header[HDR_POSTINGS_SIZE], out.pos() - postingsPos );
+   out.padToPage();
+
+   // keys
+   writeLE64( &header[HDR_KEYS_POS], out.pos() );
+   {
+      vector<unsigned char> buf(4);
+      for ( size_t k = 0; k < keys.size(); ++k )
+      {
+         writeLE32( &buf[0], keys[k] );
+         out.write(buf);
+      }
+   }
+   out.padToPage();
+
+   // buckets
+   writeLE64( &header[HDR_BUCKETS_POS], out.pos() );
+   {
+      vector<unsigned char> buckets( (NUM_BUCKETS + 1) * 4 );
+      size_t k = 0;
+      for ( size_t b = 0; b <= NUM_BUCKETS; ++b )
+      {
+         while ( k < keys.size() && (keys[k] >> BUCKET_SHIFT) < b )
+            ++k;
+         writeLE32( &buckets[b * 4], static_cast<unsigned int>(k) );
+      }
+      out.write(buckets);
+   }
+   out.padToPage();
+
+   // offsets
+   writeLE64( &header[HDR_OFFSETS_POS], out.pos() );
+   {
+      vector<unsigned char> buf(8);
+      for ( size_t k = 0; k < offsets.size(); ++k )
+      {
+         writeLE64( &buf[0], offsets[k] );
+         out.write(buf);
+      }
+   }
+
+   out.finish(header);
+}
+
+// -----------------------------------------------------------------------------
+
+class MappedIndexPimplData
+{
+public:
+
+   explicit MappedIndexPimplData(const string& fileName);
+
+   // for queryIndex
+   const Posting* getPostings(unsigned int key, vector<Posting>& scratch, size_t& numPostings) const;
+
+   MappedFile           m_file;
+
+   size_t               m_numTracks;
+   size_t               m_numKeys;
+
+   const unsigned char* m_pBuckets;
+   const unsigned char* m_pKeys;
+   const unsigned char* m_pPostings;
+   size_t               m_postingsSize;
+   const unsigned char* m_pOffsets;
+
+private:
+
+   // the section at pos, checking that it is in the file
+   const unsigned char* section(size_t pos, size_t size) const
+   {
+      if ( pos > m_file.size() || size > m_file.size() - pos )
+         throw std::runtime_error("The index file is truncated!");
+      return m_file.data() + pos;
+   }
+};
+
+// -----------------------------------------------------------------------------
+
+MappedIndexPimplData::MappedIndexPimplData(const string& fileName)
+: m_file(fileName)
+{
+   if ( m_file.size() < HDR_SIZE || memcmp(m_file.data() + HDR_MAGIC, INDEX_FILE_MAGIC, sizeof(INDEX_FILE_MAGIC)) != 0 )
+      throw std::runtime_error(fileName + " is not a fingerprint index file!");
+
+   const unsigned char* pHeader = m_file.data();
+   if ( readLE32(pHeader + HDR_VERSION) != INDEX_FILE_VERSION )
+      throw std::runtime_error("Unknown version of the index file " + fileName + "!");
+
+   m_numTracks = readLE32(pHeader + HDR_NUM_TRACKS);
+   m_numKeys = readLE32(pHeader + HDR_NUM_KEYS);
+
+   // (the sizes can't overflow: a key takes less than 8 bytes of the file)
+   if ( m_numKeys > m_file.size() / 8 )
+      throw std::runtime_error("The index file is truncated!");
+
+   m_pBuckets = section( readLE64(pHeader + HDR_BUCKETS_POS), (NUM_BUCKETS + 1) * 4 );
+   m_pKeys = section( readLE64(pHeader + HDR_KEYS_POS), m_numKeys * 4 );
+   m_postingsSize = readLE64(pHeader + HDR_POSTINGS_SIZE);
+   m_pPostings = section( readLE64(pHeader + HDR_POSTINGS_POS), m_postingsSize );
+   m_pOffsets = section( readLE64(pHeader + HDR_OFFSETS_POS), (m_numKeys + 1) * 8 );
+}
+
+// -----------------------------------------------------------------------------
+
+const Posting* MappedIndexPimplData::getPostings( unsigned int key, vector<Posting>& scratch, 
+                                                  size_t& numPostings ) const
+{
+   numPostings = 0;
+
+   // the bucket, then a binary search in it
+   const size_t b = key >> BUCKET_SHIFT;
+   size_t lo = readLE32(m_pBuckets + b * 4);
+   size_t hi = readLE32(m_pBuckets + b * 4 + 4);
+   if ( lo > hi || hi > m_numKeys )
+      throw std::runtime_error("The key directory of the index file is corrupted!");
+
+   while ( lo < hi )
+   {
+      const size_t mid = lo + (hi - lo) / 2;
+      if ( readLE32(m_pKeys + mid * 4) < key )
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+
+   if ( lo == m_numKeys || readLE32(m_pKeys + lo * 4) != key )
+      return NULL;
+
+   const size_t begin = readLE64(m_pOffsets + lo * 8);
+   const size_t end = readLE64(m_pOffsets + lo * 8 + 8);
+   if ( begin > end || end > m_postingsSize )
+      throw std::runtime_error("The key directory of the index file is corrupted!");
+
+   const unsigned char* p = m_pPostings + begin;
+   const unsigned char* pEnd = m_pPostings + end;
+
+   numPostings = readVarint(p, pEnd);
+   if ( numPostings > MAX_POSTINGS_PER_KEY )
+      return NULL; // skipped by the query anyway: no need to decode them
+
+   // (every posting takes at least two bytes)
+   if ( numPostings > static_cast<size_t>(pEnd - p) / 2 )
+      throw std::runtime_error("The postings of the index file are corrupted!");
+
+   scratch.resize(numPostings);
+
+   unsigned int trackId = 0, pos = 0;
+   for ( size_t i = 0; i < numPostings; ++i )
+   {
+      const unsigned int trackDelta = readVarint(p, pEnd);
+      const unsigned int posDelta = readVarint(p, pEnd);
+
+      trackId += trackDelta;
+      pos = trackDelta == 0 ? pos + posDelta : posDelta;
+
+      scratch[i].trackId = trackId;
+      scratch[i].pos = pos;
+   }
+
+   return numPostings > 0 ? &scratch[0] : NULL;
+}
+
+// -----------------------------------------------------------------------------
+
+MappedFingerprintIndex::MappedFingerprintIndex(const string& fileName)
+: m_pPimplData(NULL)
+{
+   m_pPimplData = new MappedIndexPimplData(fileName);
+}
+
+// -----------------------------------------------------------------------------
+
+MappedFingerprintIndex::~MappedFingerprintIndex()
+{
+   if ( m_pPimplData )
+      delete m_pPimplData;
+}
+
+// -----------------------------------------------------------------------------
+
+size_t MappedFingerprintIndex::getNumTracks() const
+{
+   return m_pPimplData->m_numTracks;
+}
+
+// -----------------------------------------------------------------------------
+
+size_t MappedFingerprintIndex::getNumKeys() const
+{
+   return m_pPimplData->m_numKeys;
+}
+
+// -----------------------------------------------------------------------------
+
+void MappedFingerprintIndex::query( const char* pData, size_t size, vector<IndexMatch>& matches,
+                                    size_t maxResults, unsigned int minVotes ) const
+{
+   queryIndex(*m_pPimplData, pData, size, matches, maxResults, minVotes);
+}
+
+// -----------------------------------------------------------------------------
+
+} // end of namespace fingerprint
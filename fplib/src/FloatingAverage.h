@@ -26,87 +26,104 @@
 #ifndef __FLOAT_AVERAGE_H__
 #define __FLOAT_AVERAGE_H__
 
-//#include <deque>
-#include <limits>
-#include "CircularArray.h"
+#include "RingBuffer.h"
 
 template <typename T>
 class FloatingAverage
 {
 public:
    FloatingAverage(size_t size)
+   : m_values(size), m_size(size), m_pos(0), m_count(0), m_sum(0)
    {
-      m_values.resize(size);
-      m_valIt = m_values.head();
-      m_sum = 0;
-      m_bufferFilled = false;
+      m_values.zero_fill();
    }
 
+   // recompute the sum from scratch, to get rid of the accumulated errors
    void purge()
    {
       m_sum = 0;
-      const T* pCircularBuffer = m_values.get_buffer();
-      const int size = m_values.size();
-
-      for ( int i = 0; i < size; ++i )
-         m_sum += pCircularBuffer[i];
+      for ( size_t i = m_pos - m_count; i != m_pos; ++i )
+         m_sum += m_values[i];
    }
 
    void add(const T& value)
    {
       m_sum += value;
 
-      if ( m_bufferFilled )
+      if ( m_count == m_size )
       {
-         m_sum -= *m_valIt;
-         *m_valIt = value;
-         ++m_valIt;
+         // the value leaving the window is size() positions back
+         m_sum -= m_values[m_pos - m_size];
       }
       else
+         ++m_count;
+
+      m_values[m_pos] = value;
+      ++m_pos;
+   }
+
+   // The same as n times { pAverages[i] = getAverage(); add(pValues[i]); }
+   // Once the buffer is filled, the running sum is updated exactly in the
+   // same order of add(), and all the divisions are left for a second loop,
+   // where they don't wait for each other.
+   void addBlock(const T* pValues, size_t n, T* pAverages)
+   {
+      size_t i = 0;
+      for ( ; i < n && m_count < m_size; ++i )
+      {
+         pAverages[i] = getAverage();
+         add(pValues[i]);
+      }
+
+      const size_t firstFilled = i;
+      for ( ; i < n; ++i )
       {
-         *m_valIt = value;
-         ++m_valIt;
-         if ( m_valIt == m_values.head() )
-            m_bufferFilled = true;
+         pAverages[i] = m_sum;
+         m_sum += pValues[i];
+         m_sum -= m_values[m_pos - m_size];
+         m_values[m_pos] = pValues[i];
+         ++m_pos;
       }
+
+      for ( i = firstFilled; i < n; ++i )
+         pAverages[i] /= m_size;
    }
 
    T getAverage() const
    {
-      if ( !m_bufferFilled )
-         return m_sum / (m_valIt - m_values.head());
-      else
-         return m_sum / m_values.size();
+      if ( m_count == 0 )
+         return 0;
+      return m_sum / m_count;
    }
 
    T getError() const
    {
       T real_sum = 0;
-      const T* pCircularBuffer = m_values.get_buffer();
-      for ( int i = 0; i < size; ++i )
-         real_sum += pCircularBuffer[i];
+      for ( size_t i = m_pos - m_count; i != m_pos; ++i )
+         real_sum += m_values[i];
       return abs(real_sum - m_sum) / this->size();
    }
 
    size_t size() const
    {
-      return m_values.size();
+      return m_size;
    }
 
    void clear()
    {
-      m_bufferFilled = false;
       m_values.zero_fill();
-      m_valIt = m_values.head();
+      m_pos = 0;
+      m_count = 0;
       m_sum = 0;
    }
 
 private:
-   //std::deque<T> m_values;
-   CircularArray<T> m_values;
-   typename CircularArray<T>::iterator m_valIt;
+   // the last size() values are in the positions [m_pos - size(), m_pos)
+   RingBuffer<T> m_values;
+   const size_t  m_size;
+   size_t        m_pos;   // free running, where the next value goes
+   size_t        m_count; // how many values are in, up to size()
 
-   bool m_bufferFilled;
    T m_sum;
 };
 
@@ -0,0 +1,57 @@
+/***************************************************************************
+* This file is part of last.fm fingerprint app                             *
+*  Last.fm Ltd <mir@last.fm>                                               *
+*                                                                          *
+* This library is free software; you can redistribute it and/or            *
+* modify it under the terms of the GNU Lesser General Public               *
+* License as published by the Free Software Foundation; either             *
+* version 2.1 of the License, or (at your option) any later version.       *
+*                                                                          *
+* This library is distributed in the hope that it will be useful,          *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+* Lesser General Public License for more details.                          *
+*                                                                          *
+* You should have received a copy of the GNU Lesser General Public         *
+* License along with this library; if not, write to the Free Software      *
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 *
+* USA                                                                      *
+***************************************************************************/
+
+#ifndef __FRAME_VIEW_H
+#define __FRAME_VIEW_H
+
+#include <cstddef> // for size_t
+
+namespace fingerprint
+{
+
+// -----------------------------------------------------------------------------
+
+// The band energies of the frames: one row of Filter::NBANDS floats per frame.
+// The rows are contiguous and padded to a multiple of a cache line, so
+// walking them is just a strided scan of one aligned block.
+class FrameView
+{
+public:
+
+   FrameView(float* pData, size_t stride)
+   : m_pData(pData), m_stride(stride) {}
+
+   float*
+   operator[](size_t row) const { return m_pData + row * m_stride; }
+
+   size_t
+   stride() const { return m_stride; }
+
+private:
+
+   float* m_pData;
+   size_t m_stride;
+};
+
+// -----------------------------------------------------------------------------
+
+} // end of namespace fingerprint
+
+#endif // __FRAME_VIEW_H
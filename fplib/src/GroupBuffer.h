@@ -0,0 +1,135 @@
+/***************************************************************************
+* This file is part of last.fm fingerprint app                             *
+*  Last.fm Ltd <mir@last.fm>                                               *
+*                                                                          *
+* This library is free software; you can redistribute it and/or            *
+* modify it under the terms of the GNU Lesser General Public               *
+* License as published by the Free Software Foundation; either             *
+* version 2.1 of the License, or (at your option) any later version.       *
+*                                                                          *
+* This library is distributed in the hope that it will be useful,          *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+* Lesser General Public License for more details.                          *
+*                                                                          *
+* You should have received a copy of the GNU Lesser General Public         *
+* License along with this library; if not, write to the Free Software      *
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 *
+* USA                                                                      *
+***************************************************************************/
+
+#ifndef __GROUP_BUFFER_H
+#define __GROUP_BUFFER_H
+
+#include <vector>
+#include <cstddef> // for size_t
+
+namespace fingerprint
+{
+
+// -----------------------------------------------------------------------------
+
+// The groups (run length encoded keys) of the extractor, in one contiguous
+// array: the fingerprint can be handed out as it is, and it can be scanned
+// with plain pointers. The groups dropped from the front only move the
+// beginning forward; the live ones are moved back to the start of the
+// storage when there is more dead space than groups, so the storage stops
+// growing (and allocating) once it fits the window.
+// The total of the counts is kept up to date: change the counts with
+// setCount(), not through the references.
+template <typename TGroupData>
+class GroupBuffer
+{
+public:
+
+   typedef TGroupData        value_type;
+   typedef TGroupData*       iterator;
+   typedef const TGroupData* const_iterator;
+
+   GroupBuffer() : m_begin(0), m_numKeys(0) {}
+
+   size_t size() const { return m_data.size() - m_begin; }
+   bool empty() const { return size() == 0; }
+
+   // the sum of the counts of all the groups
+   size_t numKeys() const { return m_numKeys; }
+
+   // NULL when empty
+   TGroupData* data() { return empty() ? NULL : &m_data[m_begin]; }
+   const TGroupData* data() const { return empty() ? NULL : &m_data[m_begin]; }
+
+   iterator begin() { return data(); }
+   iterator end() { return data() + size(); }
+   const_iterator begin() const { return data(); }
+   const_iterator end() const { return data() + size(); }
+
+   const TGroupData& operator[](size_t i) const { return m_data[m_begin + i]; }
+   const TGroupData& back() const { return m_data.back(); }
+
+   void setCount(size_t i, unsigned int count)
+   {
+      m_numKeys -= m_data[m_begin + i].count;
+      m_numKeys += count;
+      m_data[m_begin + i].count = count;
+   }
+
+   void push_back(const TGroupData& group)
+   {
+      if ( m_begin > 0 && m_begin >= size() )
+         compact();
+
+      m_data.push_back(group);
+      m_numKeys += group.count;
+   }
+
+   void pop_back()
+   {
+      m_numKeys -= m_data.back().count;
+      m_data.pop_back();
+   }
+
+   // drop the first n groups
+   void erase_front(size_t n)
+   {
+      for ( size_t i = 0; i < n; ++i )
+         m_numKeys -= m_data[m_begin + i].count;
+      m_begin += n;
+
+      if ( empty() )
+         clear();
+   }
+
+   // keep only the groups [first, last)
+   void trim(size_t first, size_t last)
+   {
+      while ( size() > last )
+         pop_back();
+      erase_front(first);
+   }
+
+   // keeps the memory
+   void clear()
+   {
+      m_data.clear();
+      m_begin = 0;
+      m_numKeys = 0;
+   }
+
+private:
+
+   void compact()
+   {
+      m_data.erase(m_data.begin(), m_data.begin() + m_begin);
+      m_begin = 0;
+   }
+
+   std::vector<TGroupData> m_data; // the groups start at m_begin
+   size_t                  m_begin;
+   size_t                  m_numKeys;
+};
+
+// -----------------------------------------------------------------------------
+
+} // end of namespace fingerprint
+
+#endif // __GROUP_BUFFER_H
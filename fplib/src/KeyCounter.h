@@ -0,0 +1,67 @@
+/***************************************************************************
+* This file is part of last.fm fingerprint app                             *
+*  Last.fm Ltd <mir@last.fm>                                               *
+*                                                                          *
+* This library is free software; you can redistribute it and/or            *
+* modify it under the terms of the GNU Lesser General Public               *
+* License as published by the Free Software Foundation; either             *
+* version 2.1 of the License, or (at your option) any later version.       *
+*                                                                          *
+* This library is distributed in the hope that it will be useful,          *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+* Lesser General Public License for more details.                          *
+*                                                                          *
+* You should have received a copy of the GNU Lesser General Public         *
+* License along with this library; if not, write to the Free Software      *
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 *
+* USA                                                                      *
+***************************************************************************/
+
+#ifndef __KEY_COUNTER_H
+#define __KEY_COUNTER_H
+
+#include <cstddef> // for size_t
+
+#include "OpenHashTable.h"
+
+namespace fingerprint
+{
+
+// -----------------------------------------------------------------------------
+
+// How many times each key is in a window, and how many different keys there
+// are, with add() and remove() in O(1), however long the window slides.
+class KeyCounter
+{
+public:
+
+   KeyCounter() : m_counts(0) {}
+
+   // number of different keys
+   size_t size() const { return m_counts.size(); }
+
+   void clear() { m_counts.clear(); }
+
+   void add(unsigned int key) { ++m_counts.insert(key); }
+
+   // the key must have been added
+   void remove(unsigned int key)
+   {
+      unsigned int& count = *m_counts.find(key);
+      if ( count > 1 )
+         --count;
+      else
+         m_counts.erase(key);
+   }
+
+private:
+
+   OpenHashTable<unsigned int, unsigned int> m_counts; // no count is 0
+};
+
+// -----------------------------------------------------------------------------
+
+} // end of namespace fingerprint
+
+#endif // __KEY_COUNTER_H
@@ -0,0 +1,50 @@
+/***************************************************************************
+* This file is part of last.fm fingerprint app                             *
+*  Last.fm Ltd <mir@last.fm>                                               *
+*                                                                          *
+* This library is free software; you can redistribute it and/or            *
+* modify it under the terms of the GNU Lesser General Public               *
+* License as published by the Free Software Foundation; either             *
+* version 2.1 of the License, or (at your option) any later version.       *
+*                                                                          *
+* This library is distributed in the hope that it will be useful,          *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+* Lesser General Public License for more details.                          *
+*                                                                          *
+* You should have received a copy of the GNU Lesser General Public         *
+* License along with this library; if not, write to the Free Software      *
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 *
+* USA                                                                      *
+***************************************************************************/
+
+#ifndef __LITTLE_ENDIAN_H
+#define __LITTLE_ENDIAN_H
+
+// The 32 bits little endian words of the fingerprints and of the files made
+// of them, whatever the byte order of the machine.
+
+namespace fingerprint
+{
+
+// -----------------------------------------------------------------------------
+
+inline unsigned int readLE32(const unsigned char* p)
+{
+   return static_cast<unsigned int>(p[0]) | (static_cast<unsigned int>(p[1]) << 8) |
+          (static_cast<unsigned int>(p[2]) << 16) | (static_cast<unsigned int>(p[3]) << 24);
+}
+
+inline void writeLE32(unsigned char* p, unsigned int value)
+{
+   p[0] = static_cast<unsigned char>(value);
+   p[1] = static_cast<unsigned char>(value >> 8);
+   p[2] = static_cast<unsigned char>(value >> 16);
+   p[3] = static_cast<unsigned char>(value >> 24);
+}
+
+// -----------------------------------------------------------------------------
+
+} // end of namespace fingerprint
+
+#endif // __LITTLE_ENDIAN_H
@@ -0,0 +1,184 @@
+/***************************************************************************
+* This file is part of last.fm fingerprint app                             *
+*  Last.fm Ltd <mir@last.fm>                                               *
+*                                                                          *
+* This library is free software; you can redistribute it and/or            *
+* modify it under the terms of the GNU Lesser General Public               *
+* License as published by the Free Software Foundation; either             *
+* version 2.1 of the License, or (at your option) any later version.       *
+*                                                                          *
+* This library is distributed in the hope that it will be useful,          *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+* Lesser General Public License for more details.                          *
+*                                                                          *
+* You should have received a copy of the GNU Lesser General Public         *
+* License along with this library; if not, write to the Free Software      *
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 *
+* USA                                                                      *
+***************************************************************************/
+
+#ifndef __MAPPED_FILE_H
+#define __MAPPED_FILE_H
+
+// A read only file mapped in memory (mmap or win32 file mapping), just what
+// MappedFingerprintIndex needs.
+
+#include <string>
+#include <stdexcept>
+#include <cstddef> // for size_t
+
+#ifdef WIN32
+#ifndef NOMINMAX
+#define NOMINMAX // keep std::min/max usable
+#endif
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace fingerprint
+{
+
+// -----------------------------------------------------------------------------
+
+class MappedFile
+{
+public:
+
+   // throws if the file can't be opened or mapped
+   explicit MappedFile(const std::string& fileName);
+   ~MappedFile();
+
+   const unsigned char* data() const { return m_pData; }
+   size_t size() const { return m_size; }
+
+private:
+
+   MappedFile(const MappedFile&);
+   MappedFile& operator=(const MappedFile&);
+
+   void close();
+
+   const unsigned char* m_pData; // NULL for an empty file
+   size_t               m_size;
+
+#ifdef WIN32
+   HANDLE m_hFile;
+   HANDLE m_hMapping;
+#else
+   int    m_fd;
+#endif
+};
+
+// -----------------------------------------------------------------------------
+
+#ifdef WIN32
+
+inline MappedFile::MappedFile(const std::string& fileName)
+: m_pData(NULL), m_size(0), m_hFile(INVALID_HANDLE_VALUE), m_hMapping(NULL)
+{
+   m_hFile = CreateFileA( fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, 
+                          OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL );
+   if ( m_hFile == INVALID_HANDLE_VALUE )
+      throw std::runtime_error("Cannot open the file " + fileName + "!");
+
+   LARGE_INTEGER fileSize;
+   if ( !GetFileSizeEx(m_hFile, &fileSize) || 
+        static_cast<ULONGLONG>(static_cast<size_t>(fileSize.QuadPart)) != static_cast<ULONGLONG>(fileSize.QuadPart) )
+   {
+      close();
+      throw std::runtime_error("Cannot map the file " + fileName + ": too large!");
+   }
+
+   m_size = static_cast<size_t>(fileSize.QuadPart);
+   if ( m_size == 0 )
+      return; // nothing to map
+
+   m_hMapping = CreateFileMapping(m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+   if ( m_hMapping )
+      m_pData = static_cast<const unsigned char*>( MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0) );
+
+   if ( !m_pData )
+   {
+      close();
+      throw std::runtime_error("Cannot map the file " + fileName + "!");
+   }
+}
+
+inline void MappedFile::close()
+{
+   if ( m_pData )
+      UnmapViewOfFile(m_pData);
+   if ( m_hMapping )
+      CloseHandle(m_hMapping);
+   if ( m_hFile != INVALID_HANDLE_VALUE )
+      CloseHandle(m_hFile);
+
+   m_pData = NULL;
+   m_hMapping = NULL;
+   m_hFile = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+inline MappedFile::MappedFile(const std::string& fileName)
+: m_pData(NULL), m_size(0), m_fd(-1)
+{
+   m_fd = open(fileName.c_str(), O_RDONLY);
+   if ( m_fd < 0 )
+      throw std::runtime_error("Cannot open the file " + fileName + "!");
+
+   struct stat st;
+   if ( fstat(m_fd, &st) != 0 || static_cast<off_t>(static_cast<size_t>(st.st_size)) != st.st_size )
+   {
+      close();
+      throw std::runtime_error("Cannot map the file " + fileName + ": too large!");
+   }
+
+   m_size = static_cast<size_t>(st.st_size);
+   if ( m_size == 0 )
+      return; // mmap doesn't take empty files
+
+   void* p = mmap(NULL, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+   if ( p == MAP_FAILED )
+   {
+      close();
+      throw std::runtime_error("Cannot map the file " + fileName + "!");
+   }
+
+   m_pData = static_cast<const unsigned char*>(p);
+
+#ifdef MADV_RANDOM
+   // the lookups jump all over the file: no point in reading ahead
+   madvise(p, m_size, MADV_RANDOM);
+#endif
+}
+
+inline void MappedFile::close()
+{
+   if ( m_pData )
+      munmap( const_cast<unsigned char*>(m_pData), m_size );
+   if ( m_fd >= 0 )
+      ::close(m_fd);
+
+   m_pData = NULL;
+   m_fd = -1;
+}
+
+#endif
+
+inline MappedFile::~MappedFile()
+{
+   close();
+}
+
+// -----------------------------------------------------------------------------
+
+} // end of namespace fingerprint
+
+#endif // __MAPPED_FILE_H
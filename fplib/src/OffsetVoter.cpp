@@ -0,0 +1,148 @@
+/***************************************************************************
+* This file is part of last.fm fingerprint app                             *
+*  Last.fm Ltd <mir@last.fm>                                               *
+*                                                                          *
+* This library is free software; you can redistribute it and/or            *
+* modify it under the terms of the GNU Lesser General Public               *
+* License as published by the Free Software Foundation; either             *
+* version 2.1 of the License, or (at your option) any later version.       *
+*                                                                          *
+* This library is distributed in the hope that it will be useful,          *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+* Lesser General Public License for more details.                          *
+*                                                                          *
+* You should have received a copy of the GNU Lesser General Public         *
+* License along with this library; if not, write to the Free Software      *
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 *
+* USA                                                                      *
+***************************************************************************/
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "OffsetVoter.h"
+#include "LittleEndian.h"
+
+// -----------------------------------------------------------------------------
+
+namespace
+{
+
+using namespace fingerprint;
+
+inline int binOf(int offset)
+{
+   // rounding down, for the negative offsets too
+   return offset >= 0 ? offset / OFFSET_BIN_KEYS : -((-offset + OFFSET_BIN_KEYS - 1) / OFFSET_BIN_KEYS);
+}
+
+// the best of every track first
+bool byTrackThenVotes(const IndexMatch& a, const IndexMatch& b)
+{
+   if ( a.trackId != b.trackId )
+      return a.trackId < b.trackId;
+   if ( a.votes != b.votes )
+      return a.votes > b.votes;
+   return a.offset < b.offset;
+}
+
+bool byVotes(const IndexMatch& a, const IndexMatch& b)
+{
+   if ( a.votes != b.votes )
+      return a.votes > b.votes;
+   return a.trackId < b.trackId;
+}
+
+bool sameTrack(const IndexMatch& a, const IndexMatch& b)
+{
+   return a.trackId == b.trackId;
+}
+
+} // end of anonymous namespace
+
+// -----------------------------------------------------------------------------
+
+namespace fingerprint
+{
+
+using namespace std;
+
+// -----------------------------------------------------------------------------
+
+void parseFingerprint(const char* pData, size_t size, vector<GroupData>& groups)
+{
+   if ( size % sizeof(GroupData) != 0 )
+      throw std::runtime_error("The size of a fingerprint must be a multiple of 8!");
+
+   const unsigned char* p = reinterpret_cast<const unsigned char*>(pData);
+
+   groups.resize(size / sizeof(GroupData));
+   for ( size_t i = 0; i < groups.size(); ++i, p += sizeof(GroupData) )
+   {
+      groups[i].key = readLE32(p);
+      groups[i].count = readLE32(p + 4);
+   }
+}
+
+// -----------------------------------------------------------------------------
+
+OffsetVoter::OffsetVoter()
+: m_votes(0, 1024)
+{
+}
+
+// -----------------------------------------------------------------------------
+
+void OffsetVoter::vote(unsigned int trackId, int offset)
+{
+   TrackBin trackBin;
+   trackBin.trackId = trackId;
+   trackBin.bin = binOf(offset);
+
+   ++m_votes.insert(trackBin);
+}
+
+// -----------------------------------------------------------------------------
+
+void OffsetVoter::getMatches( vector<IndexMatch>& matches, 
+                              size_t maxResults, unsigned int minVotes ) const
+{
+   matches.clear();
+
+   for ( size_t i = 0; i < m_votes.getNumSlots(); ++i )
+   {
+      if ( !m_votes.isUsed(i) )
+         continue;
+
+      // over this bin and the next one
+      const TrackBin& trackBin = m_votes.getKey(i);
+      TrackBin next = trackBin;
+      ++next.bin;
+      const unsigned int* pNextVotes = m_votes.find(next);
+      const unsigned int nextVotes = pNextVotes ? *pNextVotes : 0;
+      const unsigned int votes = m_votes.getValue(i) + nextVotes;
+      if ( votes < minVotes )
+         continue;
+
+      // the middle of the votes
+      IndexMatch match;
+      match.trackId = trackBin.trackId;
+      match.votes = votes;
+      match.offset = trackBin.bin * OFFSET_BIN_KEYS + OFFSET_BIN_KEYS / 2 + 
+                     static_cast<int>( (nextVotes * OFFSET_BIN_KEYS) / votes );
+      matches.push_back(match);
+   }
+
+   // one per track, the best ones
+   sort(matches.begin(), matches.end(), byTrackThenVotes);
+   matches.erase( unique(matches.begin(), matches.end(), sameTrack), matches.end() );
+
+   const size_t numResults = min(maxResults, matches.size());
+   partial_sort(matches.begin(), matches.begin() + numResults, matches.end(), byVotes);
+   matches.resize(numResults);
+}
+
+// -----------------------------------------------------------------------------
+
+} // end of namespace fingerprint
@@ -0,0 +1,132 @@
+/***************************************************************************
+* This file is part of last.fm fingerprint app                             *
+*  Last.fm Ltd <mir@last.fm>                                               *
+*                                                                          *
+* This library is free software; you can redistribute it and/or            *
+* modify it under the terms of the GNU Lesser General Public               *
+* License as published by the Free Software Foundation; either             *
+* version 2.1 of the License, or (at your option) any later version.       *
+*                                                                          *
+* This library is distributed in the hope that it will be useful,          *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+* Lesser General Public License for more details.                          *
+*                                                                          *
+* You should have received a copy of the GNU Lesser General Public         *
+* License along with this library; if not, write to the Free Software      *
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 *
+* USA                                                                      *
+***************************************************************************/
+
+#ifndef __OFFSET_VOTER_H
+#define __OFFSET_VOTER_H
+
+#include <vector>
+#include <cstddef> // for size_t
+
+#include "../include/FingerprintIndex.h" // for IndexMatch
+#include "fp_helper_fun.h" // for GroupData
+#include "OpenHashTable.h"
+
+namespace fingerprint
+{
+
+// -----------------------------------------------------------------------------
+
+// A group of keys of an indexed track, listed under its key
+struct Posting
+{
+   unsigned int trackId;
+   unsigned int pos;     // the first key of the group, from the start of the track
+};
+
+// Keys listed under more postings than this are too common to tell the
+// tracks apart (silence, noise): the queries skip them.
+static const size_t MAX_POSTINGS_PER_KEY = 4096;
+
+// The group boundaries move a little with the alignment of the audio, so
+// the offsets are voted in bins of this many keys (~93 ms), and a match is
+// scored over two neighbour bins.
+static const int OFFSET_BIN_KEYS = 8;
+
+// The groups of a fingerprint as returned by getFingerprint() (little
+// endian). Throws if size is not a multiple of 8.
+void parseFingerprint(const char* pData, size_t size, std::vector<GroupData>& groups);
+
+// -----------------------------------------------------------------------------
+
+// The histogram of the (track, offset) pairs of a query: a hash table, as
+// most of the pairs only get one vote.
+class OffsetVoter
+{
+public:
+
+   OffsetVoter();
+
+   // offset is the position in the track minus the one in the query
+   void vote(unsigned int trackId, int offset);
+
+   // the best offset of every track, the best tracks first
+   void getMatches( std::vector<IndexMatch>& matches, 
+                    size_t maxResults, unsigned int minVotes ) const;
+
+private:
+
+   // a bin of the offsets of a track
+   struct TrackBin
+   {
+      unsigned int trackId;
+      int          bin;
+
+      bool operator==(const TrackBin& other) const
+      { return trackId == other.trackId && bin == other.bin; }
+   };
+
+   // the two mixed together
+   struct TrackBinHash
+   {
+      unsigned int operator()(const TrackBin& trackBin) const
+      { return (trackBin.trackId * 0x9E3779B1u) ^ static_cast<unsigned int>(trackBin.bin); }
+   };
+
+   OpenHashTable<TrackBin, unsigned int, TrackBinHash> m_votes; // no votes is 0
+};
+
+// -----------------------------------------------------------------------------
+
+// The query of the indexes, whatever they keep their postings in. TIndex provides
+//
+//   const Posting* getPostings(unsigned int key, std::vector<Posting>& scratch, size_t& numPostings) const
+//
+// which either points into the index or decodes the postings into scratch.
+// Past MAX_POSTINGS_PER_KEY, only numPostings is needed.
+template <typename TIndex>
+void queryIndex( const TIndex& index, const char* pData, size_t size, 
+                 std::vector<IndexMatch>& matches, size_t maxResults, unsigned int minVotes )
+{
+   std::vector<GroupData> groups;
+   parseFingerprint(pData, size, groups);
+
+   std::vector<Posting> scratch;
+   OffsetVoter voter;
+
+   unsigned int pos = 0;
+   for ( size_t i = 0; i < groups.size(); pos += groups[i].count, ++i )
+   {
+      size_t numPostings = 0;
+      const Posting* pPostings = index.getPostings(groups[i].key, scratch, numPostings);
+      if ( numPostings > MAX_POSTINGS_PER_KEY )
+         continue;
+
+      for ( size_t j = 0; j < numPostings; ++j )
+         voter.vote( pPostings[j].trackId, static_cast<int>(pPostings[j].pos) - static_cast<int>(pos) );
+   }
+
+   voter.getMatches(matches, maxResults, minVotes);
+}
+
+// -----------------------------------------------------------------------------
+
+} // end of namespace fingerprint
+
+#endif // __OFFSET_VOTER_H
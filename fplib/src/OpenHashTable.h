@@ -0,0 +1,186 @@
+/***************************************************************************
+* This file is part of last.fm fingerprint app                             *
+*  Last.fm Ltd <mir@last.fm>                                               *
+*                                                                          *
+* This library is free software; you can redistribute it and/or            *
+* modify it under the terms of the GNU Lesser General Public               *
+* License as published by the Free Software Foundation; either             *
+* version 2.1 of the License, or (at your option) any later version.       *
+*                                                                          *
+* This library is distributed in the hope that it will be useful,          *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+* Lesser General Public License for more details.                          *
+*                                                                          *
+* You should have received a copy of the GNU Lesser General Public         *
+* License along with this library; if not, write to the Free Software      *
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 *
+* USA                                                                      *
+***************************************************************************/
+
+#ifndef __OPEN_HASH_TABLE_H
+#define __OPEN_HASH_TABLE_H
+
+#include <vector>
+#include <cstddef> // for size_t
+
+namespace fingerprint
+{
+
+// -----------------------------------------------------------------------------
+
+// The hash of the keys of the fingerprints: they are themselves the hash.
+struct KeyHash
+{
+   unsigned int operator()(unsigned int key) const { return key; }
+};
+
+// -----------------------------------------------------------------------------
+
+// A map with open addressing and linear probing, for the small values
+// counted or looked up per key or per frame. The free slots are the ones
+// holding emptyValue, which no entry may hold.
+//
+// THash gives 32 bits out of a key, and the top bits of their Fibonacci
+// hashing (the product) pick the slot: the keys of the fingerprints are bits
+// of the spectrum, so the low bits alone are far from random. Erasing
+// shifts the following entries back instead of leaving tombstones, so the
+// table never needs cleaning however many entries come and go.
+template <typename TKey, typename TValue, typename THash = KeyHash>
+class OpenHashTable
+{
+public:
+
+   // capacity must be a power of two
+   explicit OpenHashTable(const TValue& emptyValue, size_t capacity = 64)
+   : m_mask(0), m_shift(0), m_size(0)
+   {
+      m_emptySlot.key = TKey();
+      m_emptySlot.value = emptyValue;
+      rehash(capacity);
+   }
+
+   // number of entries
+   size_t size() const { return m_size; }
+
+   void clear()
+   {
+      m_slots.assign(m_slots.size(), m_emptySlot);
+      m_size = 0;
+   }
+
+   // the value of key, or NULL
+   TValue* find(const TKey& key)
+   {
+      Slot& slot = m_slots[findSlot(key)];
+      return isUsed(slot) ? &slot.value : NULL;
+   }
+
+   const TValue* find(const TKey& key) const
+   {
+      const Slot& slot = m_slots[findSlot(key)];
+      return isUsed(slot) ? &slot.value : NULL;
+   }
+
+   // The value of key. A new one starts as emptyValue: the caller must
+   // set it to something else.
+   TValue& insert(const TKey& key)
+   {
+      size_t i = findSlot(key);
+      if ( !isUsed(m_slots[i]) )
+      {
+         // at most half full, so that the runs stay short
+         if ( 2 * (m_size + 1) > m_slots.size() )
+         {
+            rehash(2 * m_slots.size());
+            i = findSlot(key);
+         }
+
+         m_slots[i].key = key;
+         ++m_size;
+      }
+
+      return m_slots[i].value;
+   }
+
+   // the key must be there
+   void erase(const TKey& key)
+   {
+      size_t i = findSlot(key);
+      --m_size;
+
+      // close the hole: move back any entry of the run that can't be
+      // reached from its home slot anymore
+      for ( size_t j = (i + 1) & m_mask; isUsed(m_slots[j]); j = (j + 1) & m_mask )
+      {
+         const size_t home = hash(m_slots[j].key);
+         // is home cyclically in (i, j]? then the entry stays
+         const bool stays = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+         if ( !stays )
+         {
+            m_slots[i] = m_slots[j];
+            i = j;
+         }
+      }
+
+      m_slots[i] = m_emptySlot;
+   }
+
+   // all the entries, in no order: the slots i < getNumSlots() that isUsed(i)
+   size_t getNumSlots() const { return m_slots.size(); }
+   bool isUsed(size_t i) const { return isUsed(m_slots[i]); }
+   const TKey& getKey(size_t i) const { return m_slots[i].key; }
+   const TValue& getValue(size_t i) const { return m_slots[i].value; }
+
+private:
+
+   struct Slot
+   {
+      TKey   key;
+      TValue value;
+   };
+
+   bool isUsed(const Slot& slot) const
+   { return !(slot.value == m_emptySlot.value); }
+
+   size_t hash(const TKey& key) const
+   { return static_cast<size_t>( (THash()(key) * 2654435769u) >> m_shift ); }
+
+   // the slot of key, or the free one where it would go
+   size_t findSlot(const TKey& key) const
+   {
+      size_t i = hash(key);
+      while ( isUsed(m_slots[i]) && !(m_slots[i].key == key) )
+         i = (i + 1) & m_mask;
+      return i;
+   }
+
+   void rehash(size_t capacity)
+   {
+      std::vector<Slot> old;
+      old.swap(m_slots);
+
+      m_slots.assign(capacity, m_emptySlot);
+      m_mask = capacity - 1;
+      for ( m_shift = 32; capacity > 1; capacity >>= 1 )
+         --m_shift;
+
+      for ( size_t i = 0; i < old.size(); ++i )
+      {
+         if ( isUsed(old[i]) )
+            m_slots[findSlot(old[i].key)] = old[i];
+      }
+   }
+
+   std::vector<Slot> m_slots; // the size is a power of two
+   Slot              m_emptySlot;
+   size_t            m_mask;
+   unsigned int      m_shift;   // 32 - log2 of the size
+   size_t            m_size;
+};
+
+// -----------------------------------------------------------------------------
+
+} // end of namespace fingerprint
+
+#endif // __OPEN_HASH_TABLE_H
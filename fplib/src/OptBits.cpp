@@ -0,0 +1,283 @@
+/***************************************************************************
+* This file is part of last.fm fingerprint app                             *
+*  Last.fm Ltd <mir@last.fm>                                               *
+*                                                                          *
+* This library is free software; you can redistribute it and/or            *
+* modify it under the terms of the GNU Lesser General Public               *
+* License as published by the Free Software Foundation; either             *
+* version 2.1 of the License, or (at your option) any later version.       *
+*                                                                          *
+* This library is distributed in the hope that it will be useful,          *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+* Lesser General Public License for more details.                          *
+*                                                                          *
+* You should have received a copy of the GNU Lesser General Public         *
+* License along with this library; if not, write to the Free Software      *
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 *
+* USA                                                                      *
+*                                                                          *
+* Part of this code is based on the work of Y. Ke, D. Hoiem, and           *
+* R. Sukthankar - "Computer Vision for Music Identification",              *
+* in Proceedings of Computer Vision and Pattern Recognition, 2005.         *
+* See also http://www.cs.cmu.edu/~yke/musicretrieval/                      *
+***************************************************************************/
+
+#include <stdexcept>
+
+#include "OptBits.h"
+#include "fp_helper_fun.h" // for round__
+
+#ifdef FP_SSE2_KERNEL
+#include <emmintrin.h> // SSE2
+#endif
+#if defined(FP_X86_KERNELS) && defined(_MSC_VER)
+#include <intrin.h> // __cpuid, _xgetbv
+#endif
+
+// -----------------------------------------------------------------------------
+
+namespace
+{
+
+struct ScalarVec
+{
+   enum { WIDTH = 1 };
+
+   ScalarVec(double x) : v(x) {}
+
+   static ScalarVec load(const double* p) { return ScalarVec(*p); }
+   static unsigned int greater(const ScalarVec& a, const ScalarVec& b) { return a.v > b.v; }
+
+   double v;
+};
+
+inline ScalarVec operator+(const ScalarVec& a, const ScalarVec& b) { return ScalarVec(a.v + b.v); }
+inline ScalarVec operator*(const ScalarVec& a, const ScalarVec& b) { return ScalarVec(a.v * b.v); }
+
+// -----------------------------------------------------------------------------
+
+#ifdef FP_SSE2_KERNEL
+
+// no special flags needed for this one: the build already assumes SSE2
+struct SSE2Vec
+{
+   enum { WIDTH = 2 };
+
+   SSE2Vec(double x) : v(_mm_set1_pd(x)) {}
+   SSE2Vec(__m128d x) : v(x) {}
+
+   static SSE2Vec load(const double* p) { return SSE2Vec(_mm_loadu_pd(p)); }
+   static unsigned int greater(const SSE2Vec& a, const SSE2Vec& b)
+   { return static_cast<unsigned int>( _mm_movemask_pd(_mm_cmpgt_pd(a.v, b.v)) ); }
+
+   __m128d v;
+};
+
+inline SSE2Vec operator+(const SSE2Vec& a, const SSE2Vec& b) { return SSE2Vec(_mm_add_pd(a.v, b.v)); }
+inline SSE2Vec operator*(const SSE2Vec& a, const SSE2Vec& b) { return SSE2Vec(_mm_mul_pd(a.v, b.v)); }
+
+#endif // FP_SSE2_KERNEL
+
+// -----------------------------------------------------------------------------
+
+#ifdef FP_X86_KERNELS
+
+bool cpuHasAVX()
+{
+#if defined(_MSC_VER)
+   int info[4];
+   __cpuid(info, 1);
+   const bool osxsave = (info[2] & (1 << 27)) != 0;
+   const bool avx     = (info[2] & (1 << 28)) != 0;
+   // the OS must also save the ymm registers on context switch
+   return osxsave && avx && (_xgetbv(0) & 6) == 6;
+#elif defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 8)))
+   __builtin_cpu_init();
+   return __builtin_cpu_supports("avx") != 0;
+#else
+   return false;
+#endif
+}
+
+#endif // FP_X86_KERNELS
+
+// -----------------------------------------------------------------------------
+
+void addTap(fingerprint::BitFilter& bf, int row, int col, double weight)
+{
+   bf.offset[bf.numTaps] = col + row;
+   bf.weight[bf.numTaps] = weight;
+   ++bf.numTaps;
+}
+
+} // end of anonymous namespace
+
+// -----------------------------------------------------------------------------
+
+namespace fingerprint
+{
+
+using namespace std;
+
+// -----------------------------------------------------------------------------
+
+void computeBitsScalar( const double* pColumns,
+                        const BitFilter* pFilters, unsigned int numFilters,
+                        unsigned int firstTime, unsigned int numBits,
+                        unsigned int* pBits )
+{
+   computeBitsKernel<ScalarVec>(pColumns, pFilters, numFilters, firstTime, numBits, pBits);
+}
+
+#ifdef FP_SSE2_KERNEL
+void computeBitsSSE2( const double* pColumns,
+                      const BitFilter* pFilters, unsigned int numFilters,
+                      unsigned int firstTime, unsigned int numBits,
+                      unsigned int* pBits )
+{
+   computeBitsKernel<SSE2Vec>(pColumns, pFilters, numFilters, firstTime, numBits, pBits);
+}
+#endif
+
+// -----------------------------------------------------------------------------
+
+OptBits::OptBits(const vector<Filter>& filters, unsigned int maxFrames)
+: m_stride(maxFrames), m_kernel(computeBitsScalar), m_width(1)
+{
+   if ( filters.size() > 32 )
+      throw std::runtime_error("Too many filters for a 32 bits key!");
+
+   m_columns.resize(m_stride * Filter::NBANDS);
+
+   // The corners only depend on the distance from t2, so they are computed
+   // once here, with exactly the formulas of the original per frame version.
+   const unsigned int t2 = Filter::KEYWIDTH / 2 + 1;
+   const int st = static_cast<int>(m_stride);
+
+   m_filters.resize(filters.size());
+   for (size_t i = 0; i < filters.size(); ++i)
+   {
+      const Filter& f = filters[i];
+      BitFilter& bf = m_filters[i];
+
+      // we subtract 1 from t1 and b1 because we use integral images
+      unsigned int t1 = (unsigned int) ((float) t2 - f.wt / 2.0 - 1);
+      unsigned int t3 = (unsigned int) ((float) t2 + f.wt / 2.0 - 1);
+      unsigned int b1 = f.first_band;
+      unsigned int b2 = (unsigned int) round__((float) b1 + f.wb / 2.0) - 1;
+      unsigned int b3 = b1 + f.wb - 1;
+      --b1;
+
+      unsigned int t_1q = (t1 + t2) / 2; // one quarter time
+      unsigned int t_3q = t_1q + (t3 - t1 + 1) / 2; // three quarter time
+      unsigned int b_1q = (b1 + b2) / 2; // one quarter band
+      unsigned int b_3q = b_1q + (b3 - b1) / 2; // three quarter band
+
+      const int r1  = static_cast<int>(t1) - 1 - static_cast<int>(t2);
+      const int r2  = -2;
+      const int r3  = static_cast<int>(t3) - 1 - static_cast<int>(t2);
+      const int r1q = static_cast<int>(t_1q) - 1 - static_cast<int>(t2);
+      const int r3q = static_cast<int>(t_3q) - 1 - static_cast<int>(t2);
+
+      // (c1 is only used when b1 > 0)
+      const int c1  = (static_cast<int>(b1) - 1) * st;
+      const int c2  = (static_cast<int>(b2) - 1) * st;
+      const int c3  = (static_cast<int>(b3) - 1) * st;
+      const int c1q = (static_cast<int>(b_1q) - 1) * st;
+      const int c3q = (static_cast<int>(b_3q) - 1) * st;
+
+      bf.numTaps = 0;
+      bf.threshold = f.threshold;
+
+      // the terms of the original expressions, in the same order
+      switch (f.filter_type) {
+      case 1: { // total energy
+         addTap(bf, r3, c3, 1);
+         if (b1 > 0) { addTap(bf, r3, c1, -1); }
+         addTap(bf, r1, c3, -1);
+         if (b1 > 0) { addTap(bf, r1, c1, 1); }
+         break;
+      }
+      case 2: { // energy difference over time
+         if (b1 > 0) { addTap(bf, r1, c1, 1); addTap(bf, r2, c1, -2); addTap(bf, r3, c1, 1); }
+         addTap(bf, r1, c3, -1); addTap(bf, r2, c3, 2); addTap(bf, r3, c3, -1);
+         break;
+      }
+      case 3: { // energy difference over bands
+         if (b1 > 0) { addTap(bf, r1, c1, 1); addTap(bf, r3, c1, -1); }
+         addTap(bf, r1, c2, -2); addTap(bf, r3, c2, 2);
+         addTap(bf, r1, c3, 1);  addTap(bf, r3, c3, -1);
+         break;
+      }
+      case 4: { // energy difference over time and bands
+         if (b1 > 0) { addTap(bf, r1, c1, 1); addTap(bf, r2, c1, -2); addTap(bf, r3, c1, 1); }
+         addTap(bf, r1, c2, -2); addTap(bf, r2, c2, 4);  addTap(bf, r3, c2, -2);
+         addTap(bf, r1, c3, 1);  addTap(bf, r2, c3, -2); addTap(bf, r3, c3, 1);
+         break;
+      }
+      case 5: { // time peak
+         if (b1 > 0) { addTap(bf, r1, c1, -1); addTap(bf, r1q, c1, 2); addTap(bf, r3q, c1, -2); addTap(bf, r3, c1, 1); }
+         addTap(bf, r1, c3, 1); addTap(bf, r1q, c3, -2); addTap(bf, r3q, c3, 2); addTap(bf, r3, c3, -1);
+         break;
+      }
+      case 6: { // band beak
+         if (b1 > 0) { addTap(bf, r1, c1, -1); addTap(bf, r3, c1, 1); }
+         addTap(bf, r1, c1q, 2);  addTap(bf, r3, c1q, -2);
+         addTap(bf, r1, c3q, -2); addTap(bf, r3, c3q, 2);
+         addTap(bf, r1, c3, 1);   addTap(bf, r3, c3, -1);
+         break;
+      }
+      default:
+         throw std::runtime_error("Unknown filter type!");
+      }
+   }
+
+#ifdef FP_X86_KERNELS
+   if ( cpuHasAVX() )
+   {
+      m_kernel = computeBitsAVX;
+      m_width = 4;
+   }
+#ifdef FP_SSE2_KERNEL
+   else
+   {
+      m_kernel = computeBitsSSE2;
+      m_width = 2;
+   }
+#endif
+#endif
+}
+
+// -----------------------------------------------------------------------------
+
+void OptBits::process(vector<unsigned int>& bits, const FrameView& frames, unsigned int nFrames)
+{
+   if ( nFrames > m_stride )
+      throw std::runtime_error("Too many frames for OptBits!");
+
+   unsigned int first_time = Filter::KEYWIDTH / 2 + 1;
+   unsigned int last_time = nFrames - Filter::KEYWIDTH / 2;
+
+   unsigned int numBits = last_time - first_time + 1;
+   bits.resize(numBits);
+
+   // transpose, so that the kernel can load consecutive frames at once
+   for (unsigned int y = 0; y < nFrames; ++y)
+   {
+      const float* pFrame = frames[y];
+      double* pCol = &m_columns[y];
+      for (unsigned int x = 0; x < Filter::NBANDS; ++x, pCol += m_stride)
+         *pCol = static_cast<double>(pFrame[x]);
+   }
+
+   // the vector kernels need at least one full block
+   BitsKernel kernel = numBits >= m_width ? m_kernel : computeBitsScalar;
+
+   kernel( &m_columns[0], &m_filters[0], static_cast<unsigned int>(m_filters.size()),
+           first_time, numBits, &bits[0] );
+}
+
+// -----------------------------------------------------------------------------
+
+} // end of namespace fingerprint
@@ -0,0 +1,76 @@
+/***************************************************************************
+* This file is part of last.fm fingerprint app                             *
+*  Last.fm Ltd <mir@last.fm>                                               *
+*                                                                          *
+* This library is free software; you can redistribute it and/or            *
+* modify it under the terms of the GNU Lesser General Public               *
+* License as published by the Free Software Foundation; either             *
+* version 2.1 of the License, or (at your option) any later version.       *
+*                                                                          *
+* This library is distributed in the hope that it will be useful,          *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+* Lesser General Public License for more details.                          *
+*                                                                          *
+* You should have received a copy of the GNU Lesser General Public         *
+* License along with this library; if not, write to the Free Software      *
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 *
+* USA                                                                      *
+*                                                                          *
+* Part of this code is based on the work of Y. Ke, D. Hoiem, and           *
+* R. Sukthankar - "Computer Vision for Music Identification",              *
+* in Proceedings of Computer Vision and Pattern Recognition, 2005.         *
+* See also http://www.cs.cmu.edu/~yke/musicretrieval/                      *
+***************************************************************************/
+
+#ifndef __OPT_BITS_H
+#define __OPT_BITS_H
+
+#include <vector>
+#include <cstddef> // for size_t
+
+#include "Filter.h"
+#include "FrameView.h"
+#include "OptBitsKernel.h"
+
+namespace fingerprint
+{
+
+// -----------------------------------------------------------------------------
+
+// Converts the bands to bits, using the supplied filters.
+// Gives exactly the same keys of the plain per-frame evaluation, but the
+// corners of the filters are resolved once and many consecutive time
+// positions are evaluated at once with SSE2/AVX (picked at runtime).
+class OptBits
+{
+public:
+
+   OptBits(const std::vector<Filter>& filters, unsigned int maxFrames);
+
+   // frames must be the integral image of the bands
+   void
+   process(std::vector<unsigned int>& bits, const FrameView& frames, unsigned int nFrames);
+
+   // how many time positions are evaluated at once by the kernel in use
+   unsigned int
+   getWidth() const { return m_width; }
+
+private:
+
+   std::vector<BitFilter> m_filters;
+
+   // the integral image transposed (one column per band) and in double,
+   // so that consecutive time positions are contiguous
+   std::vector<double>    m_columns;
+   size_t                 m_stride;
+
+   BitsKernel             m_kernel;
+   unsigned int           m_width;
+};
+
+// -----------------------------------------------------------------------------
+
+} // end of namespace fingerprint
+
+#endif // __OPT_BITS_H
@@ -0,0 +1,88 @@
+/***************************************************************************
+* This file is part of last.fm fingerprint app                             *
+*  Last.fm Ltd <mir@last.fm>                                               *
+*                                                                          *
+* This library is free software; you can redistribute it and/or            *
+* modify it under the terms of the GNU Lesser General Public               *
+* License as published by the Free Software Foundation; either             *
+* version 2.1 of the License, or (at your option) any later version.       *
+*                                                                          *
+* This library is distributed in the hope that it will be useful,          *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+* Lesser General Public License for more details.                          *
+*                                                                          *
+* You should have received a copy of the GNU Lesser General Public         *
+* License along with this library; if not, write to the Free Software      *
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 *
+* USA                                                                      *
+***************************************************************************/
+
+// The AVX flavour of the computeBits kernel. This is the only file compiled
+// with -mavx (see CMakeLists.txt), and its code is only called after
+// checking the cpu at runtime: keep everything else out of it!
+
+#include "OptBitsKernel.h"
+
+#if defined(FP_X86_KERNELS) && ( defined(__AVX__) || defined(_MSC_VER) )
+
+#include <immintrin.h>
+
+namespace
+{
+
+// doubles are all we need, so AVX is enough (no AVX2)
+struct AVXVec
+{
+   enum { WIDTH = 4 };
+
+   AVXVec(double x) : v(_mm256_set1_pd(x)) {}
+   AVXVec(__m256d x) : v(x) {}
+
+   static AVXVec load(const double* p) { return AVXVec(_mm256_loadu_pd(p)); }
+   static unsigned int greater(const AVXVec& a, const AVXVec& b)
+   { return static_cast<unsigned int>( _mm256_movemask_pd(_mm256_cmp_pd(a.v, b.v, _CMP_GT_OQ)) ); }
+
+   __m256d v;
+};
+
+inline AVXVec operator+(const AVXVec& a, const AVXVec& b) { return AVXVec(_mm256_add_pd(a.v, b.v)); }
+inline AVXVec operator*(const AVXVec& a, const AVXVec& b) { return AVXVec(_mm256_mul_pd(a.v, b.v)); }
+
+} // end of anonymous namespace
+
+namespace fingerprint
+{
+
+void computeBitsAVX( const double* pColumns,
+                     const BitFilter* pFilters, unsigned int numFilters,
+                     unsigned int firstTime, unsigned int numBits,
+                     unsigned int* pBits )
+{
+   computeBitsKernel<AVXVec>(pColumns, pFilters, numFilters, firstTime, numBits, pBits);
+   _mm256_zeroupper();
+}
+
+} // end of namespace fingerprint
+
+#elif defined(FP_X86_KERNELS)
+
+namespace fingerprint
+{
+
+// built without AVX support: same keys, just fewer at a time
+void computeBitsAVX( const double* pColumns,
+                     const BitFilter* pFilters, unsigned int numFilters,
+                     unsigned int firstTime, unsigned int numBits,
+                     unsigned int* pBits )
+{
+#ifdef FP_SSE2_KERNEL
+   computeBitsSSE2(pColumns, pFilters, numFilters, firstTime, numBits, pBits);
+#else
+   computeBitsScalar(pColumns, pFilters, numFilters, firstTime, numBits, pBits);
+#endif
+}
+
+} // end of namespace fingerprint
+
+#endif
@@ -0,0 +1,141 @@
+/***************************************************************************
+* This file is part of last.fm fingerprint app                             *
+*  Last.fm Ltd <mir@last.fm>                                               *
+*                                                                          *
+* This library is free software; you can redistribute it and/or            *
+* modify it under the terms of the GNU Lesser General Public               *
+* License as published by the Free Software Foundation; either             *
+* version 2.1 of the License, or (at your option) any later version.       *
+*                                                                          *
+* This library is distributed in the hope that it will be useful,          *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+* Lesser General Public License for more details.                          *
+*                                                                          *
+* You should have received a copy of the GNU Lesser General Public         *
+* License along with this library; if not, write to the Free Software      *
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 *
+* USA                                                                      *
+*                                                                          *
+* Part of this code is based on the work of Y. Ke, D. Hoiem, and           *
+* R. Sukthankar - "Computer Vision for Music Identification",              *
+* in Proceedings of Computer Vision and Pattern Recognition, 2005.         *
+* See also http://www.cs.cmu.edu/~yke/musicretrieval/                      *
+***************************************************************************/
+
+#ifndef __OPT_BITS_KERNEL_H
+#define __OPT_BITS_KERNEL_H
+
+// The filter evaluation shared by all the instruction sets. It is included
+// by every OptBits*.cpp with its own vector type V, which must provide:
+//
+//   V::WIDTH               number of doubles per vector
+//   V::load(const double*) unaligned load of WIDTH consecutive values
+//   V(double)              broadcast
+//   + and *
+//   V::greater(a, b)       bit l set if a[l] > b[l]
+//
+// V must live in an anonymous namespace of the including file: each
+// instantiation is compiled with different instruction set flags and must
+// never be merged with the one of another file by the linker.
+// For the same reason, don't include any other header from here.
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define FP_X86_KERNELS
+#endif
+
+// The SSE2 kernel only where the whole build already assumes SSE2 (always on
+// x86_64, on i386 only when enabled), as the other SSE2 code of fplib.
+// Elsewhere computeBitsScalar takes its place.
+#if defined(FP_X86_KERNELS) && \
+    ( defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) )
+#define FP_SSE2_KERNEL
+#endif
+
+namespace fingerprint
+{
+
+// -----------------------------------------------------------------------------
+
+// A Filter resolved against the integral image: a sparse list of taps
+// (corner, weight), with the corners given as offsets from the current time
+// position t2 in the transposed image (band * stride + frame).
+// The taps are in the same order as the terms of the original per frame
+// expressions, so the sums are rounded exactly in the same way.
+struct BitFilter
+{
+   static const unsigned int MAX_TAPS = 9; // filter type 4
+
+   unsigned int numTaps;
+   int          offset[MAX_TAPS];
+   double       weight[MAX_TAPS]; // +-1, +-2 or 4: the products are exact
+
+   double       threshold;
+};
+
+typedef void (*BitsKernel)( const double* pColumns,
+                            const BitFilter* pFilters, unsigned int numFilters,
+                            unsigned int firstTime, unsigned int numBits,
+                            unsigned int* pBits );
+
+// the kernel below compiled for the various instruction sets
+void computeBitsScalar( const double* pColumns,
+                        const BitFilter* pFilters, unsigned int numFilters,
+                        unsigned int firstTime, unsigned int numBits,
+                        unsigned int* pBits );
+
+#ifdef FP_SSE2_KERNEL
+void computeBitsSSE2( const double* pColumns,
+                      const BitFilter* pFilters, unsigned int numFilters,
+                      unsigned int firstTime, unsigned int numBits,
+                      unsigned int* pBits );
+#endif
+
+#ifdef FP_X86_KERNELS
+void computeBitsAVX( const double* pColumns,
+                     const BitFilter* pFilters, unsigned int numFilters,
+                     unsigned int firstTime, unsigned int numBits,
+                     unsigned int* pBits );
+#endif
+
+// -----------------------------------------------------------------------------
+
+template <typename V>
+void computeBitsKernel( const double* pColumns,
+                        const BitFilter* pFilters, unsigned int numFilters,
+                        unsigned int firstTime, unsigned int numBits,
+                        unsigned int* pBits )
+{
+   for (unsigned int b = 0; b < numBits; b += V::WIDTH)
+   {
+      // the last block may overlap the previous one: the keys are
+      // assigned, so computing them twice is harmless
+      if ( b + V::WIDTH > numBits )
+         b = numBits - V::WIDTH;
+
+      const double* pT2 = pColumns + firstTime + b;
+      unsigned int keys[V::WIDTH] = { 0 };
+
+      for (unsigned int i = 0; i < numFilters; ++i)
+      {
+         const BitFilter& f = pFilters[i];
+
+         V X = V(f.weight[0]) * V::load(pT2 + f.offset[0]);
+         for (unsigned int k = 1; k < f.numTaps; ++k)
+            X = X + V(f.weight[k]) * V::load(pT2 + f.offset[k]);
+
+         const unsigned int mask = V::greater(X, V(f.threshold));
+         for (unsigned int l = 0; l < V::WIDTH; ++l)
+            keys[l] |= ((mask >> l) & 1) << i;
+      }
+
+      for (unsigned int l = 0; l < V::WIDTH; ++l)
+         pBits[b + l] = keys[l];
+   }
+}
+
+// -----------------------------------------------------------------------------
+
+} // end of namespace fingerprint
+
+#endif // __OPT_BITS_KERNEL_H
@@ -26,6 +26,7 @@
 #include "OptFFT.h"
 #include "fp_helper_fun.h"
 #include "Filter.h" // for NBANDS
+#include "Threading.h"
 
 #include <cmath>
 #include <cassert>
@@ -35,6 +36,14 @@
 #include <cstdlib> 
 #include <stdexcept>
 #include <cstring>
+#include <map>
+#include <string>
+#include <utility> // for pair
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define FP_SSE_MAGNITUDES
+#endif
 
 using namespace std;
 // ----------------------------------------------------------------------
@@ -42,6 +51,9 @@ using namespace std;
 namespace fingerprint
 {
 
+   // rows of the frame matrix are aligned (and padded) to this
+   static const size_t CACHE_LINE_SIZE = 64;
+
    static const float hann[] = {
       0.000000f,0.000002f,0.000009f,0.000021f,0.000038f,0.000059f,0.000085f,0.000115f,0.000151f,0.000191f,0.000236f,
       0.000285f,0.000339f,0.000398f,0.000462f,0.000530f,0.000603f,0.000681f,0.000763f,0.000850f,0.000942f,0.001038f,
@@ -233,6 +245,104 @@ namespace fingerprint
 
 // -----------------------------------------------------------------------------
 
+// Planning is by far the most expensive part of building an OptFFT
+// (especially with FFTW_MEASURE or FFTW_PATIENT), and the plan only depends
+// on the number of frames. So the plans are made once per process, and every
+// OptFFT runs them on its own arrays through the new-array execute interface.
+// fftwf_malloc always gives the same alignment, which is all FFTW requires.
+
+// The FFTW planner (and the wisdom) is not thread safe, while executing
+// a plan is: everything that plans goes through s_plannerMutex, so the
+// extractors can be created and run from any thread.
+
+static Mutex                             s_plannerMutex;
+static unsigned int                      s_plannerFlags = FFTW_ESTIMATE;
+static map< pair<int, unsigned int>, fftwf_plan > s_plans; // (frames, flags) -> plan
+static string                            s_wisdomFile;  // where new wisdom is saved, if anywhere
+
+// -----------------------------------------------------------------------------
+
+fftwf_plan OptFFT::getPlan(int maxFrames)
+{
+   ScopedLock lock(s_plannerMutex);
+
+   const pair<int, unsigned int> key(maxFrames, s_plannerFlags);
+
+   map< pair<int, unsigned int>, fftwf_plan >::iterator it = s_plans.find(key);
+   if ( it != s_plans.end() )
+      return it->second;
+
+   int numSamplesPerFrame    = FRAMESIZE;
+   int numSamplesPerFrameOut = FRAMESIZE/2+1;
+
+   // FFTW_MEASURE and FFTW_PATIENT overwrite the arrays while planning,
+   // so plan on scratch ones
+   float*         pIn  = static_cast<float*> ( fftwf_malloc(sizeof(float) * (numSamplesPerFrame * maxFrames) ) );
+   fftwf_complex* pOut = static_cast<fftwf_complex*>( fftwf_malloc(sizeof(fftwf_complex) * (numSamplesPerFrameOut * maxFrames) ) );
+   if ( !pIn || !pOut )
+   {
+      fftwf_free(pIn);
+      fftwf_free(pOut);
+      throw std::runtime_error ("fftwf_malloc failed while planning");
+   }
+
+	// in destroyed when line executed
+   fftwf_plan p = fftwf_plan_many_dft_r2c(1, &numSamplesPerFrame, maxFrames,
+                                          pIn, &numSamplesPerFrame, 1, numSamplesPerFrame,
+                                          pOut, &numSamplesPerFrameOut,
+                                          1, numSamplesPerFrameOut,
+                                          s_plannerFlags | FFTW_DESTROY_INPUT);
+   fftwf_free(pIn);
+   fftwf_free(pOut);
+
+   if ( !p )
+      throw std::runtime_error ("fftwf_plan_many_dft_r2c failed");
+
+   s_plans[key] = p;
+
+   // FFTW_ESTIMATE doesn't learn anything worth saving. If the file can't
+   // be written the next run just plans again.
+   if ( !s_wisdomFile.empty() && s_plannerFlags != FFTW_ESTIMATE )
+      fftwf_export_wisdom_to_filename( s_wisdomFile.c_str() );
+
+   return p;
+}
+
+// -----------------------------------------------------------------------------
+
+void OptFFT::setPlannerFlags(unsigned int flags)
+{
+   ScopedLock lock(s_plannerMutex);
+   s_plannerFlags = flags;
+}
+
+// -----------------------------------------------------------------------------
+
+bool OptFFT::importWisdom(const char* filename)
+{
+   ScopedLock lock(s_plannerMutex);
+   return fftwf_import_wisdom_from_filename(filename) != 0;
+}
+
+// -----------------------------------------------------------------------------
+
+bool OptFFT::exportWisdom(const char* filename)
+{
+   ScopedLock lock(s_plannerMutex);
+   return fftwf_export_wisdom_to_filename(filename) != 0;
+}
+
+// -----------------------------------------------------------------------------
+
+bool OptFFT::setWisdomFile(const char* filename)
+{
+   ScopedLock lock(s_plannerMutex);
+   s_wisdomFile = filename;
+   return fftwf_import_wisdom_from_filename(filename) != 0;
+}
+
+// -----------------------------------------------------------------------------
+
 OptFFT::OptFFT(const size_t maxDataSize)
 {
    assert( maxDataSize % OVERLAPSAMPLES == 0 );
@@ -277,15 +387,8 @@ OptFFT::OptFFT(const size_t maxDataSize)
       throw std::runtime_error(oss.str());
    }
 
-	// in destroyed when line executed
-   m_p = fftwf_plan_many_dft_r2c(1, &numSamplesPerFrame, m_maxFrames,
-                                 m_pIn, &numSamplesPerFrame, 1, numSamplesPerFrame,
-                                 m_pOut, &numSamplesPerFrameOut,
-                                 1, numSamplesPerFrameOut,
-                                 FFTW_ESTIMATE | FFTW_DESTROY_INPUT);
-
-   if ( !m_p )
-      throw std::runtime_error ("fftwf_plan_many_dft_r2c failed");
+   // shared, executed on our own arrays
+   m_p = getPlan(m_maxFrames);
 
 	double base = exp( log( static_cast<double>(MAXFREQ) / static_cast<double>(MINFREQ) ) / 
                       static_cast<double>(Filter::NBANDS) 
@@ -295,41 +398,61 @@ OptFFT::OptFFT(const size_t maxDataSize)
    for ( unsigned int i = 0; i < Filter::NBANDS + 1; ++i )
       m_powTable[i] = static_cast<unsigned int>( (pow(base, static_cast<double>(i)) - 1.0) * MINCOEF );
 
-   m_pFrames = new float*[m_maxFrames];
-
-   if ( !m_pFrames )
+   m_bandFirstBin.resize( Filter::NBANDS );
+   m_bandLastBin.resize( Filter::NBANDS );
+   m_bandNumBins.resize( Filter::NBANDS );
+   for ( unsigned int j = 0; j < Filter::NBANDS; ++j )
    {
-      ostringstream oss;
-      oss << "Allocation failed on m_pFrames. Trying to allocate <" 
-         << sizeof(float*) * m_maxFrames
-         << "> bytes";
-
-      throw std::runtime_error(oss.str());
+      // WARNING: We're double counting the last one here.
+      // this bug is to match matlab's implementation bug in power2band.m
+      m_bandFirstBin[j] = m_powTable[j] + static_cast<unsigned int>(MINCOEF);
+      m_bandLastBin[j]  = m_powTable[j+1] + static_cast<unsigned int>(MINCOEF);
+      // WARNING: if we change the inclusive last bin above, we need to change the following line
+      m_bandNumBins[j]  = static_cast<float>(m_powTable[j+1] - m_powTable[j] + 1);
    }
 
-
-   for (int i = 0; i < m_maxFrames; ++i) 
+   // Only the bins between MINFREQ and MAXFREQ end up in the bands (111..742,
+   // about 60% of the spectrum), so the magnitudes are computed just for them.
+   // Computing only those bins in the transform itself doesn't pay off:
+   //  - Goertzel (or any per bin DFT) is O(FRAMESIZE) per bin, ~1.3M mults
+   //    per frame against the ~60K flops of the whole real FFT.
+   //  - A chirp-z over the range needs three complex FFTs of more than
+   //    FRAMESIZE points.
+   //  - Output pruning a radix-2 FFT saves at most a couple of the last
+   //    stages when more than half of the outputs are needed.
+   //  - Demodulating and decimating the band before the transform would
+   //    change the energies, and with them the keys sent to the server.
+   m_firstUsedBin = m_bandFirstBin[0];
+   m_numUsedBins  = m_bandLastBin[Filter::NBANDS-1] - m_firstUsedBin + 1;
+   m_magnitudes.resize( m_numUsedBins );
+
+   // from now on the band ranges are relative to the first used bin
+   for ( unsigned int j = 0; j < Filter::NBANDS; ++j )
    {
-      m_pFrames[i] = new float[Filter::NBANDS];
-      if ( !m_pFrames[i] )
-         throw std::runtime_error("Allocation failed on m_pFrames");
+      m_bandFirstBin[j] -= m_firstUsedBin;
+      m_bandLastBin[j]  -= m_firstUsedBin;
    }
 
+   // all the frames in one block, every row starting on its own cache line
+   const size_t floatsPerLine = CACHE_LINE_SIZE / sizeof(float);
+   m_frameStride = (Filter::NBANDS + floatsPerLine - 1) / floatsPerLine * floatsPerLine;
+
+   m_pFramesBuffer = new float[m_frameStride * m_maxFrames + floatsPerLine];
+
+   size_t misalignment = reinterpret_cast<size_t>(m_pFramesBuffer) % CACHE_LINE_SIZE;
+   m_pFrames = m_pFramesBuffer + (misalignment ? (CACHE_LINE_SIZE - misalignment) / sizeof(float) : 0);
 }
 
 // ----------------------------------------------------------------------
 
 OptFFT::~OptFFT()
 {
-	fftwf_destroy_plan(m_p);
-	
+   // the plan is shared, it stays alive for the next ones
+
 	fftwf_free(m_pIn);
 	fftwf_free(m_pOut);
 
-   for (int i = 0; i < m_maxFrames; ++i)
-      delete [] m_pFrames[i];
-
-   delete [] m_pFrames;
+   delete [] m_pFramesBuffer;
 }
 
 // ----------------------------------------------------------------------
@@ -340,13 +463,19 @@ int OptFFT::process(float* pInData, const size_t dataSize)
    // might be less at the end of the stream
    int nFrames = static_cast<int>( (dataSize - FRAMESIZE) / OVERLAPSAMPLES + 1 );
 
+   // Every frame shares all but OVERLAPSAMPLES samples with the previous one,
+   // but each of them needs its own windowed copy anyway: the transform is
+   // done in place on the whole batch, and the window moves with the frame.
+   // A sliding DFT would avoid this copy but costs ~2*OVERLAPSAMPLES complex
+   // mults per bin per frame (~80K for the bins we need, more than the FFT),
+   // can only apply the window as an approximation in the frequency domain
+   // and drifts over time. So the copy just gets the window in the same pass.
    float* pIn_It = m_pIn;
 
    for (int i = 0; i < nFrames; ++i)
    {
-      memcpy( pIn_It, &pInData[i*OVERLAPSAMPLES], sizeof(float) * FRAMESIZE);
-      // apply hanning window
-      applyHann(pIn_It, FRAMESIZE);
+      // copy applying the hanning window
+      applyHann(&pInData[i*OVERLAPSAMPLES], pIn_It, FRAMESIZE);
 
       pIn_It += FRAMESIZE;
    }
@@ -355,46 +484,32 @@ int OptFFT::process(float* pInData, const size_t dataSize)
    if ( nFrames < m_maxFrames )
       memset( pIn_It, 0, sizeof(float) * (m_maxFrames-nFrames) * FRAMESIZE );
 
-   fftwf_execute(m_p);
+   fftwf_execute_dft_r2c(m_p, m_pIn, m_pOut);
 
-   int totSamples = (FRAMESIZE/2+1) * // numSamplesPerFrameOut
-                    nFrames; // the frames actually in the input
+   // The output of the fft should be scaled by FRAMESIZE/2. That's a power of
+   // two, so instead of scaling every bin the band sums are scaled once at the
+   // end by its square: the result is exactly the same.
+   const float scalingFactor = static_cast<float>(FRAMESIZE) / 2.0f;
+   const float powerScale = 1.0f / (scalingFactor * scalingFactor);
 
-   // scaling (?)
-   float scalingFactor = static_cast<float>(FRAMESIZE) / 2.0f;
-   for (int k = 0; k < totSamples; ++k)
-   {
-      m_pOut[k][0] /= scalingFactor;
-      m_pOut[k][1] /= scalingFactor;
-   }
-
-   int frameStart;
-   unsigned int outBlocStart;
-   unsigned int outBlocEnd;
+   const int numBins = FRAMESIZE/2+1;
+   float* pMag = &m_magnitudes[0];
 
 	for (int i = 0; i < nFrames; ++i) 
    {
-      frameStart = i * (FRAMESIZE/2+1);
+      float* pFrame = m_pFrames + i * m_frameStride;
+
+      computeMagnitudes(m_pOut + i * numBins + m_firstUsedBin, pMag, m_numUsedBins);
 
 	   // compute bands
 	   for (unsigned int j = 0; j < Filter::NBANDS; j++) 
       {
-         outBlocStart = m_powTable[j] + frameStart;
-         outBlocEnd   = m_powTable[j+1] + frameStart;
-
-		   m_pFrames[i][j] = 0;
-
-		   // WARNING: We're double counting the last one here.
-		   // this bug is to match matlab's implementation bug in power2band.m
-         unsigned int end_k = outBlocEnd + static_cast<unsigned int>(MINCOEF);
-		   for (unsigned int k = outBlocStart + static_cast<unsigned int>(MINCOEF); k <= end_k; k++) 
-         {
-			   m_pFrames[i][j] += m_pOut[k][0] * m_pOut[k][0] + 
-                               m_pOut[k][1] * m_pOut[k][1];
-		   }
-
-		   // WARNING: if we change the k<=end to k<end above, we need to change the following line
-		   m_pFrames[i][j] /= static_cast<float>(outBlocEnd - outBlocStart + 1);   		
+         float sum = 0;
+         const unsigned int end_k = m_bandLastBin[j];
+		   for (unsigned int k = m_bandFirstBin[j]; k <= end_k; k++) 
+            sum += pMag[k];
+
+		   pFrame[j] = (sum * powerScale) / m_bandNumBins[j];
 	   }   
    }
 
@@ -403,12 +518,37 @@ int OptFFT::process(float* pInData, const size_t dataSize)
 
 // -----------------------------------------------------------------------------
 
-void OptFFT::applyHann( float* pInData, const size_t dataSize )
+void OptFFT::computeMagnitudes( const fftwf_complex* pIn, float* pOut, int numBins )
+{
+   const float* pInF = reinterpret_cast<const float*>(pIn);
+   int k = 0;
+
+#ifdef FP_SSE_MAGNITUDES
+   // four bins at a time: same products and sum of the scalar loop below
+   for ( ; k + 4 <= numBins; k += 4 )
+   {
+      __m128 a = _mm_loadu_ps(pInF + 2*k);     // re0 im0 re1 im1
+      __m128 b = _mm_loadu_ps(pInF + 2*k + 4); // re2 im2 re3 im3
+      a = _mm_mul_ps(a, a);
+      b = _mm_mul_ps(b, b);
+      __m128 re2 = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+      __m128 im2 = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+      _mm_storeu_ps(pOut + k, _mm_add_ps(re2, im2));
+   }
+#endif
+
+   for ( ; k < numBins; ++k )
+      pOut[k] = pInF[2*k] * pInF[2*k] + pInF[2*k+1] * pInF[2*k+1];
+}
+
+// -----------------------------------------------------------------------------
+
+void OptFFT::applyHann( const float* pInData, float* pOutData, const size_t dataSize )
 {
    assert (dataSize == 2048);
 
    for ( size_t i = 0; i < dataSize; ++i )
-      pInData[i] *= hann[i];
+      pOutData[i] = pInData[i] * hann[i];
 }
 
 // -----------------------------------------------------------------------------
@@ -29,6 +29,8 @@
 #include <fftw3.h>
 #include <vector>
 
+#include "FrameView.h"
+
 namespace fingerprint
 {
 
@@ -42,12 +44,29 @@ public:
    int 
    process(float* pInData, const size_t dataSize);
    
-   float** 
-   getFrames()    { return m_pFrames; }
+   FrameView
+   getFrames()    { return FrameView(m_pFrames, m_frameStride); }
+
+   int
+   getMaxFrames() const { return m_maxFrames; }
+
+   // Process wide FFTW settings (see FingerprintExtractor.h).
+   // The plans are shared by all the OptFFT with the same size, so the
+   // flags only affect the plans made after the call.
+   static void setPlannerFlags(unsigned int flags);
+   static bool importWisdom(const char* filename);
+   static bool exportWisdom(const char* filename);
+   static bool setWisdomFile(const char* filename);
 
 private:
 
-   void applyHann(float* pInData, const size_t dataSize);
+   // the shared plan for maxFrames frames, made on first request
+   static fftwf_plan getPlan(int maxFrames);
+
+   void applyHann(const float* pInData, float* pOutData, const size_t dataSize);
+
+   // squared magnitudes of numBins complex bins
+   static void computeMagnitudes(const fftwf_complex* pIn, float* pOut, int numBins);
 
 	fftwf_plan        m_p;
 	fftwf_complex *   m_pOut;
@@ -58,11 +77,22 @@ private:
    int     m_numSamples;
    int     m_numOutSamples;
 
-   float** m_pFrames;
+   float*  m_pFramesBuffer;  // what has been allocated..
+   float*  m_pFrames;        // ..and the same, aligned to a cache line
+   size_t  m_frameStride;    // Filter::NBANDS rounded up to a cache line
    int     m_maxFrames;
 
    std::vector<int> m_powTable;
 
+   // the bins summed by each band (inclusive, relative to m_firstUsedBin) and their count
+   std::vector<unsigned int> m_bandFirstBin;
+   std::vector<unsigned int> m_bandLastBin;
+   std::vector<float>        m_bandNumBins;
+
+   std::vector<float>        m_magnitudes; // of one frame, only the bins used by the bands
+   unsigned int              m_firstUsedBin;
+   unsigned int              m_numUsedBins;
+
 };
 
 } // end of namespace
@@ -0,0 +1,254 @@
+/***************************************************************************
+* This file is part of last.fm fingerprint app                             *
+*  Last.fm Ltd <mir@last.fm>                                               *
+*                                                                          *
+* This library is free software; you can redistribute it and/or            *
+* modify it under the terms of the GNU Lesser General Public               *
+* License as published by the Free Software Foundation; either             *
+* version 2.1 of the License, or (at your option) any later version.       *
+*                                                                          *
+* This library is distributed in the hope that it will be useful,          *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+* Lesser General Public License for more details.                          *
+*                                                                          *
+* You should have received a copy of the GNU Lesser General Public         *
+* License along with this library; if not, write to the Free Software      *
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 *
+* USA                                                                      *
+***************************************************************************/
+
+#include <cmath>
+#include <stdexcept>
+#include <algorithm>
+
+#include "OptResampler.h"
+#include "fp_helper_fun.h" // for FDFREQ and MAXFREQ
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define FP_SSE_RESAMPLER
+#endif
+
+// -----------------------------------------------------------------------------
+
+namespace
+{
+
+// twice the output frequency, so that L/M = RATE_NUM / (2 * freq)
+const unsigned int RATE_NUM = 11025;
+
+// above this the filter gets too big to be worth it (32000 needs 441)
+const unsigned int MAX_PHASES = 441;
+
+// The bands stop at MAXFREQ, so everything up to there must be kept and
+// nothing above FDFREQ - MAXFREQ may be left, or it aliases into the bands.
+const double STOPBAND_DB = 80.0;
+
+unsigned int gcd(unsigned int a, unsigned int b)
+{
+   while ( b != 0 )
+   {
+      unsigned int t = a % b;
+      a = b;
+      b = t;
+   }
+   return a;
+}
+
+// modified Bessel function of the first kind, order 0 (for the Kaiser window)
+double besselI0(double x)
+{
+   double sum = 1.0, term = 1.0;
+   const double y = x * x / 4.0;
+   for (int k = 1; term > 1e-12 * sum; ++k)
+   {
+      term *= y / (static_cast<double>(k) * k);
+      sum += term;
+   }
+   return sum;
+}
+
+// n is a multiple of 8
+inline float dotProduct(const float* h, const float* x, unsigned int n)
+{
+#ifdef FP_SSE_RESAMPLER
+   __m128 acc0 = _mm_setzero_ps();
+   __m128 acc1 = _mm_setzero_ps();
+   for (unsigned int i = 0; i < n; i += 8)
+   {
+      acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(h + i),     _mm_loadu_ps(x + i)));
+      acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(h + i + 4), _mm_loadu_ps(x + i + 4)));
+   }
+   acc0 = _mm_add_ps(acc0, acc1);
+   acc0 = _mm_add_ps(acc0, _mm_movehl_ps(acc0, acc0));
+   acc0 = _mm_add_ss(acc0, _mm_shuffle_ps(acc0, acc0, 1));
+   return _mm_cvtss_f32(acc0);
+#else
+   float acc = 0;
+   for (unsigned int i = 0; i < n; ++i)
+      acc += h[i] * x[i];
+   return acc;
+#endif
+}
+
+} // end of anonymous namespace
+
+// -----------------------------------------------------------------------------
+
+namespace fingerprint
+{
+
+using namespace std;
+
+// -----------------------------------------------------------------------------
+
+bool OptResampler::isSupported(int freq)
+{
+   if ( freq <= 0 || 2 * static_cast<unsigned int>(freq) <= RATE_NUM )
+      return false; // only downsampling
+
+   const unsigned int L = RATE_NUM / gcd(RATE_NUM, 2 * static_cast<unsigned int>(freq));
+   return L <= MAX_PHASES;
+}
+
+// -----------------------------------------------------------------------------
+
+OptResampler::OptResampler()
+: m_freq(0), m_L(0), m_M(0), m_numTaps(0), m_bufPos(0), m_phase(0), m_inputEnd(0),
+  m_startPhase(0), m_startPos(0)
+{}
+
+// -----------------------------------------------------------------------------
+
+void OptResampler::init(int freq)
+{
+   if ( freq == m_freq )
+   {
+      reset();
+      return;
+   }
+
+   if ( !isSupported(freq) )
+      throw std::runtime_error("Unsupported frequency for the fixed ratio resampler!");
+
+   const unsigned int g = gcd(RATE_NUM, 2 * static_cast<unsigned int>(freq));
+   m_L = RATE_NUM / g;
+   m_M = 2 * static_cast<unsigned int>(freq) / g;
+
+   // Kaiser windowed sinc, designed at the upsampled rate freq * L.
+   // Cut at FDFREQ/2, with the transition band from MAXFREQ to FDFREQ - MAXFREQ.
+   const double upRate = static_cast<double>(freq) * m_L;
+   const double cutoff = (FDFREQ / 2.0) / upRate;
+   const double transition = (FDFREQ - 2.0 * MAXFREQ) / upRate;
+   const double beta = 0.1102 * (STOPBAND_DB - 8.7);
+
+   const double PI = 3.14159265358979323846;
+   double minLength = (STOPBAND_DB - 8.0) / (2.285 * 2.0 * PI * transition) + 1;
+
+   m_numTaps = static_cast<unsigned int>( ceil(minLength / m_L) );
+   m_numTaps = (m_numTaps + 7) & ~7u; // for the vectorized dot product
+
+   const unsigned int length = m_numTaps * m_L;
+   const double center = (length - 1) / 2.0;
+
+   vector<double> h(length);
+   double sum = 0;
+   for (unsigned int k = 0; k < length; ++k)
+   {
+      const double t = k - center;
+      const double r = t / center;
+      const double w = besselI0( beta * sqrt( max(0.0, 1.0 - r * r) ) ) / besselI0(beta);
+      const double x = 2.0 * PI * cutoff * t;
+      h[k] = 2.0 * cutoff * (x == 0 ? 1.0 : sin(x) / x) * w;
+      sum += h[k];
+   }
+
+   // unity gain for every phase (the upsampling has L - 1 zeros out of L)
+   m_phases.resize(length);
+   for (unsigned int p = 0; p < m_L; ++p)
+   {
+      for (unsigned int i = 0; i < m_numTaps; ++i)
+         m_phases[p * m_numTaps + i] = static_cast<float>( h[p + (m_numTaps - 1 - i) * m_L] * m_L / sum );
+   }
+
+   // The output n is centered on the input n * M / L: the filter delay is
+   // compensated, like libsamplerate does, so the keys keep their timing.
+   const unsigned int delay = (length - 1) / 2;
+   m_startPos = delay / m_L;
+   m_startPhase = delay % m_L;
+
+   m_freq = freq;
+   reset();
+}
+
+// -----------------------------------------------------------------------------
+
+void OptResampler::reset()
+{
+   // the history before the first sample is silence
+   m_buffer.assign(m_numTaps - 1, 0.0f);
+   m_inputEnd = m_buffer.size();
+   m_bufPos = m_startPos;
+   m_phase = m_startPhase;
+}
+
+// -----------------------------------------------------------------------------
+
+void OptResampler::process(SRC_DATA& data)
+{
+   if ( m_freq == 0 )
+      throw std::runtime_error("The resampler must be initialized before process()!");
+
+   const size_t outFrames = static_cast<size_t>( max(data.output_frames, 0L) );
+   const size_t inFrames  = static_cast<size_t>( max(data.input_frames, 0L) );
+
+   // grab at once all the input needed to fill the output
+   size_t inUsed = 0;
+   if ( outFrames > 0 && m_inputEnd == m_buffer.size() )
+   {
+      const size_t lastPos = m_bufPos + ((outFrames - 1) * m_M + m_phase) / m_L + m_numTaps;
+      if ( lastPos > m_buffer.size() )
+      {
+         inUsed = min(lastPos - m_buffer.size(), inFrames);
+         m_buffer.insert(m_buffer.end(), data.data_in, data.data_in + inUsed);
+         m_inputEnd = m_buffer.size();
+      }
+   }
+
+   size_t outGen = 0;
+   for (; outGen < outFrames; ++outGen)
+   {
+      if ( m_bufPos + m_numTaps > m_buffer.size() )
+      {
+         if ( !data.end_of_input )
+            break; // need more data
+
+         // flushing: stop at the output matching the end of the input
+         const double time = (static_cast<double>(m_bufPos) * m_L + m_phase - m_startPhase) / m_L - m_startPos;
+         if ( time >= static_cast<double>(m_inputEnd) - (m_numTaps - 1) )
+            break;
+
+         m_buffer.resize(m_bufPos + m_numTaps, 0.0f);
+      }
+
+      data.data_out[outGen] = dotProduct(&m_phases[m_phase * m_numTaps], &m_buffer[m_bufPos], m_numTaps);
+
+      m_phase += m_M;
+      m_bufPos += m_phase / m_L;
+      m_phase %= m_L;
+   }
+
+   // drop what won't be used anymore
+   const size_t consumed = min(m_bufPos, m_buffer.size());
+   m_buffer.erase(m_buffer.begin(), m_buffer.begin() + consumed);
+   m_bufPos -= consumed;
+   m_inputEnd -= min(consumed, m_inputEnd);
+
+   data.input_frames_used = static_cast<long>(inUsed);
+   data.output_frames_gen = static_cast<long>(outGen);
+}
+
+// -----------------------------------------------------------------------------
+
+} // end of namespace fingerprint
@@ -0,0 +1,88 @@
+/***************************************************************************
+* This file is part of last.fm fingerprint app                             *
+*  Last.fm Ltd <mir@last.fm>                                               *
+*                                                                          *
+* This library is free software; you can redistribute it and/or            *
+* modify it under the terms of the GNU Lesser General Public               *
+* License as published by the Free Software Foundation; either             *
+* version 2.1 of the License, or (at your option) any later version.       *
+*                                                                          *
+* This library is distributed in the hope that it will be useful,          *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+* Lesser General Public License for more details.                          *
+*                                                                          *
+* You should have received a copy of the GNU Lesser General Public         *
+* License along with this library; if not, write to the Free Software      *
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 *
+* USA                                                                      *
+***************************************************************************/
+
+#ifndef __OPT_RESAMPLER_H
+#define __OPT_RESAMPLER_H
+
+#include <vector>
+#include <cstddef> // for size_t
+
+#include <samplerate.h> // for SRC_DATA
+
+namespace fingerprint
+{
+
+// -----------------------------------------------------------------------------
+
+// Fixed ratio polyphase resampler to FDFREQ (5512.5 Hz).
+// The ratio FDFREQ/freq is L/M with small integers for all the usual rates
+// (44100 and 22050 are plain 8:1 and 4:1 decimations, 48000 is 147/1280,
+// 32000 is 441/2560, 96000 is 147/2560): the output samples are a dot
+// product of the input with one of L precomputed filter phases, with no
+// interpolation of the coefficients at runtime.
+class OptResampler
+{
+public:
+
+   // true if there is a fixed ratio filter for this input frequency
+   static bool isSupported(int freq);
+
+   OptResampler();
+
+   // throws if the frequency is not supported
+   void init(int freq);
+
+   // forget the stream, keep the filter
+   void reset();
+
+   // Same contract of src_process: uses data_in, input_frames, data_out,
+   // output_frames and end_of_input, and sets input_frames_used and
+   // output_frames_gen. The input is only consumed as long as there is
+   // room for the output.
+   void process(SRC_DATA& data);
+
+   int getFreq() const { return m_freq; }
+
+private:
+
+   int                m_freq;
+
+   unsigned int       m_L;       // interpolation factor
+   unsigned int       m_M;       // decimation factor
+   unsigned int       m_numTaps; // taps per phase (a multiple of 4)
+
+   // the coefficients of phase p are at [p * m_numTaps], reversed so that
+   // they line up with the input from the oldest to the newest sample
+   std::vector<float> m_phases;
+
+   // the input not consumed yet, preceded by the history of the filter
+   std::vector<float> m_buffer;
+   size_t             m_bufPos;    // first sample of the next output in m_buffer
+   unsigned int       m_phase;     // phase of the next output
+   size_t             m_inputEnd;  // end of the actual input in m_buffer (the rest is padding)
+   unsigned int       m_startPhase;
+   size_t             m_startPos;
+};
+
+// -----------------------------------------------------------------------------
+
+} // end of namespace fingerprint
+
+#endif // __OPT_RESAMPLER_H
@@ -0,0 +1,203 @@
+/***************************************************************************
+* This file is part of last.fm fingerprint app                             *
+*  Last.fm Ltd <mir@last.fm>                                               *
+*                                                                          *
+* This library is free software; you can redistribute it and/or            *
+* modify it under the terms of the GNU Lesser General Public               *
+* License as published by the Free Software Foundation; either             *
+* version 2.1 of the License, or (at your option) any later version.       *
+*                                                                          *
+* This library is distributed in the hope that it will be useful,          *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+* Lesser General Public License for more details.                          *
+*                                                                          *
+* You should have received a copy of the GNU Lesser General Public         *
+* License along with this library; if not, write to the Free Software      *
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 *
+* USA                                                                      *
+***************************************************************************/
+
+#include <limits>
+
+#include <samplerate.h> // for src_short_to_float_array
+
+#include "PCMReader.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FP_SSE2_DOWNMIX
+#endif
+
+// -----------------------------------------------------------------------------
+
+namespace fingerprint
+{
+
+using namespace std;
+
+// -----------------------------------------------------------------------------
+
+void ShortPCMReader::toMono(size_t pos, size_t numFrames, float* out) const
+{
+   src_short_to_float_and_mono_array( m_pPCM + pos, out, static_cast<int>(numFrames * m_nchannels), m_nchannels );
+}
+
+// -----------------------------------------------------------------------------
+
+void Int32PCMReader::toMono(size_t pos, size_t numFrames, float* out) const
+{
+   const int* in = m_pPCM + pos;
+   const double div = 2147483648.0 * m_nchannels; // 2^31
+
+   for ( size_t j = 0; j < numFrames; ++j, in += m_nchannels )
+   {
+      double sum = 0;
+      for ( int c = 0; c < m_nchannels; ++c )
+         sum += in[c];
+      out[j] = static_cast<float>( sum / div );
+   }
+}
+
+// -----------------------------------------------------------------------------
+
+void Int24PCMReader::toMono(size_t pos, size_t numFrames, float* out) const
+{
+   const unsigned char* in = m_pPCM + pos * 3;
+   const double div = 8388608.0 * m_nchannels; // 2^23
+
+   for ( size_t j = 0; j < numFrames; ++j )
+   {
+      int sum = 0; // 2^23 * 256 channels still fits
+      for ( int c = 0; c < m_nchannels; ++c, in += 3 )
+         sum += static_cast<int>(in[0]) | (static_cast<int>(in[1]) << 8) | (static_cast<int>(static_cast<signed char>(in[2])) << 16);
+      out[j] = static_cast<float>( sum / div );
+   }
+}
+
+// -----------------------------------------------------------------------------
+
+void FloatPCMReader::toMono(size_t pos, size_t numFrames, float* out) const
+{
+   const float* in = m_pPCM + pos;
+
+   switch ( m_nchannels )
+   {
+   case 1:
+      for ( size_t j = 0; j < numFrames; ++j )
+         out[j] = in[j];
+      break;
+   case 2:
+      for ( size_t j = 0; j < numFrames; ++j )
+         out[j] = (in[2*j] + in[2*j + 1]) * 0.5f;
+      break;
+   default:
+      {
+         const float scale = 1.0f / m_nchannels;
+         for ( size_t j = 0; j < numFrames; ++j, in += m_nchannels )
+         {
+            float sum = 0;
+            for ( int c = 0; c < m_nchannels; ++c )
+               sum += in[c];
+            out[j] = sum * scale;
+         }
+      }
+      break;
+   }
+}
+
+// -----------------------------------------------------------------------------
+
+void PlanarFloatPCMReader::toMono(size_t pos, size_t numFrames, float* out) const
+{
+   const size_t frame = pos / m_nchannels;
+
+   // one channel at a time: every loop is a plain contiguous stream
+   const float* in = m_ppChannels[0] + frame;
+   for ( size_t j = 0; j < numFrames; ++j )
+      out[j] = in[j];
+
+   for ( int c = 1; c < m_nchannels; ++c )
+   {
+      in = m_ppChannels[c] + frame;
+      for ( size_t j = 0; j < numFrames; ++j )
+         out[j] += in[j];
+   }
+
+   if ( m_nchannels > 1 )
+   {
+      const float scale = 1.0f / m_nchannels;
+      for ( size_t j = 0; j < numFrames; ++j )
+         out[j] *= scale;
+   }
+}
+
+// -----------------------------------------------------------------------------
+
+void src_short_to_float_and_mono_array( const short *in, float *out, int srclen, int nchannels )
+{
+   switch ( nchannels )
+   {
+   case 1:
+      {
+         int i = 0;
+#ifdef FP_SSE2_DOWNMIX
+         // same as src_short_to_float_array: dividing by 2^15 is exact
+         const __m128 scale = _mm_set1_ps( 1.0f / 0x8000 );
+         for ( ; i + 8 <= srclen; i += 8 )
+         {
+            const __m128i s = _mm_loadu_si128( reinterpret_cast<const __m128i*>(in + i) );
+            const __m128i lo = _mm_srai_epi32( _mm_unpacklo_epi16(s, s), 16 );
+            const __m128i hi = _mm_srai_epi32( _mm_unpackhi_epi16(s, s), 16 );
+            _mm_storeu_ps( out + i,     _mm_mul_ps(_mm_cvtepi32_ps(lo), scale) );
+            _mm_storeu_ps( out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale) );
+         }
+#endif
+         src_short_to_float_array(in + i, out + i, srclen - i);
+      }
+      break;
+   case 2:
+      {
+         int i = 0, j = 0;
+         const double div = numeric_limits<short>::max() * nchannels;
+#ifdef FP_SSE2_DOWNMIX
+         // still a division in double, two at a time, so that the result
+         // is exactly the same of the scalar loop
+         const __m128d vdiv = _mm_set1_pd(div);
+         const __m128i ones = _mm_set1_epi16(1);
+         for ( ; i + 8 <= srclen; i += 8, j += 4 )
+         {
+            // L+R of four frames
+            const __m128i sum = _mm_madd_epi16( _mm_loadu_si128( reinterpret_cast<const __m128i*>(in + i) ), ones );
+            const __m128 lo = _mm_cvtpd_ps( _mm_div_pd(_mm_cvtepi32_pd(sum), vdiv) );
+            const __m128 hi = _mm_cvtpd_ps( _mm_div_pd(_mm_cvtepi32_pd(_mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2))), vdiv) );
+            _mm_storeu_ps( out + j, _mm_movelh_ps(lo, hi) );
+         }
+#endif
+         for ( ; i < srclen; i += 2, ++j )
+         {
+            out[j] = static_cast<float>( static_cast<double>(static_cast<int>(in[i]) + static_cast<int>(in[i+1])) / div );
+         }
+      }
+      break;
+
+   default:
+      {
+         // same scale of the stereo case
+         const double div = numeric_limits<short>::max() * nchannels;
+         for ( int i = 0, j = 0; i + nchannels <= srclen; i += nchannels, ++j )
+         {
+            int sum = 0;
+            for ( int c = 0; c < nchannels; ++c )
+               sum += in[i + c];
+            out[j] = static_cast<float>( static_cast<double>(sum) / div );
+         }
+      }
+      break;
+   }
+
+}
+
+// -----------------------------------------------------------------------------
+
+} // end of namespace fingerprint
@@ -0,0 +1,112 @@
+/***************************************************************************
+* This file is part of last.fm fingerprint app                             *
+*  Last.fm Ltd <mir@last.fm>                                               *
+*                                                                          *
+* This library is free software; you can redistribute it and/or            *
+* modify it under the terms of the GNU Lesser General Public               *
+* License as published by the Free Software Foundation; either             *
+* version 2.1 of the License, or (at your option) any later version.       *
+*                                                                          *
+* This library is distributed in the hope that it will be useful,          *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+* Lesser General Public License for more details.                          *
+*                                                                          *
+* You should have received a copy of the GNU Lesser General Public         *
+* License along with this library; if not, write to the Free Software      *
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 *
+* USA                                                                      *
+***************************************************************************/
+
+#ifndef __PCM_READER_H
+#define __PCM_READER_H
+
+#include <cstddef> // for size_t
+
+namespace fingerprint
+{
+
+// -----------------------------------------------------------------------------
+
+// The PCM given to one of the FingerprintExtractor::process* calls, whatever
+// its sample format. The extractor only sees mono floats: every reader
+// converts and downmixes in the same pass, straight into the resampler input.
+class PCMReader
+{
+public:
+
+   explicit PCMReader(int nchannels) : m_nchannels(nchannels) {}
+   virtual ~PCMReader() {}
+
+   // Converts numFrames frames to mono, starting from the sample pos.
+   // Positions are counted in samples (all channels), as for num_samples.
+   virtual void toMono(size_t pos, size_t numFrames, float* out) const = 0;
+
+protected:
+
+   const int m_nchannels;
+};
+
+// -----------------------------------------------------------------------------
+
+// interleaved 16 bits
+class ShortPCMReader : public PCMReader
+{
+public:
+   ShortPCMReader(const short* pPCM, int nchannels) : PCMReader(nchannels), m_pPCM(pPCM) {}
+   void toMono(size_t pos, size_t numFrames, float* out) const;
+private:
+   const short* m_pPCM;
+};
+
+// interleaved 32 bits
+class Int32PCMReader : public PCMReader
+{
+public:
+   Int32PCMReader(const int* pPCM, int nchannels) : PCMReader(nchannels), m_pPCM(pPCM) {}
+   void toMono(size_t pos, size_t numFrames, float* out) const;
+private:
+   const int* m_pPCM;
+};
+
+// interleaved 24 bits, packed little endian (3 bytes per sample)
+class Int24PCMReader : public PCMReader
+{
+public:
+   Int24PCMReader(const unsigned char* pPCM, int nchannels) : PCMReader(nchannels), m_pPCM(pPCM) {}
+   void toMono(size_t pos, size_t numFrames, float* out) const;
+private:
+   const unsigned char* m_pPCM;
+};
+
+// interleaved float in [-1, 1]
+class FloatPCMReader : public PCMReader
+{
+public:
+   FloatPCMReader(const float* pPCM, int nchannels) : PCMReader(nchannels), m_pPCM(pPCM) {}
+   void toMono(size_t pos, size_t numFrames, float* out) const;
+private:
+   const float* m_pPCM;
+};
+
+// planar float in [-1, 1], one array per channel
+class PlanarFloatPCMReader : public PCMReader
+{
+public:
+   PlanarFloatPCMReader(const float* const* ppChannels, int nchannels) : PCMReader(nchannels), m_ppChannels(ppChannels) {}
+   void toMono(size_t pos, size_t numFrames, float* out) const;
+private:
+   const float* const* m_ppChannels;
+};
+
+// -----------------------------------------------------------------------------
+
+// 16 bits interleaved to mono float, any number of channels.
+// srclen is the number of shorts in the buffer.
+void src_short_to_float_and_mono_array(const short *in, float *out, int srclen, int nchannels);
+
+// -----------------------------------------------------------------------------
+
+} // end of namespace fingerprint
+
+#endif // __PCM_READER_H
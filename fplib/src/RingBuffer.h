@@ -0,0 +1,80 @@
+/***************************************************************************
+* This file is part of last.fm fingerprint app                             *
+*  Last.fm Ltd <mir@last.fm>                                               *
+*                                                                          *
+* This library is free software; you can redistribute it and/or            *
+* modify it under the terms of the GNU Lesser General Public               *
+* License as published by the Free Software Foundation; either             *
+* version 2.1 of the License, or (at your option) any later version.       *
+*                                                                          *
+* This library is distributed in the hope that it will be useful,          *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+* Lesser General Public License for more details.                          *
+*                                                                          *
+* You should have received a copy of the GNU Lesser General Public         *
+* License along with this library; if not, write to the Free Software      *
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 *
+* USA                                                                      *
+***************************************************************************/
+
+#ifndef __RING_BUFFER_H
+#define __RING_BUFFER_H
+
+#include <cstddef> // for size_t
+#include <cstring> // for memset
+
+// -----------------------------------------------------------------------------
+
+// A circular buffer with a power of two capacity, indexed by a free running
+// position: wrapping around is just a mask, no modulo and no branch.
+// Unlike CircularArray, the capacity can be larger than what is asked for,
+// so the user keeps track of how many elements are meaningful.
+template <typename T>
+class RingBuffer
+{
+public:
+
+   RingBuffer() : m_pData(NULL), m_mask(0) {}
+   explicit RingBuffer(size_t minSize) : m_pData(NULL), m_mask(0) { resize(minSize); }
+   ~RingBuffer() { delete [] m_pData; }
+
+   // the capacity becomes the first power of two >= minSize
+   void resize(size_t minSize)
+   {
+      size_t capacity = 1;
+      while ( capacity < minSize )
+         capacity <<= 1;
+
+      delete [] m_pData;
+      m_pData = new T[capacity];
+      m_mask = capacity - 1;
+   }
+
+   size_t capacity() const { return m_mask + 1; }
+
+   // pos is any position, it wraps around by itself
+   T& operator[](size_t pos) { return m_pData[pos & m_mask]; }
+   const T& operator[](size_t pos) const { return m_pData[pos & m_mask]; }
+
+   // how many elements can be read/written from pos in one go before
+   // wrapping around: any block is at most two contiguous runs
+   size_t contiguous(size_t pos) const { return capacity() - (pos & m_mask); }
+
+   T* data(size_t pos) { return m_pData + (pos & m_mask); }
+   const T* data(size_t pos) const { return m_pData + (pos & m_mask); }
+
+   void zero_fill() { memset( m_pData, 0, capacity() * sizeof(T) ); }
+
+private:
+
+   RingBuffer(const RingBuffer&);
+   RingBuffer& operator=(const RingBuffer&);
+
+   T*     m_pData;
+   size_t m_mask;
+};
+
+// -----------------------------------------------------------------------------
+
+#endif // __RING_BUFFER_H
@@ -0,0 +1,214 @@
+/***************************************************************************
+* This file is part of last.fm fingerprint app                             *
+*  Last.fm Ltd <mir@last.fm>                                               *
+*                                                                          *
+* This library is free software; you can redistribute it and/or            *
+* modify it under the terms of the GNU Lesser General Public               *
+* License as published by the Free Software Foundation; either             *
+* version 2.1 of the License, or (at your option) any later version.       *
+*                                                                          *
+* This library is distributed in the hope that it will be useful,          *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+* Lesser General Public License for more details.                          *
+*                                                                          *
+* You should have received a copy of the GNU Lesser General Public         *
+* License along with this library; if not, write to the Free Software      *
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 *
+* USA                                                                      *
+***************************************************************************/
+
+#ifndef __THREADING_H
+#define __THREADING_H
+
+// Minimal wrappers around the native threading primitives (pthreads or win32),
+// just what fplib needs internally.
+
+#include <stdexcept>
+#include <cstddef> // for size_t
+
+#ifdef WIN32
+#ifndef NOMINMAX
+#define NOMINMAX // keep std::min/max usable
+#endif
+#include <windows.h>
+#include <process.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+namespace fingerprint
+{
+
+// -----------------------------------------------------------------------------
+
+class Mutex
+{
+public:
+
+#ifdef WIN32
+   Mutex()        { InitializeCriticalSection(&m_cs); }
+   ~Mutex()       { DeleteCriticalSection(&m_cs); }
+   void lock()    { EnterCriticalSection(&m_cs); }
+   void unlock()  { LeaveCriticalSection(&m_cs); }
+#else
+   Mutex()        { pthread_mutex_init(&m_mutex, NULL); }
+   ~Mutex()       { pthread_mutex_destroy(&m_mutex); }
+   void lock()    { pthread_mutex_lock(&m_mutex); }
+   void unlock()  { pthread_mutex_unlock(&m_mutex); }
+#endif
+
+private:
+
+   friend class Condition;
+
+   Mutex(const Mutex&);            // non copyable
+   Mutex& operator=(const Mutex&);
+
+#ifdef WIN32
+   CRITICAL_SECTION m_cs;
+#else
+   pthread_mutex_t  m_mutex;
+#endif
+};
+
+// -----------------------------------------------------------------------------
+
+class ScopedLock
+{
+public:
+   explicit ScopedLock(Mutex& m) : m_mutex(m) { m_mutex.lock(); }
+   ~ScopedLock() { m_mutex.unlock(); }
+
+private:
+   ScopedLock(const ScopedLock&);
+   ScopedLock& operator=(const ScopedLock&);
+
+   Mutex& m_mutex;
+};
+
+// -----------------------------------------------------------------------------
+
+class Condition
+{
+public:
+
+#ifdef WIN32
+   Condition()              { InitializeConditionVariable(&m_cond); }
+   ~Condition()             { }
+   void wait(Mutex& m)      { SleepConditionVariableCS(&m_cond, &m.m_cs, INFINITE); }
+   void signal()            { WakeConditionVariable(&m_cond); }
+   void broadcast()         { WakeAllConditionVariable(&m_cond); }
+#else
+   Condition()              { pthread_cond_init(&m_cond, NULL); }
+   ~Condition()             { pthread_cond_destroy(&m_cond); }
+   void wait(Mutex& m)      { pthread_cond_wait(&m_cond, &m.m_mutex); }
+   void signal()            { pthread_cond_signal(&m_cond); }
+   void broadcast()         { pthread_cond_broadcast(&m_cond); }
+#endif
+
+private:
+   Condition(const Condition&);
+   Condition& operator=(const Condition&);
+
+#ifdef WIN32
+   CONDITION_VARIABLE m_cond;
+#else
+   pthread_cond_t     m_cond;
+#endif
+};
+
+// -----------------------------------------------------------------------------
+
+class Thread
+{
+public:
+
+   typedef void (*ThreadFunc)(void*);
+
+   Thread() : m_pFunc(NULL), m_pArg(NULL), m_running(false) {}
+
+   ~Thread()
+   {
+      if ( m_running )
+         join();
+   }
+
+   void start(ThreadFunc pFunc, void* pArg)
+   {
+      m_pFunc = pFunc;
+      m_pArg = pArg;
+
+#ifdef WIN32
+      m_handle = reinterpret_cast<HANDLE>( _beginthreadex(NULL, 0, &Thread::trampoline, this, 0, NULL) );
+      if ( m_handle == 0 )
+         throw std::runtime_error("Cannot create thread!");
+#else
+      if ( pthread_create(&m_thread, NULL, &Thread::trampoline, this) != 0 )
+         throw std::runtime_error("Cannot create thread!");
+#endif
+      m_running = true;
+   }
+
+   void join()
+   {
+      if ( !m_running )
+         return;
+#ifdef WIN32
+      WaitForSingleObject(m_handle, INFINITE);
+      CloseHandle(m_handle);
+#else
+      pthread_join(m_thread, NULL);
+#endif
+      m_running = false;
+   }
+
+   // number of cores available, never returns 0
+   static size_t getNumCores()
+   {
+#ifdef WIN32
+      SYSTEM_INFO si;
+      GetSystemInfo(&si);
+      long n = static_cast<long>(si.dwNumberOfProcessors);
+#else
+      long n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+      return n > 0 ? static_cast<size_t>(n) : 1;
+   }
+
+private:
+
+   Thread(const Thread&);
+   Thread& operator=(const Thread&);
+
+#ifdef WIN32
+   static unsigned __stdcall trampoline(void* pThis)
+   {
+      Thread* pThread = static_cast<Thread*>(pThis);
+      pThread->m_pFunc(pThread->m_pArg);
+      return 0;
+   }
+
+   HANDLE     m_handle;
+#else
+   static void* trampoline(void* pThis)
+   {
+      Thread* pThread = static_cast<Thread*>(pThis);
+      pThread->m_pFunc(pThread->m_pArg);
+      return NULL;
+   }
+
+   pthread_t  m_thread;
+#endif
+
+   ThreadFunc m_pFunc;
+   void*      m_pArg;
+   bool       m_running;
+};
+
+// -----------------------------------------------------------------------------
+
+} // end of namespace fingerprint
+
+#endif // __THREADING_H
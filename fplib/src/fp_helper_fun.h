@@ -27,9 +27,11 @@
 #define __FINGERPRINT_HELPER_FUNCTIONS_H
 
 #include <vector>
-#include <deque>
 #include <set>
 
+#include "GroupBuffer.h"
+#include "KeyCounter.h"
+
 namespace fingerprint
 {
 
@@ -141,58 +143,12 @@ void cutGroups(
 
 // -------------------------------------------------------------------------
 
-template <typename TGroupData>
-void keys2GroupData( 
-   const std::vector<unsigned int>& keys, // in
-   std::vector<TGroupData>& groupData,
-   bool clearDst = true ) // out
-{
-   if (clearDst)
-      groupData.clear();
-
-   if (keys.empty())
-      return;
-
-   TGroupData tmpGroup;
-   std::vector<unsigned int>::const_iterator it = keys.begin();
-
-   if ( !groupData.empty() )
-   {
-      // get the last group 
-      tmpGroup = groupData.back();
-      groupData.pop_back();
-   }
-   else
-   {
-      // new group!
-      tmpGroup.key = *it;
-      tmpGroup.count = 1;
-      ++it; // move to the next key
-   }
-
-   for (; it != keys.end(); ++it)
-   {
-      if ( *it != tmpGroup.key )
-      {
-         // new group ready!
-         groupData.push_back( tmpGroup );
-         tmpGroup.key = *it;
-         tmpGroup.count = 0;
-      }
-
-      ++tmpGroup.count;
-   }
-
-   // last group
-   groupData.push_back( tmpGroup );
-}
-
-// -------------------------------------------------------------------------
-
-template <typename TGroupData>
+// Appends the keys to the groups, continuing the last one unless clearDst.
+// The groups can be a std::vector or a GroupBuffer.
+template <typename TGroupContainer>
 void keys2GroupData( 
    const std::vector<unsigned int>& keys, // in
-   std::deque<TGroupData>& groupData,
+   TGroupContainer& groupData,
    bool clearDst = true ) // out
 {
    if (clearDst)
@@ -201,7 +157,7 @@ void keys2GroupData(
    if (keys.empty())
       return;
 
-   TGroupData tmpGroup;
+   typename TGroupContainer::value_type tmpGroup;
    std::vector<unsigned int>::const_iterator it = keys.begin();
 
    if ( !groupData.empty() )
@@ -256,6 +212,49 @@ void groupData2Keys(
 
 // -------------------------------------------------------------------------
 
+// Gives the same answer of enoughUniqueGoodGroups(beg, end, minUniqueKeys)
+// for a window that only moves forward, in O(1) per group that enters or
+// leaves it instead of rebuilding a set at every call.
+// enoughUniqueGoodGroups stops at minUniqueKeys keys or at the first group
+// longer than MAX_GOOD_GROUP_SIZE, whichever comes first, so it is true when
+// the groups from beg up to the first long one (or end) have enough different
+// keys. Those are the ones in the counter: [m_left, m_right), with m_right
+// held at the first long group.
+template <typename GroupDataIt>
+class UniqueGoodGroups
+{
+public:
+
+   UniqueGoodGroups(const GroupDataIt& start, unsigned int minUniqueKeys)
+   : m_left(start), m_right(start), m_minUniqueKeys(minUniqueKeys) {}
+
+   // beg and end must never go back
+   bool enough(const GroupDataIt& beg, const GroupDataIt& end)
+   {
+      for (; m_left != beg; ++m_left)
+      {
+         if (m_left == m_right)
+            ++m_right; // a long group leaving the window
+         else
+            m_keys.remove(m_left->key);
+      }
+
+      for (; m_right != end && m_right->count <= MAX_GOOD_GROUP_SIZE; ++m_right)
+         m_keys.add(m_right->key);
+
+      return static_cast<unsigned int>(m_keys.size()) >= m_minUniqueKeys;
+   }
+
+private:
+
+   GroupDataIt  m_left;
+   GroupDataIt  m_right;
+   unsigned int m_minUniqueKeys;
+   KeyCounter   m_keys;
+};
+
+// -------------------------------------------------------------------------
+
 template <typename GroupDataIt>
 bool findSignificantGroups(
    GroupDataIt& beg, GroupDataIt& end, unsigned int& offset_left, unsigned int& offset_right,
@@ -292,9 +291,12 @@ bool findSignificantGroups(
       window_offset_right > itWindowEnd->count; ++itWindowEnd)
       window_offset_right -= itWindowEnd->count;
 
+   // the window only moves forward: keep its keys counted as it slides
+   UniqueGoodGroups<GroupDataIt> uniqueGoodGroups(itWindowBeg, minUniqueKeys);
+
    while (itEnd != end)
    {
-      if (enoughUniqueGoodGroups(itWindowBeg, itWindowEnd, minUniqueKeys))
+      if (uniqueGoodGroups.enough(itWindowBeg, itWindowEnd))
       {
          beg = itBeg;
          end = itEnd;
@@ -320,7 +322,7 @@ bool findSignificantGroups(
    beg = itBeg;
    end = itEnd;
 
-   return enoughUniqueGoodGroups(itWindowBeg, itWindowEnd, minUniqueKeys);
+   return uniqueGoodGroups.enough(itWindowBeg, itWindowEnd);
 }
 
 // -----------------------------------------------------------------------------
@@ -403,41 +405,47 @@ struct RawFilter
    unsigned int ftid;
    float thresh;
 	float weight;
+
+   // what Filter(ftid) decodes to, precomputed (see Filter.cpp)
+   unsigned int wt;
+   unsigned int first_band;
+   unsigned int wb;
+   unsigned int filter_type;
 };
 
 const RawFilter rFilters[] = {
-   { 26752, -4.37515e-07f, 0.260836f }, // filterID, threshold, alpha (weight)
-   { 23871, -2.44615e-05f, 0.263986f },
-   { 26777, -3.69244e-08f, 0.267763f },
-   { 4635,  -1.13672e-05f, 0.269428f },
-   { 2937,   5.28804e-09f, 0.271896f },
-   { 27405, -0.000126494f, 0.272362f },
-   { 10782,  4.27478e-08f, 0.272609f },
-   { 21033, -6.7912e-07f,  0.276099f },
-   { 27117,  8.07178e-06f, 0.277762f },
-   { 27072,  2.46044e-05f, 0.27883f  },
-   { 24228,  4.11255e-07f, 0.281743f },
-   { 23838,  0.000228396f, 0.284479f },
-   { 17165, -1.19495e-07f, 0.286304f },
-   { 25263,  0.000398279f, 0.287066f },
-   { 20721,  7.15095e-07f, 0.288913f },
-   { 8502,  -2.78361e-07f, 0.290424f },
-   { 17175, -1.08429e-08f, 0.292219f },
-   { 17811, -3.29527e-08f, 0.292554f },
-   { 27495, -4.47575e-07f, 0.290119f },
-   { 23538, -3.04273e-09f, 0.294539f },
-   { 8205,   4.02691e-07f, 0.293525f },
-   { 12177,  1.16873e-06f, 0.293832f },
-   { 27051, -0.000902544f, 0.296453f },
-   { 27111, -2.38425e-05f, 0.297428f },
-   { 21779, -1.0669e-07f,  0.297302f },
-   { 14817, -9.52849e-09f, 0.299f    },
-   { 27087,  1.22163e-05f, 0.296502f },
-   { 27081, -2.8758e-09f,  0.300112f },
-   { 20394,  1.28237e-06f, 0.298693f },
-   { 28209,  0.000624447f, 0.29812f  },
-   { 23533, -2.19406e-06f, 0.299773f },
-   { 23865, -1.28037e-08f, 0.300777f } // this is iteration 1
+   { 26752, -4.37515e-07f, 0.260836f, 82,  6,  2, 3 }, // filterID, threshold, alpha (weight), wt, first band, wb, type
+   { 23871, -2.44615e-05f, 0.263986f, 54,  6,  4, 6 },
+   { 26777, -3.69244e-08f, 0.267763f, 82, 11,  2, 3 },
+   { 4635,  -1.13672e-05f, 0.269428f,  4,  4,  4, 6 },
+   { 2937,   5.28804e-09f, 0.271896f,  2,  1, 12, 6 },
+   { 27405, -0.000126494f, 0.272362f, 82,  2,  6, 6 },
+   { 10782,  4.27478e-08f, 0.272609f, 10, 16,  2, 3 },
+   { 21033, -6.7912e-07f,  0.276099f, 36,  8,  6, 6 },
+   { 27117,  8.07178e-06f, 0.277762f, 82, 13,  4, 6 },
+   { 27072,  2.46044e-05f, 0.27883f,  82,  6,  4, 3 },
+   { 24228,  4.11255e-07f, 0.281743f, 54,  7,  6, 3 },
+   { 23838,  0.000228396f, 0.284479f, 54,  1,  4, 3 },
+   { 17165, -1.19495e-07f, 0.286304f, 24, 11,  2, 3 },
+   { 25263,  0.000398279f, 0.287066f, 54,  4, 13, 6 },
+   { 20721,  7.15095e-07f, 0.288913f, 36, 15,  4, 6 },
+   { 8502,  -2.78361e-07f, 0.290424f,  6,  1,  8, 3 },
+   { 17175, -1.08429e-08f, 0.292219f, 24, 13,  2, 3 },
+   { 17811, -3.29527e-08f, 0.292554f, 24,  5,  6, 6 },
+   { 27495, -4.47575e-07f, 0.290119f, 82, 17,  6, 6 },
+   { 23538, -3.04273e-09f, 0.294539f, 54,  4,  2, 3 },
+   { 8205,   4.02691e-07f, 0.293525f,  6,  6,  6, 6 },
+   { 12177,  1.16873e-06f, 0.293832f, 10,  4, 11, 6 },
+   { 27051, -0.000902544f, 0.296453f, 82,  2,  4, 6 },
+   { 27111, -2.38425e-05f, 0.297428f, 82, 12,  4, 6 },
+   { 21779, -1.0669e-07f,  0.297302f, 36,  3, 11, 2 },
+   { 14817, -9.52849e-09f, 0.299f,    16, 12,  7, 6 },
+   { 27087,  1.22163e-05f, 0.296502f, 82,  8,  4, 6 },
+   { 27081, -2.8758e-09f,  0.300112f, 82,  7,  4, 6 },
+   { 20394,  1.28237e-06f, 0.298693f, 36, 16,  2, 3 },
+   { 28209,  0.000624447f, 0.29812f,  82,  6, 11, 6 },
+   { 23533, -2.19406e-06f, 0.299773f, 54,  3,  2, 3 },
+   { 23865, -1.28037e-08f, 0.300777f, 54,  5,  4, 6 } // this is iteration 1
 };
 
 // -----------------------------------------------------------------------------
@@ -0,0 +1,153 @@
+/***************************************************************************
+* This file is part of last.fm fingerprint app                             *
+*  Last.fm Ltd <mir@last.fm>                                               *
+*                                                                          *
+* This library is free software; you can redistribute it and/or            *
+* modify it under the terms of the GNU Lesser General Public               *
+* License as published by the Free Software Foundation; either             *
+* version 2.1 of the License, or (at your option) any later version.       *
+*                                                                          *
+* This library is distributed in the hope that it will be useful,          *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+* Lesser General Public License for more details.                          *
+*                                                                          *
+* You should have received a copy of the GNU Lesser General Public         *
+* License along with this library; if not, write to the Free Software      *
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 *
+* USA                                                                      *
+***************************************************************************/
+
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include "TestUtils.h"
+#include "BatchFingerprinter.h"
+
+// -----------------------------------------------------------------------------
+
+namespace
+{
+
+using namespace std;
+using namespace fingerprint;
+
+const size_t BATCH_THREADS = 3;
+const size_t BATCH_TRACKS = 7;
+
+// A track in memory, with its own rate and channels.
+class TestSource : public PCMSource
+{
+public:
+
+   TestSource(int freq, int nchannels, int secs, unsigned int seed)
+   : m_freq(freq), m_nchannels(nchannels), m_pos(0)
+   , m_pcm( makeTestSignal(freq, nchannels, secs, seed) )
+   {}
+
+   virtual int getFreq() const { return m_freq; }
+   virtual int getNumChannels() const { return m_nchannels; }
+
+   virtual size_t read(short* pPCM, size_t num_samples)
+   {
+      const size_t n = std::min(num_samples, m_pcm.size() - m_pos);
+      std::copy(m_pcm.begin() + m_pos, m_pcm.begin() + m_pos + n, pPCM);
+      m_pos += n;
+      return n;
+   }
+
+   void rewind() { m_pos = 0; }
+
+   // what a single extractor makes of it, empty if it fails
+   vector<char> fingerprint(BatchFingerprinter::eMode mode) const
+   {
+      FingerprintExtractor fextr;
+      if ( mode == BatchFingerprinter::FOR_QUERY )
+         fextr.initForQuery(m_freq, m_nchannels);
+      else
+         fextr.initForFullSubmit(m_freq, m_nchannels);
+
+      try
+      {
+         return fingerprintOf(fextr, &m_pcm[0], m_pcm.size());
+      }
+      catch ( const std::runtime_error& )
+      {
+         return vector<char>();
+      }
+   }
+
+private:
+
+   int           m_freq;
+   int           m_nchannels;
+   size_t        m_pos;
+   vector<short> m_pcm;
+};
+
+// one of them too short for a fingerprint
+TestSource* makeSource(size_t i)
+{
+   static const int freqs[] = { 44100, 22050, 48000, 11025 };
+   const int secs = (i == 3) ? 2 : 25 + static_cast<int>(i) * 3;
+   return new TestSource( freqs[i % 4], 1 + static_cast<int>(i % 2), secs, static_cast<unsigned int>(i) + 1 );
+}
+
+} // end of anonymous namespace
+
+// -----------------------------------------------------------------------------
+
+namespace fingerprint
+{
+
+// Every result of a batch must be what a single extractor gets out of the
+// same source, for both modes, and the workers keep their extractors from
+// one batch to the next.
+bool testBatchMatchesSingle()
+{
+   vector<TestSource*> sources;
+   for ( size_t i = 0; i < BATCH_TRACKS; ++i )
+      sources.push_back( makeSource(i) );
+   const vector<PCMSource*> pcmSources(sources.begin(), sources.end());
+
+   bool ok = true;
+   for ( int m = 0; m < 2 && ok; ++m )
+   {
+      const BatchFingerprinter::eMode mode = m ? BatchFingerprinter::FOR_FULLSUBMIT
+                                               : BatchFingerprinter::FOR_QUERY;
+      BatchFingerprinter batch(BATCH_THREADS, mode);
+
+      for ( int run = 0; run < 2 && ok; ++run )
+      {
+         for ( size_t i = 0; i < sources.size(); ++i )
+            sources[i]->rewind();
+         batch.start(pcmSources);
+
+         vector<bool> seen(sources.size(), false);
+         BatchResult result;
+         while ( ok && batch.getNextResult(result) )
+         {
+            ok = result.index < sources.size() && !seen[result.index];
+            if ( !ok )
+               break;
+            seen[result.index] = true;
+
+            const vector<char> single = sources[result.index]->fingerprint(mode);
+            ok = result.success ? result.fingerprint == single && !single.empty()
+                                : single.empty() && !result.error.empty();
+            if ( !ok )
+               fprintf(stderr, "source %u: %s\n", static_cast<unsigned int>(result.index), result.error.c_str());
+         }
+         ok = ok && find(seen.begin(), seen.end(), false) == seen.end();
+      }
+   }
+
+   for ( size_t i = 0; i < sources.size(); ++i )
+      delete sources[i];
+
+   TEST_CHECK( ok );
+   return true;
+}
+
+} // end of namespace fingerprint
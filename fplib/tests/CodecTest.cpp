@@ -0,0 +1,271 @@
+/***************************************************************************
+* This file is part of last.fm fingerprint app                             *
+*  Last.fm Ltd <mir@last.fm>                                               *
+*                                                                          *
+* This library is free software; you can redistribute it and/or            *
+* modify it under the terms of the GNU Lesser General Public               *
+* License as published by the Free Software Foundation; either             *
+* version 2.1 of the License, or (at your option) any later version.       *
+*                                                                          *
+* This library is distributed in the hope that it will be useful,          *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+* Lesser General Public License for more details.                          *
+*                                                                          *
+* You should have received a copy of the GNU Lesser General Public         *
+* License along with this library; if not, write to the Free Software      *
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 *
+* USA                                                                      *
+***************************************************************************/
+
+#include <stdexcept>
+
+#include "TestUtils.h"
+#include "FingerprintCodec.h"
+#include "FingerprintCodecKernel.h"
+
+// -----------------------------------------------------------------------------
+
+namespace
+{
+
+using namespace std;
+using namespace fingerprint;
+
+// Decodes the first size bytes of data from a copy of exactly that many, so
+// that a memory checker sees any read past them.
+void decodeExact(const vector<char>& data, size_t size, vector<char>& out)
+{
+   const vector<char> copy(data.begin(), data.begin() + size);
+   decodeFingerprint(copy.empty() ? NULL : &copy[0], copy.size(), out);
+}
+
+bool decodeFails(const vector<char>& data, size_t size)
+{
+   vector<char> out;
+   try
+   {
+      decodeExact(data, size, out);
+   }
+   catch ( const std::runtime_error& )
+   {
+      return true;
+   }
+   return false;
+}
+
+bool roundTrips(const vector<char>& fp, bool useLZ)
+{
+   vector<char> encoded, decoded;
+   encodeFingerprint(fp.empty() ? NULL : &fp[0], fp.size(), encoded, useLZ);
+   decodeExact(encoded, encoded.size(), decoded);
+   return decoded == fp;
+}
+
+// Groups whose keys and counts take from 1 to 4 bytes, as the real ones
+// don't, and the whole first half once more (a chorus, for the LZ stage).
+vector<char> makeWideFingerprint(size_t numGroups)
+{
+   vector<char> fp(numGroups * 8);
+   unsigned int r = 12345;
+   for ( size_t i = 0; i < numGroups / 2; ++i )
+   {
+      for ( size_t b = 0; b < 8; ++b )
+      {
+         r = r * 1664525u + 1013904223u;
+         fp[i * 8 + b] = static_cast<char>( b % 4 <= (i + b / 4) % 4 ? r >> 24 : 0 );
+      }
+   }
+   copy(fp.begin(), fp.begin() + numGroups / 2 * 8, fp.begin() + numGroups / 2 * 8);
+   return fp;
+}
+
+// Values of every length, the limits between them included.
+vector<unsigned int> makeVByteValues(size_t numQuads)
+{
+   static const unsigned int limits[] = { 0, 0xFF, 0x100, 0xFFFF, 0x10000, 0xFFFFFF, 0x1000000, 0xFFFFFFFF };
+   const size_t numLimits = sizeof(limits) / sizeof(limits[0]);
+
+   vector<unsigned int> values(4 * numQuads);
+   unsigned int r = 777;
+   for ( size_t i = 0; i < values.size(); ++i )
+   {
+      r = r * 1664525u + 1013904223u;
+      if ( i < numLimits )
+         values[i] = limits[i];
+      else
+         values[i] = r >> (8 * ((r >> 3) % 4));
+   }
+   return values;
+}
+
+} // end of anonymous namespace
+
+// -----------------------------------------------------------------------------
+
+namespace fingerprint
+{
+
+// Back to the same legacy bytes, with and without LZ, whatever the number
+// of groups (the padding) and the sizes of the values.
+bool testCodecRoundTrip()
+{
+   for ( size_t numGroups = 1; numGroups <= 9; ++numGroups )
+   {
+      const vector<char> fp = makeTestFingerprint(static_cast<unsigned int>(numGroups), numGroups, 50000);
+      TEST_CHECK( roundTrips(fp, false) );
+      TEST_CHECK( roundTrips(fp, true) );
+   }
+
+   const vector<char> fp = makeTestFingerprint(1, 5000, 50000);
+   TEST_CHECK( roundTrips(fp, false) );
+   TEST_CHECK( roundTrips(fp, true) );
+
+   const vector<char> wide = makeWideFingerprint(3000);
+   TEST_CHECK( roundTrips(wide, false) );
+   TEST_CHECK( roundTrips(wide, true) );
+
+   // the repeated half has to go through the LZ matches
+   vector<char> plain, packed;
+   encodeFingerprint(&wide[0], wide.size(), plain, false);
+   encodeFingerprint(&wide[0], wide.size(), packed, true);
+   TEST_CHECK( packed.size() < plain.size() * 2 / 3 );
+
+   bool thrown = false;
+   try
+   {
+      encodeFingerprint(&fp[0], 12, plain);
+   }
+   catch ( const std::runtime_error& )
+   {
+      thrown = true;
+   }
+   TEST_CHECK( thrown );
+
+   return true;
+}
+
+// -----------------------------------------------------------------------------
+
+// No groups is still a fingerprint, the header alone.
+bool testCodecEmpty()
+{
+   const vector<char> empty;
+   TEST_CHECK( roundTrips(empty, false) );
+   TEST_CHECK( roundTrips(empty, true) );
+
+   vector<char> encoded;
+   encodeFingerprint(NULL, 0, encoded, false);
+   TEST_CHECK( encoded.size() == 3 );
+   TEST_CHECK( encoded[0] == static_cast<char>(FINGERPRINT_CODEC_VERSION) );
+   TEST_CHECK( encoded[2] == 0 );
+
+   // nothing at all isn't
+   TEST_CHECK( decodeFails(encoded, 0) );
+
+   return true;
+}
+
+// -----------------------------------------------------------------------------
+
+// Whatever is cut off must throw; a changed byte must throw or decode to
+// something, without reading past the end (run it with a memory checker).
+bool testCodecCorrupted()
+{
+   const vector<char> fp = makeWideFingerprint(200);
+
+   for ( int useLZ = 0; useLZ < 2; ++useLZ )
+   {
+      vector<char> encoded;
+      encodeFingerprint(&fp[0], fp.size(), encoded, useLZ != 0);
+
+      for ( size_t size = 0; size < encoded.size(); ++size )
+         TEST_CHECK( decodeFails(encoded, size) );
+
+      for ( size_t i = 0; i < encoded.size(); ++i )
+      {
+         static const unsigned char masks[] = { 0x01, 0x10, 0x80, 0xFF };
+         for ( size_t m = 0; m < sizeof(masks); ++m )
+         {
+            vector<char> mutated(encoded);
+            mutated[i] = static_cast<char>(mutated[i] ^ masks[m]);
+            decodeFails(mutated, mutated.size());
+         }
+      }
+
+      vector<char> mutated(encoded);
+      mutated[0] = static_cast<char>(FINGERPRINT_CODEC_VERSION + 1);
+      TEST_CHECK( decodeFails(mutated, mutated.size()) );
+
+      mutated = encoded;
+      mutated[1] = static_cast<char>(mutated[1] | 0x02);
+      TEST_CHECK( decodeFails(mutated, mutated.size()) );
+   }
+
+   // without LZ, a control byte that doesn't add up to the data
+   vector<char> encoded;
+   encodeFingerprint(&fp[0], fp.size(), encoded, false);
+   const size_t header = 4; // version, flags, 200 in two bytes
+   for ( size_t q = 0; q < (2 * 200 + 3) / 4; ++q )
+   {
+      vector<char> mutated(encoded);
+      mutated[header + q] = static_cast<char>(mutated[header + q] ^ 0x03);
+      TEST_CHECK( decodeFails(mutated, mutated.size()) );
+   }
+
+   return true;
+}
+
+// -----------------------------------------------------------------------------
+
+// The SSSE3 loops must write the same bytes and read the same values as the
+// scalar ones.
+bool testCodecSSSE3Kernels()
+{
+#ifdef FP_X86_CODEC
+   if ( !codecUsesSSSE3() )
+   {
+      printf("(no SSSE3) ");
+      return true;
+   }
+
+   const StreamVByteTables& tables = getStreamVByteTables();
+
+   for ( size_t numQuads = 1; numQuads <= 40; numQuads += 13 )
+   {
+      const vector<unsigned int> values = makeVByteValues(numQuads);
+
+      // the control bytes, then the data, and room for the last store
+      vector<unsigned char> scalar(numQuads + 16 * numQuads + 16);
+      vector<unsigned char> ssse3(scalar.size());
+      const unsigned char* pScalarEnd =
+         encodeQuadsScalar(&values[0], numQuads, &scalar[0], &scalar[numQuads], tables);
+      const unsigned char* pSSSE3End =
+         encodeQuadsSSSE3(&values[0], numQuads, &ssse3[0], &ssse3[numQuads], tables);
+
+      const size_t size = pScalarEnd - &scalar[0];
+      TEST_CHECK( pSSSE3End - &ssse3[0] == static_cast<ptrdiff_t>(size) );
+      TEST_CHECK( equal(scalar.begin(), scalar.begin() + size, ssse3.begin()) );
+
+      // back, from a buffer without any slack: the SSSE3 loop leaves the
+      // last quads to the scalar one
+      const vector<unsigned char> encoded(scalar.begin(), scalar.begin() + size);
+      const unsigned char* pEnd = &encoded[0] + size;
+      const unsigned char* pData = &encoded[numQuads];
+      vector<unsigned int> decoded(4 * numQuads);
+      const size_t q = decodeQuadsSSSE3(&encoded[0], numQuads, pData, pEnd, &decoded[0], tables);
+      TEST_CHECK( q <= numQuads );
+      decodeQuadsScalar(&encoded[q], numQuads - q, pData, pEnd, &decoded[4 * q], tables);
+      TEST_CHECK( pData == pEnd );
+      TEST_CHECK( decoded == values );
+   }
+#else
+   printf("(not x86) ");
+#endif
+
+   return true;
+}
+
+// -----------------------------------------------------------------------------
+
+} // end of namespace fingerprint
@@ -0,0 +1,158 @@
+/***************************************************************************
+* This file is part of last.fm fingerprint app                             *
+*  Last.fm Ltd <mir@last.fm>                                               *
+*                                                                          *
+* This library is free software; you can redistribute it and/or            *
+* modify it under the terms of the GNU Lesser General Public               *
+* License as published by the Free Software Foundation; either             *
+* version 2.1 of the License, or (at your option) any later version.       *
+*                                                                          *
+* This library is distributed in the hope that it will be useful,          *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+* Lesser General Public License for more details.                          *
+*                                                                          *
+* You should have received a copy of the GNU Lesser General Public         *
+* License along with this library; if not, write to the Free Software      *
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 *
+* USA                                                                      *
+***************************************************************************/
+
+#include <vector>
+
+#include "TestUtils.h"
+
+// -----------------------------------------------------------------------------
+
+namespace
+{
+
+using namespace std;
+using namespace fingerprint;
+
+const int    FORMAT_FREQ = 44100;
+const int    FORMAT_SECS = 30;
+const size_t FORMAT_CHUNK_FRAMES = 4096;
+
+const double MIN_FORMAT_KEY_MATCH = 0.998;
+const double MIN_FORMAT_BIT_MATCH = 0.9999;
+
+enum eFormat
+{
+   FORMAT_SHORT,
+   FORMAT_FLOAT,
+   FORMAT_INT32,
+   FORMAT_INT24,
+   FORMAT_PLANAR_FLOAT
+};
+
+// The full submit of pcm (interleaved 16 bits), converted to format first
+// and fed to the matching process call, FORMAT_CHUNK_FRAMES at a time.
+vector<char> fullSubmitAs(const vector<short>& pcm, int nchannels, eFormat format)
+{
+   const size_t numSamples = pcm.size();
+   const size_t numFrames = numSamples / nchannels;
+
+   vector<float>         floats(numSamples);
+   vector<int>           ints(numSamples);
+   vector<unsigned char> packed(numSamples * 3);
+   vector< vector<float> > planes( nchannels, vector<float>(numFrames) );
+   for ( size_t i = 0; i < numSamples; ++i )
+   {
+      floats[i] = pcm[i] / 32768.0f;
+      ints[i] = pcm[i] * 65536;
+
+      const int s24 = pcm[i] * 256;
+      packed[i * 3] = static_cast<unsigned char>(s24);
+      packed[i * 3 + 1] = static_cast<unsigned char>(s24 >> 8);
+      packed[i * 3 + 2] = static_cast<unsigned char>(s24 >> 16);
+
+      planes[i % nchannels][i / nchannels] = floats[i];
+   }
+
+   FingerprintExtractor fextr;
+   fextr.initForFullSubmit(FORMAT_FREQ, nchannels);
+
+   bool done = false;
+   vector<const float*> ppChannels(nchannels);
+   for ( size_t frame = 0; frame < numFrames && !done; frame += FORMAT_CHUNK_FRAMES )
+   {
+      const size_t frames = min(FORMAT_CHUNK_FRAMES, numFrames - frame);
+      const size_t pos = frame * nchannels;
+      const size_t size = frames * nchannels;
+      const bool end = frame + frames >= numFrames;
+
+      switch ( format )
+      {
+      case FORMAT_SHORT:  done = fextr.process(&pcm[pos], size, end); break;
+      case FORMAT_FLOAT:  done = fextr.processFloat(&floats[pos], size, end); break;
+      case FORMAT_INT32:  done = fextr.processInt32(&ints[pos], size, end); break;
+      case FORMAT_INT24:  done = fextr.processInt24(&packed[pos * 3], size, end); break;
+      case FORMAT_PLANAR_FLOAT:
+         for ( int c = 0; c < nchannels; ++c )
+            ppChannels[c] = &planes[c][frame];
+         done = fextr.processPlanarFloat(&ppChannels[0], frames, end);
+         break;
+      }
+   }
+
+   pair<const char*, size_t> fp = fextr.getFingerprint();
+   if ( !done || !fp.first )
+      return vector<char>();
+   return vector<char>(fp.first, fp.first + fp.second);
+}
+
+// the stereo pcm three times over: six channels that mix down to the same
+vector<short> sixChannelsOf(const vector<short>& stereo)
+{
+   vector<short> six;
+   six.reserve(stereo.size() * 3);
+   for ( size_t i = 0; i + 1 < stereo.size(); i += 2 )
+   {
+      for ( int k = 0; k < 3; ++k )
+      {
+         six.push_back(stereo[i]);
+         six.push_back(stereo[i + 1]);
+      }
+   }
+   return six;
+}
+
+} // end of anonymous namespace
+
+// -----------------------------------------------------------------------------
+
+namespace fingerprint
+{
+
+// Every sample format, and more channels mixed down to the same signal,
+// must give the keys of process(const short*). Bit for bit in mono; with
+// more channels the 16 bits reader keeps the 1/32767 scale it always had,
+// where the others are full scale, and a very few keys flip (5 in 10000 here).
+bool testPCMFormatKeys()
+{
+   const vector<short> mono = makeTestSignal(FORMAT_FREQ, 1, FORMAT_SECS, 6);
+   const vector<short> stereo = makeTestSignal(FORMAT_FREQ, 2, FORMAT_SECS, 6);
+   const vector<short> six = sixChannelsOf(stereo);
+
+   const vector<unsigned int> monoKeys = keysOf( fullSubmitAs(mono, 1, FORMAT_SHORT) );
+   const vector<unsigned int> stereoKeys = keysOf( fullSubmitAs(stereo, 2, FORMAT_SHORT) );
+   const vector<unsigned int> fullScaleKeys = keysOf( fullSubmitAs(stereo, 2, FORMAT_FLOAT) );
+   TEST_CHECK( !monoKeys.empty() && !stereoKeys.empty() );
+   TEST_CHECK( keyMatchRate(stereoKeys, fullScaleKeys) >= MIN_FORMAT_KEY_MATCH );
+   TEST_CHECK( bitMatchRate(stereoKeys, fullScaleKeys) >= MIN_FORMAT_BIT_MATCH );
+
+   const eFormat formats[] = { FORMAT_SHORT, FORMAT_FLOAT, FORMAT_INT32, FORMAT_INT24, FORMAT_PLANAR_FLOAT };
+   for ( size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); ++f )
+   {
+      TEST_CHECK( keysOf( fullSubmitAs(mono, 1, formats[f]) ) == monoKeys );
+
+      const vector<unsigned int>& expected = formats[f] == FORMAT_SHORT ? stereoKeys : fullScaleKeys;
+      TEST_CHECK( keysOf( fullSubmitAs(stereo, 2, formats[f]) ) == expected );
+      TEST_CHECK( keysOf( fullSubmitAs(six, 6, formats[f]) ) == expected );
+   }
+
+   return true;
+}
+
+} // end of namespace fingerprint
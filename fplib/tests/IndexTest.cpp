@@ -0,0 +1,208 @@
+/***************************************************************************
+* This file is part of last.fm fingerprint app                             *
+*  Last.fm Ltd <mir@last.fm>                                               *
+*                                                                          *
+* This library is free software; you can redistribute it and/or            *
+* modify it under the terms of the GNU Lesser General Public               *
+* License as published by the Free Software Foundation; either             *
+* version 2.1 of the License, or (at your option) any later version.       *
+*                                                                          *
+* This library is distributed in the hope that it will be useful,          *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+* Lesser General Public License for more details.                          *
+*                                                                          *
+* You should have received a copy of the GNU Lesser General Public         *
+* License along with this library; if not, write to the Free Software      *
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 *
+* USA                                                                      *
+***************************************************************************/
+
+#include <cstdio>
+#include <stdexcept>
+
+#include "TestUtils.h"
+#include "FingerprintIndex.h"
+#include "FingerprintIndexFile.h"
+#include "OffsetVoter.h" // for OFFSET_BIN_KEYS
+
+// -----------------------------------------------------------------------------
+
+namespace
+{
+
+using namespace std;
+using namespace fingerprint;
+
+const size_t       INDEX_TRACKS = 200;
+const size_t       INDEX_GROUPS = 2000; // per track
+const unsigned int INDEX_KEYS = 50000;
+
+vector<char> makeFingerprint(unsigned int seed)
+{
+   return makeTestFingerprint(seed, INDEX_GROUPS, INDEX_KEYS);
+}
+
+vector<char> readFile(const char* fileName)
+{
+   vector<char> data;
+   FILE* pFile = fopen(fileName, "rb");
+   if ( !pFile )
+      return data;
+
+   char buf[4096];
+   size_t n;
+   while ( (n = fread(buf, 1, sizeof(buf), pFile)) > 0 )
+      data.insert(data.end(), buf, buf + n);
+   fclose(pFile);
+   return data;
+}
+
+// where group firstGroup of a track starts, in keys
+int offsetOf(const vector<char>& fp, size_t firstGroup)
+{
+   int offset = 0;
+   for ( size_t i = 0; i < firstGroup; ++i )
+      offset += static_cast<unsigned char>(fp[i * 8 + 4]);
+   return offset;
+}
+
+bool sameMatches(const vector<IndexMatch>& a, const vector<IndexMatch>& b)
+{
+   if ( a.size() != b.size() )
+      return false;
+   for ( size_t i = 0; i < a.size(); ++i )
+   {
+      if ( a[i].trackId != b[i].trackId || a[i].offset != b[i].offset || a[i].votes != b[i].votes )
+         return false;
+   }
+   return true;
+}
+
+} // end of anonymous namespace
+
+// -----------------------------------------------------------------------------
+
+namespace fingerprint
+{
+
+// A builder with little memory spills a lot of runs, and must still write
+// the same file of one that keeps everything in memory.
+bool testIndexFileSpill()
+{
+   const char* inMemoryName = "fplib_test_index_memory.tmp";
+   const char* spilledName = "fplib_test_index_spilled.tmp";
+
+   FingerprintIndexBuilder inMemory;
+   FingerprintIndexBuilder spilled(INDEX_GROUPS * 12 * 7 / 2); // a run every 3 tracks or so
+
+   for ( size_t t = 0; t < INDEX_TRACKS; ++t )
+   {
+      const vector<char> fp = makeFingerprint( static_cast<unsigned int>(t) );
+      inMemory.addTrack( static_cast<unsigned int>(t), &fp[0], fp.size() );
+      spilled.addTrack( static_cast<unsigned int>(t), &fp[0], fp.size() );
+   }
+
+   inMemory.write(inMemoryName);
+   spilled.write(spilledName);
+
+   const vector<char> inMemoryFile = readFile(inMemoryName);
+   const vector<char> spilledFile = readFile(spilledName);
+   TEST_CHECK( !inMemoryFile.empty() );
+   TEST_CHECK( spilledFile == inMemoryFile );
+
+   // a piece of a track finds it, at its offset
+   {
+      MappedFingerprintIndex index(spilledName);
+      TEST_CHECK( index.getNumTracks() == INDEX_TRACKS );
+
+      const unsigned int trackId = 123;
+      const vector<char> fp = makeFingerprint(trackId);
+      const size_t firstGroup = 500;
+
+      vector<IndexMatch> matches;
+      index.query( &fp[firstGroup * 8], 300 * 8, matches );
+      TEST_CHECK( !matches.empty() );
+      TEST_CHECK( matches[0].trackId == trackId );
+      TEST_CHECK( matches[0].offset == offsetOf(fp, firstGroup) );
+   }
+
+   // the runs are still there: more tracks, and written again
+   const vector<char> fp = makeFingerprint( static_cast<unsigned int>(INDEX_TRACKS) );
+   inMemory.addTrack( static_cast<unsigned int>(INDEX_TRACKS), &fp[0], fp.size() );
+   spilled.addTrack( static_cast<unsigned int>(INDEX_TRACKS), &fp[0], fp.size() );
+   inMemory.write(inMemoryName);
+   spilled.write(spilledName);
+   TEST_CHECK( readFile(spilledName) == readFile(inMemoryName) );
+
+   remove(inMemoryName);
+   remove(spilledName);
+   return true;
+}
+
+// -----------------------------------------------------------------------------
+
+// Pieces of the tracks of the in-memory index find them at their offset,
+// an unknown track finds nothing, and the file of the same tracks answers
+// the same.
+bool testIndexQuery()
+{
+   const char* fileName = "fplib_test_index_query.tmp";
+
+   FingerprintIndex index;
+   FingerprintIndexBuilder builder;
+   for ( size_t t = 0; t < INDEX_TRACKS; ++t )
+   {
+      const vector<char> fp = makeFingerprint( static_cast<unsigned int>(t) );
+      index.addTrack( static_cast<unsigned int>(t), &fp[0], fp.size() );
+      builder.addTrack( static_cast<unsigned int>(t), &fp[0], fp.size() );
+   }
+   TEST_CHECK( index.getNumTracks() == INDEX_TRACKS );
+   builder.write(fileName);
+
+   {
+      MappedFingerprintIndex mapped(fileName);
+
+      for ( unsigned int trackId = 0; trackId < INDEX_TRACKS; trackId += 37 )
+      {
+         const vector<char> fp = makeFingerprint(trackId);
+         const size_t firstGroup = (trackId * 13) % (INDEX_GROUPS - 300);
+
+         vector<IndexMatch> matches;
+         index.query( &fp[firstGroup * 8], 300 * 8, matches );
+         TEST_CHECK( !matches.empty() );
+         TEST_CHECK( matches[0].trackId == trackId );
+         // the offsets are voted in bins: as close as half a bin
+         const int offsetError = matches[0].offset - offsetOf(fp, firstGroup);
+         TEST_CHECK( offsetError >= -OFFSET_BIN_KEYS / 2 && offsetError <= OFFSET_BIN_KEYS / 2 );
+         TEST_CHECK( matches.size() == 1 || matches[1].votes < matches[0].votes / 4 );
+
+         vector<IndexMatch> mappedMatches;
+         mapped.query( &fp[firstGroup * 8], 300 * 8, mappedMatches );
+         TEST_CHECK( sameMatches(mappedMatches, matches) );
+      }
+
+      const vector<char> unknown = makeFingerprint( static_cast<unsigned int>(INDEX_TRACKS) );
+      vector<IndexMatch> matches;
+      index.query( &unknown[0], 300 * 8, matches );
+      TEST_CHECK( matches.empty() );
+   }
+
+   const vector<char> fp = makeFingerprint(0);
+   bool thrown = false;
+   try
+   {
+      index.addTrack( 0, &fp[0], fp.size() );
+   }
+   catch ( const std::runtime_error& )
+   {
+      thrown = true;
+   }
+   TEST_CHECK( thrown );
+   TEST_CHECK( index.getNumTracks() == INDEX_TRACKS );
+
+   remove(fileName);
+   return true;
+}
+
+} // end of namespace fingerprint
@@ -0,0 +1,85 @@
+/***************************************************************************
+* This file is part of last.fm fingerprint app                             *
+*  Last.fm Ltd <mir@last.fm>                                               *
+*                                                                          *
+* This library is free software; you can redistribute it and/or            *
+* modify it under the terms of the GNU Lesser General Public               *
+* License as published by the Free Software Foundation; either             *
+* version 2.1 of the License, or (at your option) any later version.       *
+*                                                                          *
+* This library is distributed in the hope that it will be useful,          *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+* Lesser General Public License for more details.                          *
+*                                                                          *
+* You should have received a copy of the GNU Lesser General Public         *
+* License along with this library; if not, write to the Free Software      *
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 *
+* USA                                                                      *
+***************************************************************************/
+
+#include "TestUtils.h"
+
+// -----------------------------------------------------------------------------
+
+namespace
+{
+
+using namespace std;
+using namespace fingerprint;
+
+const int RESET_FREQ = 44100;
+const int RESET_NCHANNELS = 2;
+
+// keeps what it's given, and counts the finish() calls
+class MemoryGroupSink : public GroupSink
+{
+public:
+   MemoryGroupSink() : numFinished(0) {}
+
+   void write(const char* data, size_t size)
+   { this->data.insert(this->data.end(), data, data + size); }
+
+   void finish()
+   { ++numFinished; }
+
+   vector<char> data;
+   int          numFinished;
+};
+
+} // end of anonymous namespace
+
+// -----------------------------------------------------------------------------
+
+namespace fingerprint
+{
+
+// After a full submit to a sink, reset() goes back to memory: the finished
+// sink gets nothing more, and the next track is the same as on a new extractor.
+bool testResetAfterSink()
+{
+   const vector<short> pcm1 = makeTestSignal(RESET_FREQ, RESET_NCHANNELS, 40, 10);
+   const vector<short> pcm2 = makeTestSignal(RESET_FREQ, RESET_NCHANNELS, 40, 11);
+
+   FingerprintExtractor reference;
+   reference.initForFullSubmit(RESET_FREQ, RESET_NCHANNELS);
+   const vector<char> fp1 = fingerprintOf(reference, &pcm1[0], pcm1.size());
+   reference.initForFullSubmit(RESET_FREQ, RESET_NCHANNELS);
+   const vector<char> fp2 = fingerprintOf(reference, &pcm2[0], pcm2.size());
+
+   MemoryGroupSink sink;
+   FingerprintExtractor fextr;
+   fextr.initForFullSubmit(RESET_FREQ, RESET_NCHANNELS, &sink);
+   fingerprintOf(fextr, &pcm1[0], pcm1.size());
+   TEST_CHECK( sink.data == fp1 );
+   TEST_CHECK( sink.numFinished == 1 );
+
+   fextr.reset();
+   TEST_CHECK( fingerprintOf(fextr, &pcm2[0], pcm2.size()) == fp2 );
+   TEST_CHECK( sink.data == fp1 );
+   TEST_CHECK( sink.numFinished == 1 );
+
+   return true;
+}
+
+} // end of namespace fingerprint
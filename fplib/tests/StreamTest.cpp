@@ -0,0 +1,166 @@
+/***************************************************************************
+* This file is part of last.fm fingerprint app                             *
+*  Last.fm Ltd <mir@last.fm>                                               *
+*                                                                          *
+* This library is free software; you can redistribute it and/or            *
+* modify it under the terms of the GNU Lesser General Public               *
+* License as published by the Free Software Foundation; either             *
+* version 2.1 of the License, or (at your option) any later version.       *
+*                                                                          *
+* This library is distributed in the hope that it will be useful,          *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+* Lesser General Public License for more details.                          *
+*                                                                          *
+* You should have received a copy of the GNU Lesser General Public         *
+* License along with this library; if not, write to the Free Software      *
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 *
+* USA                                                                      *
+***************************************************************************/
+
+#include "TestUtils.h"
+#include "fp_helper_fun.h"
+#include "Filter.h"
+
+// -----------------------------------------------------------------------------
+
+namespace
+{
+
+using namespace std;
+using namespace fingerprint;
+
+const int STREAM_FREQ = 44100;
+const int STREAM_NCHANNELS = 2;
+
+// Streams the first numSamples samples, chunkSamples at a time, and
+// collects what pollKeys() hands out. done is what the last process()
+// returned. The end_of_stream comes with the last chunk, or else in a
+// call of its own with no samples, as at the end of a decoder.
+vector<StreamGroup> streamOf( const vector<short>& pcm, size_t numSamples, bool& done,
+                              bool endWithoutSamples = false, bool fastResampling = false )
+{
+   const size_t chunkSamples = 8192;
+
+   FingerprintExtractor fextr;
+   fextr.setFastResampling(fastResampling);
+   fextr.initForStream(STREAM_FREQ, STREAM_NCHANNELS);
+
+   vector<StreamGroup> all, groups;
+   done = false;
+   for ( size_t pos = 0; pos < numSamples; pos += chunkSamples )
+   {
+      const size_t size = min(chunkSamples, numSamples - pos);
+      done = fextr.process(&pcm[pos], size, !endWithoutSamples && pos + size >= numSamples);
+      fextr.pollKeys(groups);
+      all.insert(all.end(), groups.begin(), groups.end());
+   }
+
+   if ( endWithoutSamples )
+   {
+      done = fextr.process(&pcm[0], 0, true);
+      fextr.pollKeys(groups);
+      all.insert(all.end(), groups.begin(), groups.end());
+   }
+   return all;
+}
+
+bool sameGroups(const vector<StreamGroup>& a, const vector<StreamGroup>& b)
+{
+   if ( a.size() != b.size() )
+      return false;
+
+   for ( size_t i = 0; i < a.size(); ++i )
+   {
+      if ( a[i].key != b[i].key || a[i].count != b[i].count || a[i].startMs != b[i].startMs )
+         return false;
+   }
+   return true;
+}
+
+vector<unsigned int> streamKeysOf(const vector<StreamGroup>& groups)
+{
+   vector<unsigned int> keys;
+   for ( size_t i = 0; i < groups.size(); ++i )
+      keys.insert(keys.end(), groups[i].count, groups[i].key);
+   return keys;
+}
+
+} // end of anonymous namespace
+
+// -----------------------------------------------------------------------------
+
+namespace fingerprint
+{
+
+// The last block of a stream is short, and the rest of it is padding: no key
+// may read past the end of the audio, and the keys before must be the ones of
+// a longer stream. (With the default blocks of ~12 secs; the small ones are
+// mostly covered by the normalization window that the block waits for.)
+// Ending the stream with a call of no samples must give the same keys, also
+// with the fixed ratio resampler (that has a tail to flush).
+bool testStreamKeysInAudio()
+{
+   const int secs = 45;
+   const vector<short> pcm = makeTestSignal(STREAM_FREQ, STREAM_NCHANNELS, secs, 8);
+
+   bool done = false;
+   const vector<unsigned int> longKeys = streamKeysOf( streamOf(pcm, pcm.size(), done) );
+   TEST_CHECK( done );
+
+   // how far after its time a key reads
+   const double frameMs = OVERLAPSAMPLES * 1000.0 / DFREQ;
+   const double keyReachMs = ((Filter::KEYWIDTH / 2) * OVERLAPSAMPLES + FRAMESIZE) * 1000.0 / DFREQ;
+
+   // the ends fall all over a block
+   for ( int i = 0; i < 8; ++i )
+   {
+      const double durationMs = 30000 + i * 1500;
+      const size_t numSamples = static_cast<size_t>(durationMs * STREAM_FREQ / 1000) * STREAM_NCHANNELS;
+
+      const vector<StreamGroup> groups = streamOf(pcm, numSamples, done);
+      TEST_CHECK( done );
+      TEST_CHECK( !groups.empty() );
+
+      const StreamGroup& last = groups.back();
+      const double lastKeyMs = last.startMs + (last.count - 1) * frameMs;
+      TEST_CHECK( lastKeyMs + keyReachMs <= durationMs + frameMs );
+
+      const vector<unsigned int> keys = streamKeysOf(groups);
+      TEST_CHECK( keys.size() <= longKeys.size() );
+      TEST_CHECK( bitMatchRate(keys, vector<unsigned int>(longKeys.begin(), longKeys.begin() + keys.size())) > 0.9 );
+
+      TEST_CHECK( sameGroups(streamOf(pcm, numSamples, done, true), groups) );
+      TEST_CHECK( done );
+
+      const vector<StreamGroup> fastGroups = streamOf(pcm, numSamples, done, false, true);
+      TEST_CHECK( sameGroups(streamOf(pcm, numSamples, done, true, true), fastGroups) );
+      TEST_CHECK( done );
+   }
+
+   return true;
+}
+
+// A stream that ends before its first block is over, with or without
+// samples in the last call.
+bool testStreamShortEnd()
+{
+   const vector<short> pcm = makeTestSignal(STREAM_FREQ, STREAM_NCHANNELS, 2, 9);
+
+   bool done = false;
+   const vector<StreamGroup> groups = streamOf(pcm, pcm.size(), done);
+   TEST_CHECK( done );
+   TEST_CHECK( groups.empty() );
+
+   FingerprintExtractor fextr;
+   fextr.initForStream(STREAM_FREQ, STREAM_NCHANNELS);
+   TEST_CHECK( !fextr.process(&pcm[0], pcm.size()) );
+   TEST_CHECK( fextr.process(&pcm[0], 0, true) );
+
+   vector<StreamGroup> polled;
+   TEST_CHECK( fextr.pollKeys(polled) == 0 );
+
+   return true;
+}
+
+} // end of namespace fingerprint
@@ -0,0 +1,120 @@
+/***************************************************************************
+* This file is part of last.fm fingerprint app                             *
+*  Last.fm Ltd <mir@last.fm>                                               *
+*                                                                          *
+* This library is free software; you can redistribute it and/or            *
+* modify it under the terms of the GNU Lesser General Public               *
+* License as published by the Free Software Foundation; either             *
+* version 2.1 of the License, or (at your option) any later version.       *
+*                                                                          *
+* This library is distributed in the hope that it will be useful,          *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+* Lesser General Public License for more details.                          *
+*                                                                          *
+* You should have received a copy of the GNU Lesser General Public         *
+* License along with this library; if not, write to the Free Software      *
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 *
+* USA                                                                      *
+***************************************************************************/
+
+// The fplib tests. Not part of the default build: configure with
+// -DFPLIB_BUILD_TESTS=ON, then run ctest or fplib_tests [test...].
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+namespace fingerprint
+{
+bool testBatchMatchesSingle();
+bool testCodecCorrupted();
+bool testCodecEmpty();
+bool testCodecRoundTrip();
+bool testCodecSSSE3Kernels();
+bool testConcurrentExtractors();
+bool testFastResamplingKeys();
+bool testFastResamplingFallback();
+bool testIndexFileSpill();
+bool testIndexQuery();
+bool testPCMFormatKeys();
+bool testResetAfterSink();
+bool testStreamKeysInAudio();
+bool testStreamShortEnd();
+}
+
+// -----------------------------------------------------------------------------
+
+namespace
+{
+
+struct TestCase
+{
+   const char* name;
+   bool (*run)();
+};
+
+const TestCase tests[] = {
+   { "batch_matches_single",  fingerprint::testBatchMatchesSingle },
+   { "codec_corrupted",       fingerprint::testCodecCorrupted },
+   { "codec_empty",           fingerprint::testCodecEmpty },
+   { "codec_round_trip",      fingerprint::testCodecRoundTrip },
+   { "codec_ssse3_kernels",   fingerprint::testCodecSSSE3Kernels },
+   { "concurrent_extractors", fingerprint::testConcurrentExtractors },
+   { "fast_resampling_keys",  fingerprint::testFastResamplingKeys },
+   { "fast_resampling_fallback", fingerprint::testFastResamplingFallback },
+   { "index_file_spill",      fingerprint::testIndexFileSpill },
+   { "index_query",           fingerprint::testIndexQuery },
+   { "pcm_format_keys",       fingerprint::testPCMFormatKeys },
+   { "reset_after_sink",      fingerprint::testResetAfterSink },
+   { "stream_keys_in_audio",  fingerprint::testStreamKeysInAudio },
+   { "stream_short_end",      fingerprint::testStreamShortEnd },
+};
+
+bool isSelected(const char* name, int argc, char* argv[])
+{
+   if ( argc < 2 )
+      return true;
+
+   for ( int i = 1; i < argc; ++i )
+   {
+      if ( strcmp(argv[i], name) == 0 )
+         return true;
+   }
+   return false;
+}
+
+} // end of anonymous namespace
+
+// -----------------------------------------------------------------------------
+
+// with arguments, only the tests named
+int main(int argc, char* argv[])
+{
+   int numFailed = 0;
+
+   for ( size_t i = 0; i < sizeof(tests) / sizeof(TestCase); ++i )
+   {
+      if ( !isSelected(tests[i].name, argc, argv) )
+         continue;
+
+      printf("%-28s ", tests[i].name);
+      fflush(stdout);
+
+      bool ok = false;
+      try
+      {
+         ok = tests[i].run();
+      }
+      catch ( const std::exception& e )
+      {
+         fprintf(stderr, "%s: %s\n", tests[i].name, e.what());
+      }
+
+      printf(ok ? "ok\n" : "FAILED\n");
+      if ( !ok )
+         ++numFailed;
+   }
+
+   return numFailed > 0 ? 1 : 0;
+}
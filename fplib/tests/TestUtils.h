@@ -0,0 +1,199 @@
+/***************************************************************************
+* This file is part of last.fm fingerprint app                             *
+*  Last.fm Ltd <mir@last.fm>                                               *
+*                                                                          *
+* This library is free software; you can redistribute it and/or            *
+* modify it under the terms of the GNU Lesser General Public               *
+* License as published by the Free Software Foundation; either             *
+* version 2.1 of the License, or (at your option) any later version.       *
+*                                                                          *
+* This library is distributed in the hope that it will be useful,          *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+* Lesser General Public License for more details.                          *
+*                                                                          *
+* You should have received a copy of the GNU Lesser General Public         *
+* License along with this library; if not, write to the Free Software      *
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 *
+* USA                                                                      *
+***************************************************************************/
+
+#ifndef __TEST_UTILS_H
+#define __TEST_UTILS_H
+
+// What the tests and the benchmarks share: a synthetic signal, the
+// fingerprint of a buffer, and a clock.
+
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <cstddef> // for size_t
+#include <algorithm>
+
+#ifdef WIN32
+#ifndef NOMINMAX
+#define NOMINMAX // keep std::min/max usable
+#endif
+#include <windows.h>
+#else
+#include <sys/time.h>
+#endif
+
+#include "FingerprintExtractor.h"
+
+namespace fingerprint
+{
+
+// -----------------------------------------------------------------------------
+
+// Fails the test (a function returning bool) with the line and the condition.
+#define TEST_CHECK(cond)                                                      \
+   do {                                                                       \
+      if ( !(cond) ) {                                                        \
+         fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+         return false;                                                        \
+      }                                                                       \
+   } while (0)
+
+// -----------------------------------------------------------------------------
+
+// Something music like: six tones that change every half second and fade
+// in and out, over a bit of noise. Different seeds give unrelated tracks.
+inline std::vector<short> makeTestSignal(int freq, int nchannels, int secs, unsigned int seed)
+{
+   const double PI = 3.14159265358979323846;
+
+   std::vector<short> pcm( static_cast<size_t>(freq) * nchannels * secs );
+   double phases[6] = { 0 };
+   unsigned int noise = seed;
+
+   for ( size_t i = 0; i < pcm.size() / nchannels; ++i )
+   {
+      const double t = static_cast<double>(i) / freq;
+      const unsigned int segment = static_cast<unsigned int>(t * 2);
+
+      double sample = 0;
+      for ( unsigned int k = 0; k < 6; ++k )
+      {
+         unsigned int h = (segment * 7919u + k * 104729u) ^ (seed * 2654435761u);
+         h ^= h >> 13;
+         h *= 0x5bd1e995u;
+         h ^= h >> 15;
+
+         phases[k] += 2 * PI * (200 + h % 1800) / freq;
+         sample += sin(phases[k]) * (0.5 + 0.5 * sin(t * (k + 1) * 0.7));
+      }
+
+      noise = noise * 1664525u + 1013904223u;
+      sample += ((noise >> 16) / 65536.0 - 0.5) * 0.3;
+
+      for ( int c = 0; c < nchannels; ++c )
+         pcm[i * nchannels + c] = static_cast<short>(sample * 3000 + c * 17);
+   }
+
+   return pcm;
+}
+
+// -----------------------------------------------------------------------------
+
+// A made up full submit, for the indexes: numGroups groups of 1 to 4 keys,
+// out of numKeys different keys (few enough, and the tracks share a lot).
+inline std::vector<char> makeTestFingerprint(unsigned int seed, size_t numGroups, unsigned int numKeys)
+{
+   std::vector<char> fp(numGroups * 8);
+   unsigned char* p = reinterpret_cast<unsigned char*>( fp.empty() ? NULL : &fp[0] );
+
+   unsigned int r = seed * 2654435761u + 1;
+   for ( size_t i = 0; i < numGroups; ++i, p += 8 )
+   {
+      r = r * 1664525u + 1013904223u;
+      const unsigned int key = (r >> 8) % numKeys * 86011u;
+      const unsigned int count = 1 + (r >> 4) % 4;
+      for ( int b = 0; b < 4; ++b )
+      {
+         p[b] = static_cast<unsigned char>(key >> (b * 8));
+         p[4 + b] = static_cast<unsigned char>(count >> (b * 8));
+      }
+   }
+   return fp;
+}
+
+// -----------------------------------------------------------------------------
+
+// Feeds numSamples samples to an initialized extractor, chunkSamples at a
+// time, and returns the fingerprint (empty if it wanted more data).
+inline std::vector<char> fingerprintOf( FingerprintExtractor& fextr, const short* pPCM, 
+                                        size_t numSamples, size_t chunkSamples = 8192 )
+{
+   bool done = false;
+   for ( size_t pos = 0; pos < numSamples && !done; pos += chunkSamples )
+   {
+      const size_t size = std::min(chunkSamples, numSamples - pos);
+      done = fextr.process(pPCM + pos, size, pos + size >= numSamples);
+   }
+
+   std::pair<const char*, size_t> fp = fextr.getFingerprint();
+   if ( !done || !fp.first )
+      return std::vector<char>();
+   return std::vector<char>(fp.first, fp.first + fp.second);
+}
+
+// The key of every frame of a fingerprint (the groups expanded).
+inline std::vector<unsigned int> keysOf(const std::vector<char>& fp)
+{
+   std::vector<unsigned int> keys;
+   const unsigned char* p = reinterpret_cast<const unsigned char*>( fp.empty() ? NULL : &fp[0] );
+   for ( size_t i = 0; i + 8 <= fp.size(); i += 8 )
+   {
+      const unsigned int key = p[i] | (p[i+1] << 8) | (p[i+2] << 16) | (static_cast<unsigned int>(p[i+3]) << 24);
+      const unsigned int count = p[i+4] | (p[i+5] << 8) | (p[i+6] << 16) | (static_cast<unsigned int>(p[i+7]) << 24);
+      keys.insert(keys.end(), count, key);
+   }
+   return keys;
+}
+
+// The fraction of frames with the same key, comparing a[i] with b[i + shift].
+inline double keyMatchRate(const std::vector<unsigned int>& a, const std::vector<unsigned int>& b, int shift = 0)
+{
+   size_t same = 0, total = 0;
+   for ( size_t i = std::max(-shift, 0); i < a.size() && i + shift < b.size(); ++i, ++total )
+      same += a[i] == b[i + shift];
+   return total > 0 ? static_cast<double>(same) / total : 0;
+}
+
+// The fraction of the key bits that agree, frame by frame: two unrelated
+// tracks agree on about half of them.
+inline double bitMatchRate(const std::vector<unsigned int>& a, const std::vector<unsigned int>& b)
+{
+   size_t same = 0;
+   const size_t n = std::min(a.size(), b.size());
+   for ( size_t i = 0; i < n; ++i )
+   {
+      for ( unsigned int diff = ~(a[i] ^ b[i]); diff; diff &= diff - 1 )
+         ++same;
+   }
+   return n > 0 ? same / (32.0 * n) : 0;
+}
+
+// -----------------------------------------------------------------------------
+
+// Wall clock time in seconds.
+inline double wallClock()
+{
+#ifdef WIN32
+   LARGE_INTEGER freq, count;
+   QueryPerformanceFrequency(&freq);
+   QueryPerformanceCounter(&count);
+   return static_cast<double>(count.QuadPart) / static_cast<double>(freq.QuadPart);
+#else
+   timeval tv;
+   gettimeofday(&tv, NULL);
+   return tv.tv_sec + tv.tv_usec * 1e-6;
+#endif
+}
+
+// -----------------------------------------------------------------------------
+
+} // end of namespace fingerprint
+
+#endif // __TEST_UTILS_H
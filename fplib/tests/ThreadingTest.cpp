@@ -0,0 +1,134 @@
+/***************************************************************************
+* This file is part of last.fm fingerprint app                             *
+*  Last.fm Ltd <mir@last.fm>                                               *
+*                                                                          *
+* This library is free software; you can redistribute it and/or            *
+* modify it under the terms of the GNU Lesser General Public               *
+* License as published by the Free Software Foundation; either             *
+* version 2.1 of the License, or (at your option) any later version.       *
+*                                                                          *
+* This library is distributed in the hope that it will be useful,          *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+* Lesser General Public License for more details.                          *
+*                                                                          *
+* You should have received a copy of the GNU Lesser General Public         *
+* License along with this library; if not, write to the Free Software      *
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 *
+* USA                                                                      *
+***************************************************************************/
+
+#include <map>
+#include <string>
+#include <stdexcept>
+
+#include "TestUtils.h"
+#include "Threading.h"
+
+// -----------------------------------------------------------------------------
+
+namespace
+{
+
+using namespace std;
+using namespace fingerprint;
+
+const int    STRESS_FREQ = 44100;
+const int    STRESS_NCHANNELS = 2;
+const int    STRESS_SECS = 40; // enough for a query
+const size_t STRESS_THREADS = 8;
+const size_t STRESS_RUNS = 3;  // per thread
+
+// The block size of a run. None of them is the default one, so their FFT
+// plans are all made during the test, while the other threads are planning
+// or transforming; a few runs share a size and race for the same plan.
+unsigned int blockFramesOf(size_t thread, size_t run)
+{
+   return 7 + static_cast<unsigned int>( (thread * STRESS_RUNS + run) % 16 );
+}
+
+// every other run is a query
+vector<char> fingerprintRun(const vector<short>& pcm, unsigned int blockFrames, size_t run)
+{
+   FingerprintExtractor fextr(blockFrames);
+   if ( run % 2 )
+      fextr.initForQuery(STRESS_FREQ, STRESS_NCHANNELS);
+   else
+      fextr.initForFullSubmit(STRESS_FREQ, STRESS_NCHANNELS);
+
+   return fingerprintOf(fextr, &pcm[0], pcm.size());
+}
+
+struct StressJob
+{
+   const vector<short>*   pPCM;
+   size_t                 thread;
+   vector< vector<char> > fingerprints; // of every run
+   string                 error;
+};
+
+void stressMain(void* pArg)
+{
+   StressJob& job = *static_cast<StressJob*>(pArg);
+   try
+   {
+      for ( size_t run = 0; run < STRESS_RUNS; ++run )
+         job.fingerprints.push_back( fingerprintRun(*job.pPCM, blockFramesOf(job.thread, run), run) );
+   }
+   catch ( const std::exception& e )
+   {
+      job.error = e.what();
+   }
+}
+
+} // end of anonymous namespace
+
+// -----------------------------------------------------------------------------
+
+namespace fingerprint
+{
+
+// Many threads building and running extractors at once, with no lock
+// around them, must get the same fingerprints of a single thread.
+bool testConcurrentExtractors()
+{
+   const vector<short> pcm = makeTestSignal(STRESS_FREQ, STRESS_NCHANNELS, STRESS_SECS, 1);
+
+   StressJob jobs[STRESS_THREADS];
+   Thread threads[STRESS_THREADS];
+   for ( size_t i = 0; i < STRESS_THREADS; ++i )
+   {
+      jobs[i].pPCM = &pcm;
+      jobs[i].thread = i;
+      threads[i].start(stressMain, &jobs[i]);
+   }
+
+   for ( size_t i = 0; i < STRESS_THREADS; ++i )
+      threads[i].join();
+
+   // the same runs again, one at a time
+   map< pair<unsigned int, size_t>, vector<char> > references;
+
+   for ( size_t i = 0; i < STRESS_THREADS; ++i )
+   {
+      if ( !jobs[i].error.empty() )
+         fprintf(stderr, "thread %u: %s\n", static_cast<unsigned int>(i), jobs[i].error.c_str());
+      TEST_CHECK( jobs[i].error.empty() );
+      TEST_CHECK( jobs[i].fingerprints.size() == STRESS_RUNS );
+
+      for ( size_t run = 0; run < STRESS_RUNS; ++run )
+      {
+         const unsigned int blockFrames = blockFramesOf(i, run);
+         const pair<unsigned int, size_t> id(blockFrames, run % 2);
+         if ( references.find(id) == references.end() )
+            references[id] = fingerprintRun(pcm, blockFrames, run);
+
+         TEST_CHECK( !jobs[i].fingerprints[run].empty() );
+         TEST_CHECK( jobs[i].fingerprints[run] == references[id] );
+      }
+   }
+
+   return true;
+}
+
+} // end of namespace fingerprint
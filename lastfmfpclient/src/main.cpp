@@ -20,6 +20,7 @@
 
 // for fingerprint
 #include "../../fplib/include/FingerprintExtractor.h"
+#include "../../fplib/include/BatchFingerprinter.h"
 
 #include <sndfile.hh>
 #include <cmath>
@@ -44,6 +45,7 @@
 #include <cctype> // for tolower
 #include <algorithm>
 #include <map>
+#include <vector>
 
 using namespace std;
 
@@ -141,6 +143,151 @@ string fetchMetadata(int fpid, HTTPClient& client, bool justURL)
   return c;
 }
 
+// -----------------------------------------------------------------------------
+
+// send the fingerprint data and get either the metadata or the fingerprint ID
+string queryServer(HTTPClient& client, const string& serverName,
+    const map<std::string, std::string>& urlParams,
+    const char* pFpData, size_t fpDataSize,
+    bool wantMetadata, bool justUrl)
+{
+  string c = client.postRawObj(
+    serverName, urlParams, pFpData, fpDataSize, HTTP_POST_DATA_NAME, false);
+
+  int fpid;
+  istringstream iss(c);
+  iss >> fpid;
+
+  if ( !wantMetadata && iss.fail() )
+    c = "-1 FAIL"; // let's keep it parseable: we had an error!
+  else if ( wantMetadata && !iss.fail() )
+  {
+    // if there was no error and it wants metadata
+    string state;
+    iss >> state;
+    if ( state == "FOUND" )
+      c = fetchMetadata(fpid, client, justUrl);
+    else if ( state == "NEW" )
+    {
+      cout << "Was not found! Now added, thanks! :)" << endl;
+      c.clear();
+    }
+  }
+
+  // if iss.fail() this will display the error, otherwise it will display
+  // metadata or the id
+  return c;
+}
+
+// -----------------------------------------------------------------------------
+
+// feeds a wav file to the BatchFingerprinter
+class SndfileSource : public fingerprint::PCMSource
+{
+public:
+  SndfileSource(const string& fileName)
+    : m_fileName(fileName), m_handle(fileName)
+  {}
+
+  int getFreq() const         { return m_handle.samplerate(); }
+  int getNumChannels() const  { return m_handle.channels(); }
+  int getDuration() const     { return static_cast<int>(ceil(m_handle.frames() / m_handle.samplerate())); }
+
+  size_t read(short* pPCM, size_t num_samples)
+  {
+    // keep whole frames only
+    num_samples -= num_samples % m_handle.channels();
+    return static_cast<size_t>(m_handle.read(pPCM, num_samples));
+  }
+
+  const string& getFileName() const { return m_fileName; }
+
+private:
+  string        m_fileName;
+  SndfileHandle m_handle;
+};
+
+// -----------------------------------------------------------------------------
+
+// fingerprint all the files concurrently (one worker per core) and query them
+// as they get ready
+int runBatch(const vector<string>& fileNames, const string& serverName,
+    const map<std::string, std::string>& urlParams,
+    bool wantMetadata, bool justUrl, bool debug)
+{
+  vector<SndfileSource*> sources;
+  vector<fingerprint::PCMSource*> pcmSources;
+  int failures = 0;
+
+  for ( size_t i = 0; i < fileNames.size(); ++i )
+  {
+    ifstream checkFile(fileNames[i].c_str(), ios::binary);
+    if ( !checkFile.is_open() )
+    {
+      cerr << "ERROR: Cannot find file <" << fileNames[i] << ">!" << endl;
+      ++failures;
+      continue;
+    }
+
+    SndfileSource* pSource = new SndfileSource(fileNames[i]);
+    if ( pSource->getDuration() < 30 )
+    {
+      cerr << "ERROR: Song duration is too short <" << fileNames[i] << ">!" << endl;
+      delete pSource;
+      ++failures;
+      continue;
+    }
+
+    sources.push_back(pSource);
+    pcmSources.push_back(pSource);
+  }
+
+  fingerprint::BatchFingerprinter batch;
+  batch.start(pcmSources);
+
+  HTTPClient client;
+  fingerprint::BatchResult res;
+
+  while ( batch.getNextResult(res) )
+  {
+    const SndfileSource& source = *sources[res.index];
+
+    if ( !res.success )
+    {
+      cerr << "ERROR: <" << source.getFileName() << ">: " << res.error << endl;
+      ++failures;
+      continue;
+    }
+
+    map<std::string, std::string> params = urlParams;
+    params["duration"]   = toString(source.getDuration()); // this is absolutely mandatory
+    params["samplerate"] = toString(source.getFreq());
+    params["fpversion"]  = toString(fingerprint::FingerprintExtractor::getVersion());
+
+    if ( debug )
+      cout << "Fingerprinted <" << source.getFileName() << "> (" << res.fingerprint.size() << " bytes)" << endl;
+
+    try
+    {
+      cout << source.getFileName() << "\n"
+           << queryServer(client, serverName, params,
+                          &res.fingerprint[0], res.fingerprint.size(),
+                          wantMetadata, justUrl)
+           << endl;
+    }
+    catch (const std::exception& e)
+    {
+      cerr << "ERROR: <" << source.getFileName() << ">: " << e.what() << endl;
+      ++failures;
+    }
+  }
+
+  for ( size_t i = 0; i < sources.size(); ++i )
+    delete sources[i];
+
+  return failures ? 1 : 0;
+}
+
 // -----------------------------------------------------------------------------
 // -----------------------------------------------------------------------------
 
@@ -161,10 +308,11 @@ int main(int argc, char* argv[])
       fileName = fileName.substr(lastSlash+1);
 
     cout << fileName << " (" << PUBLIC_CLIENT_NAME << ")\n"
-      << "Usage:\n" << fileName << " [options] yourWavFile.wav\n\n";
+      << "Usage:\n" << fileName << " [options] yourWavFile.wav [moreWavFiles.wav ...]\n\n";
     exit(0);
   }
 
+  vector<string> wav_file_names;
   string wav_file_name;
   int duration, samplerate, nchannels;
   string artist;
@@ -187,7 +335,7 @@ int main(int argc, char* argv[])
   {
     if ( argv[i][0] != '-' )
     {
-      wav_file_name = argv[i]; // assume it's the filename
+      wav_file_names.push_back(argv[i]); // assume it's the filename
       continue;
     }
 
@@ -232,6 +380,19 @@ int main(int argc, char* argv[])
 
   //////////////////////////////////////////////////////////////////////////
 
+  if ( wav_file_names.empty() )
+  {
+    cerr << "ERROR: No file given!" << endl;
+    exit(1);
+  }
+
+  urlParams["username"]   = PUBLIC_CLIENT_NAME; // replace with username if possible
+
+  if ( wav_file_names.size() > 1 )
+    return runBatch(wav_file_names, serverName, urlParams, wantMetadata, justUrl, debug);
+
+  wav_file_name = wav_file_names[0];
+
   {
     // check if it exists
     ifstream checkFile(wav_file_name.c_str(), ios::binary);
@@ -258,14 +419,22 @@ int main(int argc, char* argv[])
   // If you don't specify the right duration you will not get the correct result!
   // This has to be passed in.
   urlParams["duration"]   = toString(duration); // this is absolutely mandatory
-  urlParams["username"]   = PUBLIC_CLIENT_NAME; // replace with username if possible
   urlParams["samplerate"] = toString(samplerate);
 
 
   // This will extract the fingerprint
-  // IMPORTANT: FingerprintExtractor assumes the data starts from the beginning of the file!
+  // The query skips the first seconds of the track, so jump straight to the
+  // part it needs, and tell the extractor where the data starts.
   fingerprint::FingerprintExtractor fextr;
-  fextr.initForQuery(samplerate, nchannels, duration); // initialize for query
+  const pair<size_t, size_t> queryRange = fextr.getQueryRange(samplerate, nchannels, duration);
+  if ( infile.seek(static_cast<sf_count_t>(queryRange.first), SEEK_SET) == static_cast<sf_count_t>(queryRange.first) )
+    fextr.initForQuery(samplerate, nchannels, duration, queryRange.first); // initialize for query
+  else
+  {
+    // not seekable: read from the start
+    infile.seek(0, SEEK_SET);
+    fextr.initForQuery(samplerate, nchannels, duration); // initialize for query
+  }
 
   size_t version = fextr.getVersion();
   // wow, that's odd.. If I god directly with getVersion I get a strange warning with VS2005.. :P
@@ -309,35 +478,10 @@ int main(int argc, char* argv[])
       cout << endl;
     }
 
-    // send the fingerprint data, and get the fingerprint ID
+    // send the fingerprint data, and get the fingerprint ID (or the metadata)
     HTTPClient client;
-    string c = client.postRawObj(
-      serverName, urlParams, fpData.first, fpData.second, HTTP_POST_DATA_NAME, false);
-
-    int fpid;
-    istringstream iss(c);
-    iss >> fpid;
-
-    if ( !wantMetadata && iss.fail() )
-      c = "-1 FAIL"; // let's keep it parseable: we had an error!
-    else if ( wantMetadata && !iss.fail() )
-    {
-      // if there was no error and it wants metadata
-      string state;
-      iss >> state;
-      if ( state == "FOUND" )
-        c = fetchMetadata(fpid, client, justUrl);
-      else if ( state == "NEW" )
-      {
-        cout << "Was not found! Now added, thanks! :)" << endl;
-        c.clear();
-      }
-    }
-
-    // if iss.fail() this will display the error, otherwise it will display
-    // metadata or the id
-
-    cout << c;
+    cout << queryServer(client, serverName, urlParams, fpData.first, fpData.second,
+                        wantMetadata, justUrl);
 
   }
   catch (const std::exception& e)